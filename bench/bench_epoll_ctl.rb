@@ -0,0 +1,60 @@
+# -*- encoding: binary -*-
+# epoll_ctl add/mod/del throughput, single-threaded and with several
+# threads sharing one epoll descriptor
+require File.expand_path('../helper', __FILE__)
+include SleepyPenguin
+
+nthr = Integer(ENV['BENCH_THREADS'] || 4)
+SPBench.header('epoll_ctl (ops are add+mod+del cycles)')
+pairs = SPBench.pipes(64)
+rds = pairs.map { |r, _| r }
+ops = SPBench.ops(64)
+
+ep = Epoll.new
+SPBench.run('Epoll#add/mod/del', ops) do |i|
+  io = rds[i & 63]
+  ep.add(io, Epoll::IN)
+  ep.mod(io, Epoll::OUT)
+  ep.del(io)
+end
+SPBench.run('Epoll#set x2 (second is a no-op)', ops) do |i|
+  io = rds[i & 63]
+  ep.set(io, Epoll::IN)
+  ep.set(io, Epoll::IN)
+  ep.del(io)
+end
+
+epio = Epoll::IO.new(Epoll::CLOEXEC)
+add = rds.map { |io| [ Epoll::CTL_ADD, io, Epoll::IN ] }
+mod = rds.map { |io| [ Epoll::CTL_MOD, io, Epoll::OUT ] }
+del = rds.map { |io| [ Epoll::CTL_DEL, io, 0 ] }
+SPBench.run('Epoll::IO#epoll_ctl', ops) do |i|
+  io = rds[i & 63]
+  epio.epoll_ctl(Epoll::CTL_ADD, io, Epoll::IN)
+  epio.epoll_ctl(Epoll::CTL_MOD, io, Epoll::OUT)
+  epio.epoll_ctl(Epoll::CTL_DEL, io, 0)
+end
+SPBench.run_samples('Epoll::IO#epoll_ctl_batch x64', 64) do
+  epio.epoll_ctl_batch(add)
+  epio.epoll_ctl_batch(mod)
+  epio.epoll_ctl_batch(del)
+end
+
+# each thread works on its own descriptors, only the epoll fd is shared
+per = 64 / nthr
+SPBench.run_samples("Epoll#add/mod/del #{nthr} threads", ops) do
+  Array.new(nthr) do |t|
+    mine = rds[t * per, per]
+    Thread.new do
+      (ops / nthr).times do |i|
+        io = mine[i % per]
+        ep.add(io, Epoll::IN)
+        ep.mod(io, Epoll::OUT)
+        ep.del(io)
+      end
+    end
+  end.each(&:join)
+end
+ep.close
+epio.close
+SPBench.close(pairs)
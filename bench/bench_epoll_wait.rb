@@ -0,0 +1,41 @@
+# -*- encoding: binary -*-
+# epoll_wait throughput with N descriptors which are always readable,
+# compared against IO.select and IO#wait_readable on the same descriptors
+require File.expand_path('../helper', __FILE__)
+require 'io/wait'
+include SleepyPenguin
+
+SPBench.header('epoll_wait with N ready descriptors (ops are waits)')
+[ 1, 16, 256 ].each do |n|
+  { 'pipe' => SPBench.pipes(n),
+    'socketpair' => SPBench.socketpairs(n) }.each do |type, pairs|
+    rds = pairs.map { |r, w| w.write('.'); r }
+    ops = SPBench.ops(4096 / n + 1)
+
+    ep = Epoll.new
+    rds.each { |io| ep.add(io, Epoll::IN) }
+    SPBench.run("Epoll#wait #{type} x#{n}", ops) do
+      ep.wait(n, 0) { |events, io| }
+    end
+    ary = []
+    SPBench.run("Epoll#wait_into #{type} x#{n}", ops) do
+      ep.wait_into(ary, n, 0)
+    end
+    ep.close
+
+    epio = Epoll::IO.new(Epoll::CLOEXEC)
+    rds.each { |io| epio.epoll_ctl(Epoll::CTL_ADD, io, Epoll::IN) }
+    SPBench.run("Epoll::IO#epoll_wait_into #{type} x#{n}", ops) do
+      epio.epoll_wait_into(ary, n, 0)
+    end
+    epio.close
+
+    SPBench.run("IO.select #{type} x#{n}", ops) do
+      IO.select(rds, nil, nil, 0)
+    end
+    SPBench.run("IO#wait_readable #{type} x#{n}", ops) do
+      rds.each { |io| io.wait_readable(0) }
+    end
+    SPBench.close(pairs)
+  end
+end
@@ -0,0 +1,53 @@
+# -*- encoding: binary -*-
+# EventFD ping-pong latency between threads and between processes,
+# compared against a pair of pipes
+require File.expand_path('../helper', __FILE__)
+include SleepyPenguin
+
+n = SPBench.ops(5000)
+SPBench.header('ping-pong round trips (ns per round trip)')
+
+ping = EventFD.new(0, :CLOEXEC)
+pong = EventFD.new(0, :CLOEXEC)
+thr = Thread.new { loop { ping.value; pong.incr(1) } }
+SPBench.latency('EventFD threads', n) do
+  t0 = SPBench.now
+  ping.incr(1)
+  pong.value
+  SPBench.now - t0
+end
+thr.kill.join
+
+pid = fork { loop { ping.value; pong.incr(1) } }
+SPBench.latency('EventFD processes', n) do
+  t0 = SPBench.now
+  ping.incr(1)
+  pong.value
+  SPBench.now - t0
+end
+Process.kill(:KILL, pid)
+Process.waitpid(pid)
+SPBench.close(ping, pong)
+
+a, b = IO.pipe, IO.pipe
+dot = '.'.freeze
+buf = ''.b
+thr = Thread.new { loop { a[0].readpartial(1); b[1].write(dot) } }
+SPBench.latency('pipe threads', n) do
+  t0 = SPBench.now
+  a[1].write(dot)
+  b[0].readpartial(1, buf)
+  SPBench.now - t0
+end
+thr.kill.join
+
+pid = fork { loop { a[0].readpartial(1); b[1].write(dot) } }
+SPBench.latency('pipe processes', n) do
+  t0 = SPBench.now
+  a[1].write(dot)
+  b[0].readpartial(1, buf)
+  SPBench.now - t0
+end
+Process.kill(:KILL, pid)
+Process.waitpid(pid)
+SPBench.close(a, b)
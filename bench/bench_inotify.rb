@@ -0,0 +1,33 @@
+# -*- encoding: binary -*-
+# Inotify events/sec while files are created and removed in a watched
+# directory as quickly as possible
+require File.expand_path('../helper', __FILE__)
+require 'tmpdir'
+include SleepyPenguin
+
+nfiles = SPBench.ops(128)
+ops = nfiles * 2 # one IN_CREATE and one IN_DELETE per file
+SPBench.header('Inotify file creation storm (ops are events)')
+Dir.mktmpdir('sp-bench') do |dir|
+  paths = Array.new(nfiles) { |i| "#{dir}/#{i}" }
+  storm = lambda do
+    paths.each { |p| File.open(p, 'w').close }
+    paths.each { |p| File.unlink(p) }
+  end
+
+  ino = Inotify.new(:CLOEXEC)
+  ino.add_watch(dir, [ :CREATE, :DELETE ])
+  SPBench.run_samples('Inotify#take', ops) do
+    storm.call
+    ops.times { ino.take }
+  end
+  SPBench.run_samples('Inotify#each', ops) do
+    storm.call
+    nr = 0
+    ino.each { (nr += 1) == ops and break }
+  end
+  ino.close
+
+  # the same storm, unwatched, to subtract the cost of creating files
+  SPBench.run_samples('(file creation alone)', ops) { storm.call }
+end
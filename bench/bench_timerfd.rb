@@ -0,0 +1,49 @@
+# -*- encoding: binary -*-
+# TimerFD expiration jitter: how late wakeups are relative to when a
+# periodic timer was due to expire (ns late per expiration)
+require File.expand_path('../helper', __FILE__)
+include SleepyPenguin
+
+interval = Float(ENV['BENCH_INTERVAL'] || 0.001)
+n = SPBench.ops(2000)
+SPBench.header("timer wakeup lateness, #{interval}s interval")
+ival = (interval * 1e9).to_i
+
+[ :MONOTONIC, :REALTIME ].each do |clock|
+  tfd = TimerFD.new(clock)
+  due = nil
+  SPBench.latency("TimerFD #{clock} expirations", n) do
+    unless due
+      tfd.settime(nil, interval, interval)
+      due = SPBench.now + ival
+    end
+    nr = tfd.expirations
+    late = SPBench.now - due
+    due += ival * nr
+    late
+  end
+  tfd.close
+end
+
+due = nil
+SPBench.latency('sleep', n) do
+  due = SPBench.now + ival
+  sleep(interval)
+  SPBench.now - due
+end
+
+ep = Epoll.new
+tfd = TimerFD.new(:MONOTONIC)
+ep.add(tfd, Epoll::IN)
+due = nil
+SPBench.latency('TimerFD via Epoll#wait', n) do
+  unless due
+    tfd.settime(nil, interval, interval)
+    due = SPBench.now + ival
+  end
+  ep.wait(1) { |_, io| }
+  late = SPBench.now - due
+  due += ival * tfd.expirations
+  late
+end
+SPBench.close(ep, tfd)
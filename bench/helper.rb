@@ -0,0 +1,108 @@
+# -*- encoding: binary -*-
+# Shared helpers for bench/bench_*.rb, run them with "make bench" or
+# individually with "ruby -I lib bench/bench_epoll_wait.rb" after "make build".
+#
+# Environment knobs (all optional):
+#   BENCH_ROUNDS - number of samples taken per benchmark (default: 200)
+#   BENCH_SCALE  - multiplier for the ops done per sample (default: 1)
+#   BENCH_ONLY   - only run benchmarks whose label matches this Regexp
+#
+# Each sample times a fixed number of operations and the report shows
+# per-operation latency percentiles across all samples, throughput, and
+# objects allocated per operation according to GC.stat.  GC is disabled
+# while sampling so collection pauses do not end up in the percentiles.
+require 'sleepy_penguin'
+
+module SPBench
+  ROUNDS = Integer(ENV['BENCH_ROUNDS'] || 200)
+  SCALE = Float(ENV['BENCH_SCALE'] || 1)
+  ONLY = ENV['BENCH_ONLY'] ? Regexp.new(ENV['BENCH_ONLY']) : nil
+  PCTS = [ 50, 90, 99, 99.9 ]
+
+  def self.now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+  end
+
+  def self.allocated
+    GC.stat(:total_allocated_objects)
+  end
+
+  def self.ops(n)
+    n = (n * SCALE).to_i
+    n > 0 ? n : 1
+  end
+
+  def self.header(title)
+    puts "== #{title}"
+    printf("%-40s %12s %9s %9s %9s %9s %8s\n",
+           'benchmark', 'ops/s', *PCTS.map { |p| "p#{p}(ns)" }, 'alloc/op')
+  end
+
+  # yields +ops+ times per sample, after one untimed warmup sample
+  def self.run(label, ops)
+    run_samples(label, ops) { ops.times { |i| yield i } }
+  end
+
+  # like run, but the block performs +ops+ operations itself
+  def self.run_samples(label, ops)
+    return if ONLY && ONLY !~ label
+    samples = Array.new(ROUNDS)
+    yield
+    GC.start
+    GC.disable
+    a0 = allocated
+    total = 0
+    ROUNDS.times do |r|
+      t0 = now
+      yield
+      samples[r] = now - t0
+      total += samples[r]
+    end
+    alloc = allocated - a0
+    GC.enable
+    report(label, samples, ops, total, alloc)
+  end
+
+  # for latency benchmarks, the block returns the nanoseconds of one op
+  def self.latency(label, n)
+    return if ONLY && ONLY !~ label
+    samples = Array.new(n)
+    yield
+    GC.start
+    GC.disable
+    a0 = allocated
+    total = 0
+    n.times do |i|
+      samples[i] = yield
+      total += samples[i]
+    end
+    alloc = allocated - a0
+    GC.enable
+    report(label, samples, 1, total, alloc)
+  end
+
+  def self.report(label, samples, ops, total, alloc)
+    samples.sort!
+    nops = samples.size * ops
+    pct = PCTS.map do |p|
+      i = (samples.size * p / 100.0).ceil - 1
+      samples[i < 0 ? 0 : i] / ops
+    end
+    printf("%-40s %12.0f %9d %9d %9d %9d %8.2f\n",
+           label, nops * 1e9 / total, *pct, alloc.to_f / nops)
+    $stdout.flush
+  end
+
+  def self.pipes(n)
+    Array.new(n) { IO.pipe }
+  end
+
+  def self.socketpairs(n)
+    require 'socket'
+    Array.new(n) { UNIXSocket.pair }
+  end
+
+  def self.close(*ios)
+    ios.flatten.each { |io| io.close unless io.closed? }
+  end
+end
@@ -0,0 +1,261 @@
+# -*- encoding: binary -*-
+# Long-running soak test for SleepyPenguin::Epoll, run it with "make soak".
+#
+# Many waiter threads share one Epoll watching the readable ends of many
+# socketpairs with ONESHOT.  Writer threads send monotonic timestamps
+# into random pairs, and a churn thread constantly replaces pairs,
+# sometimes with Epoll#del before closing, sometimes closing registered
+# descriptors outright (like test/test_epoll_gc.rb does) so the epoll
+# registration table sees stale entries.
+#
+# Every SOAK_INTERVAL seconds, one line is printed with event throughput,
+# wakeup latency percentiles (time from write to the waiter reading the
+# timestamp), Jain's fairness index of wakeups across waiter threads,
+# RSS, GC time and the size of the Epoll registration table.  At the
+# end, it exits with a failure if fairness dropped below SOAK_FAIRNESS
+# or RSS or the registration table grew by more than SOAK_GROWTH (as a
+# fraction) after the first interval.
+#
+# Environment knobs (defaults in parentheses):
+#   SOAK_PAIRS    - socketpairs per process (10000), 100k+ pairs need
+#                   a high RLIMIT_NOFILE hard limit (ulimit -Hn)
+#   SOAK_PROCS    - independent processes to fork (1)
+#   SOAK_THREADS  - waiter threads per process (16)
+#   SOAK_WRITERS  - writer threads per process (2)
+#   SOAK_RATE     - writes per second per process, 0 is unlimited (20000)
+#   SOAK_CHURN    - pairs replaced per second per process (1000)
+#   SOAK_SECONDS  - duration (60)
+#   SOAK_INTERVAL - seconds between reports (5)
+#   SOAK_FAIRNESS - minimum fairness index, 1.0 is perfectly fair (0.5)
+#   SOAK_GROWTH   - maximum growth of RSS and the table (0.25)
+require File.expand_path('../helper', __FILE__)
+require 'socket'
+require 'objspace'
+include SleepyPenguin
+
+module Soak
+  PAIRS = Integer(ENV['SOAK_PAIRS'] || 10_000)
+  PROCS = Integer(ENV['SOAK_PROCS'] || 1)
+  THREADS = Integer(ENV['SOAK_THREADS'] || 16)
+  WRITERS = Integer(ENV['SOAK_WRITERS'] || 2)
+  RATE = Integer(ENV['SOAK_RATE'] || 20_000)
+  CHURN = Integer(ENV['SOAK_CHURN'] || 1000)
+  SECONDS = Float(ENV['SOAK_SECONDS'] || 60)
+  INTERVAL = Float(ENV['SOAK_INTERVAL'] || 5)
+  FAIRNESS = Float(ENV['SOAK_FAIRNESS'] || 0.5)
+  GROWTH = Float(ENV['SOAK_GROWTH'] || 0.25)
+  FLAGS = Epoll::IN | Epoll::ONESHOT
+  TICK = 0.01 # seconds between batches of writes and churn
+
+  def self.raise_nofile(need)
+    soft, hard = Process.getrlimit(:NOFILE)
+    return if soft >= need
+    if hard != Process::RLIM_INFINITY && hard < need
+      abort "need #{need} descriptors, RLIMIT_NOFILE hard limit is #{hard}"
+    end
+    Process.setrlimit(:NOFILE, need, hard)
+  end
+
+  def self.rss_kb
+    File.read('/proc/self/status')[/^VmRSS:\s*(\d+)/, 1].to_i
+  end
+
+  def self.gc_ms
+    GC.stat(:time) # Ruby 3.1+
+  rescue ArgumentError
+    (GC::Profiler.total_time * 1000).to_i
+  end
+
+  def self.pct(sorted, p)
+    return 0 if sorted.empty?
+    i = (sorted.size * p / 100.0).ceil - 1
+    sorted[i < 0 ? 0 : i]
+  end
+
+  # Jain's fairness index, 1.0 when all threads woke up equally often
+  def self.fairness(counts)
+    sum = counts.inject(0, :+)
+    sq = counts.inject(0) { |s, x| s + x * x }
+    sq == 0 ? 1.0 : sum * sum / (counts.size * sq.to_f)
+  end
+
+  class Run
+    def initialize(npairs, tag = '')
+      @tag = tag
+      @ep = Epoll.new
+      @pairs = Array.new(npairs) { new_pair }
+      @stop = false
+      @events = Array.new(THREADS, 0)
+      @wakeups = Array.new(THREADS, 0)
+      @lat = Array.new(THREADS) { [] }
+      @closes = @dels = @errors = 0
+    end
+
+    def new_pair
+      pair = UNIXSocket.pair
+      @ep.add(pair[0], FLAGS)
+      pair
+    end
+
+    def waiter(i)
+      buf = ''.b
+      until @stop
+        got = 0
+        @ep.wait(64, 100) do |_, io|
+          got += 1
+          begin
+            io.read_nonblock(4096, buf)
+            now = SPBench.now
+            buf.unpack('Q*').each { |t| @lat[i] << now - t }
+            @ep.rearm(io, FLAGS)
+          rescue IO::WaitReadable, EOFError, IOError, SystemCallError
+            # replaced by the churn thread while we were looking at it
+          end
+        end
+        next if got == 0
+        @events[i] += got
+        @wakeups[i] += 1
+      end
+    rescue => e
+      @errors += 1
+      warn "waiter #{i}: #{e.message} (#{e.class})"
+      retry unless @stop
+    end
+
+    def writer(rate)
+      per_tick = rate > 0 ? (rate * TICK).ceil : 1000
+      deadline = SPBench.now
+      until @stop
+        per_tick.times do
+          wr = @pairs[rand(@pairs.size)][1]
+          begin
+            wr.write_nonblock([ SPBench.now ].pack('Q'), exception: false)
+          rescue IOError, SystemCallError
+          end
+        end
+        next if rate <= 0
+        deadline += (TICK * 1e9).to_i
+        delay = (deadline - SPBench.now) / 1e9
+        sleep(delay) if delay > 0
+      end
+    end
+
+    def churn
+      per_tick = (CHURN * TICK).ceil
+      n = 0
+      until @stop
+        per_tick.times do
+          i = rand(@pairs.size)
+          old = @pairs[i]
+          @pairs[i] = new_pair
+          if (n += 1).odd?
+            @ep.del(old[0]) rescue nil
+            @dels += 1
+          else
+            @closes += 1 # the kernel drops the registration on close
+          end
+          old.each(&:close)
+        end
+        sleep(TICK)
+      end
+    end
+
+    def report_header
+      printf("%s%6s %10s %8s %8s %8s %8s %6s %8s %7s %9s\n",
+             @tag, 't(s)', 'events/s', 'p50(us)', 'p99(us)', 'p999(us)',
+             'max(us)', 'fair', 'rss(MB)', 'gc(ms)', 'table(KB)')
+    end
+
+    def report(t, dt, events, wakeups, lat)
+      lat.sort!
+      fair = Soak.fairness(wakeups)
+      rss = Soak.rss_kb
+      table = ObjectSpace.memsize_of(@ep)
+      printf("%s%6.1f %10.0f %8.1f %8.1f %8.1f %8.1f %6.3f %8.1f %7d %9.1f\n",
+             @tag, t, events / dt, Soak.pct(lat, 50) / 1e3,
+             Soak.pct(lat, 99) / 1e3, Soak.pct(lat, 99.9) / 1e3,
+             (lat[-1] || 0) / 1e3, fair, rss / 1024.0, Soak.gc_ms,
+             table / 1024.0)
+      $stdout.flush
+      [ fair, rss, table ]
+    end
+
+    def start
+      thr = Array.new(THREADS) { |i| Thread.new { waiter(i) } }
+      thr.concat(Array.new(WRITERS) { Thread.new { writer(RATE / WRITERS) } })
+      thr << Thread.new { churn }
+      thr
+    end
+
+    def run
+      report_header
+      thr = start
+      t0 = last = SPBench.now
+      prev_events = @events.dup
+      prev_wakeups = @wakeups.dup
+      samples = []
+      begin
+        sleep(INTERVAL)
+        now = SPBench.now
+        lat = []
+        @lat.map! { |a| lat.concat(a); [] }
+        events = @events.dup
+        wakeups = @wakeups.dup
+        samples << report((now - t0) / 1e9, (now - last) / 1e9,
+                          events.inject(:+) - prev_events.inject(:+),
+                          wakeups.zip(prev_wakeups).map { |a, b| a - b },
+                          lat)
+        prev_events, prev_wakeups, last = events, wakeups, now
+      end while (now - t0) / 1e9 < SECONDS
+      @stop = true
+      thr.each(&:join)
+      puts "#@tag" "dels=#@dels closes=#@closes waiter_errors=#@errors"
+      check(samples)
+    ensure
+      @stop = true
+      @pairs.each { |pair| pair.each { |io| io.close unless io.closed? } }
+      @ep.close unless @ep.closed?
+    end
+
+    def check(samples)
+      ok = true
+      base = samples[0] or return ok
+      samples.each_with_index do |(fair, rss, table), i|
+        if fair < FAIRNESS
+          warn "#@tag" "FLAG: wakeup fairness #{'%.3f' % fair} < #{FAIRNESS} " \
+               "in interval #{i + 1}"
+          ok = false
+        end
+        next if i == 0
+        { 'RSS' => [ rss * 1024, base[1] * 1024 ],
+          'registration table' => [ table, base[2] ]
+        }.each do |what, (cur, orig)|
+          next if cur <= orig * (1 + GROWTH)
+          warn "#@tag" "FLAG: #{what} grew from #{orig} to #{cur} bytes " \
+               "by interval #{i + 1}"
+          ok = false
+        end
+      end
+      ok
+    end
+  end
+end
+
+npairs = Soak::PAIRS
+Soak.raise_nofile(npairs * 2 + 256)
+puts "#{npairs} socketpairs, #{Soak::THREADS} waiters, " \
+     "#{Soak::WRITERS} writers, #{Soak::PROCS} process(es), " \
+     "#{Soak::SECONDS}s"
+if Soak::PROCS <= 1
+  exit(Soak::Run.new(npairs).run)
+end
+
+pids = Array.new(Soak::PROCS) do
+  fork do
+    ok = Soak::Run.new(npairs, "[#$$] ").run
+    $stdout.flush
+    exit!(ok)
+  end
+end
+ok = pids.map { |pid| Process.waitpid2(pid)[1].success? }.all?
+exit(ok)
@@ -0,0 +1,346 @@
+#include "arena.h"
+#include <pthread.h>
+#include <string.h>
+
+/*
+ * every RB_SP_ARENA_DECAY calls for a slot, the slot is shrunk to the
+ * largest size requested in that period if it is more than twice as
+ * large.  Slots up to RB_SP_ARENA_KEEP bytes are never shrunk.
+ */
+#define RB_SP_ARENA_DECAY 1024
+#define RB_SP_ARENA_KEEP 16384
+
+/* a buffer replaced while its caller still held it */
+struct arena_old {
+	struct arena_old *next;
+	void *ptr;
+	size_t capa;
+};
+
+struct arena_slot {
+	void *ptr;
+	size_t capa;
+	size_t hwm; /* largest request since the last decay */
+	unsigned calls;
+	unsigned held; /* nesting depth of rb_sp_arena_hold */
+	struct arena_old *old; /* freed once nothing holds the slot */
+};
+
+struct arena {
+	struct arena_slot slots[RB_SP_ARENA_NR];
+	struct arena *next;
+	int gc; /* owned by a Ruby object, see arena_fiber */
+};
+
+static __thread struct arena *mine;
+static ID id_arena;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t arena_key;
+static struct arena *live; /* one per thread which used any slot */
+
+/* all protected by arena_lock */
+static size_t nr_threads, bytes, peak_bytes;
+static uint64_t grows, trims;
+
+static void bytes_add(size_t n)
+{
+	bytes += n;
+	if (bytes > peak_bytes)
+		peak_bytes = bytes;
+}
+
+/* caller holds arena_lock */
+static void slot_old_free(struct arena_slot *s)
+{
+	struct arena_old *o, *next;
+
+	for (o = s->old; o; o = next) {
+		next = o->next;
+		bytes -= o->capa;
+		free(o->ptr);
+		free(o);
+	}
+	s->old = NULL;
+}
+
+/* caller holds arena_lock */
+static void arena_free(struct arena *a)
+{
+	struct arena **pp;
+	size_t i;
+
+	for (pp = &live; *pp; pp = &(*pp)->next) {
+		if (*pp == a) {
+			*pp = a->next;
+			break;
+		}
+	}
+	for (i = 0; i < RB_SP_ARENA_NR; i++) {
+		slot_old_free(&a->slots[i]);
+		bytes -= a->slots[i].capa;
+		free(a->slots[i].ptr);
+	}
+	nr_threads--;
+	free(a);
+}
+
+/* pthread_key_create destructor, runs without the GVL at thread exit */
+static void thread_exit(void *ptr)
+{
+	pthread_mutex_lock(&arena_lock);
+	arena_free(ptr);
+	pthread_mutex_unlock(&arena_lock);
+}
+
+static struct arena *arena_new(int gc)
+{
+	struct arena *a;
+	void *ptr;
+	int err = posix_memalign(&ptr, rb_sp_l1_cache_line_size,
+				 sizeof(struct arena));
+
+	if (err) {
+		errno = err;
+		rb_memerror();
+	}
+	memset(ptr, 0, sizeof(struct arena));
+	a = ptr;
+	a->gc = gc;
+	pthread_mutex_lock(&arena_lock);
+	a->next = live;
+	live = a;
+	nr_threads++;
+	pthread_mutex_unlock(&arena_lock);
+
+	return a;
+}
+
+static void arena_gc_free(void *ptr)
+{
+	pthread_mutex_lock(&arena_lock);
+	arena_free(ptr);
+	pthread_mutex_unlock(&arena_lock);
+}
+
+static size_t arena_memsize(const void *ptr)
+{
+	const struct arena *a = ptr;
+	size_t i, n = sizeof(struct arena);
+	const struct arena_old *o;
+
+	for (i = 0; i < RB_SP_ARENA_NR; i++) {
+		n += a->slots[i].capa;
+		for (o = a->slots[i].old; o; o = o->next)
+			n += sizeof(*o) + o->capa;
+	}
+
+	return n;
+}
+
+static const rb_data_type_t arena_type = {
+	"SleepyPenguin arena",
+	{ 0, arena_gc_free, arena_memsize, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+/*
+ * M:N threads (Ruby 3.3+) may resume on another native thread after any
+ * blocking region or wait, and fibers under a scheduler may be
+ * suspended while a caller still uses its memory.  __thread memory would
+ * then be shared with whatever runs next on the native thread, so these
+ * get an arena attached to the current fiber instead, which GC frees
+ * along with the fiber.  id_arena has no "@", so Ruby code can't see it
+ * (unlike fiber-local storage, which Thread#keys exposes).
+ */
+static struct arena *arena_fiber(void)
+{
+	VALUE fiber = rb_fiber_current();
+	VALUE obj = rb_attr_get(fiber, id_arena);
+
+	if (NIL_P(obj)) {
+		obj = TypedData_Wrap_Struct(0, &arena_type, NULL);
+		DATA_PTR(obj) = arena_new(1);
+		rb_ivar_set(fiber, id_arena, obj);
+	}
+
+	return DATA_PTR(obj);
+}
+
+static struct arena *arena_mine(void)
+{
+	if (rb_sp_park_p())
+		return arena_fiber();
+	if (!mine) {
+		mine = arena_new(0);
+		pthread_setspecific(arena_key, mine);
+	}
+
+	return mine;
+}
+
+/*
+ * replaces the buffer of +s+ with one of +size+ bytes and bumps +count+
+ * (if non-NULL).  A held buffer is kept until the slot is released.
+ */
+static void slot_resize(struct arena_slot *s, size_t size, uint64_t *count)
+{
+	size_t line = rb_sp_l1_cache_line_size;
+	struct arena_old *o = NULL;
+	void *ptr;
+	int err;
+
+	if (s->held && s->ptr) {
+		o = malloc(sizeof(*o));
+		if (!o)
+			rb_memerror();
+	}
+	size = (size + line - 1) & ~(line - 1);
+	err = posix_memalign(&ptr, line, size);
+	if (err) {
+		free(o);
+		errno = err;
+		rb_memerror();
+	}
+	if (o) {
+		o->ptr = s->ptr;
+		o->capa = s->capa;
+		o->next = s->old;
+		s->old = o;
+	} else {
+		free(s->ptr);
+	}
+	pthread_mutex_lock(&arena_lock);
+	if (!o)
+		bytes -= s->capa;
+	bytes_add(size);
+	if (count)
+		++*count;
+	pthread_mutex_unlock(&arena_lock);
+	s->ptr = ptr;
+	s->capa = size;
+}
+
+void *rb_sp_arena_get(enum rb_sp_arena_slot slot, size_t size, size_t *capa)
+{
+	struct arena_slot *s = &arena_mine()->slots[slot];
+
+	if (size > s->hwm)
+		s->hwm = size;
+	if (s->held) {
+		/* nested call, the holder is still reading the old buffer */
+		slot_resize(s, s->capa < size ? size : s->capa,
+			    s->capa < size ? &grows : NULL);
+	} else if (s->capa < size) {
+		slot_resize(s, size, &grows);
+	} else if (++s->calls >= RB_SP_ARENA_DECAY) {
+		if (s->capa > RB_SP_ARENA_KEEP && s->capa / 2 > s->hwm)
+			slot_resize(s, s->hwm, &trims);
+		s->calls = 0;
+		s->hwm = size;
+	}
+	if (capa)
+		*capa = s->capa;
+
+	return s->ptr;
+}
+
+void *rb_sp_arena_hold(enum rb_sp_arena_slot slot)
+{
+	struct arena_slot *s = &arena_mine()->slots[slot];
+
+	s->held++;
+
+	return s;
+}
+
+void rb_sp_arena_release(void *held)
+{
+	struct arena_slot *s = held;
+
+	if (--s->held == 0 && s->old) {
+		pthread_mutex_lock(&arena_lock);
+		slot_old_free(s);
+		pthread_mutex_unlock(&arena_lock);
+	}
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin.arena_stats	-> Hash
+ *
+ * Returns a snapshot of the per-thread scratch memory used by Epoll,
+ * Inotify, Kqueue and FiberScheduler to receive events:
+ *
+ * - :threads - threads (or fibers) currently holding scratch memory
+ * - :bytes - scratch memory currently held by all threads
+ * - :peak_bytes - the largest value of :bytes so far
+ * - :grows - times scratch memory was enlarged
+ * - :trims - times scratch memory was shrunk after it was mostly unused
+ *
+ * Scratch memory is released when threads exit, or when fibers are
+ * garbage collected with M:N threads or a fiber scheduler (those get
+ * their own scratch memory, since they may move between native
+ * threads or be suspended mid-call).  Memory which is more
+ * than twice as large as any request in the last 1024 calls is shrunk.
+ */
+static VALUE sp_arena_stats(VALUE self)
+{
+	VALUE rv = rb_hash_new();
+	size_t t, b, p;
+	uint64_t g, s;
+
+	pthread_mutex_lock(&arena_lock);
+	t = nr_threads;
+	b = bytes;
+	p = peak_bytes;
+	g = grows;
+	s = trims;
+	pthread_mutex_unlock(&arena_lock);
+
+	rb_hash_aset(rv, ID2SYM(rb_intern("threads")), SIZET2NUM(t));
+	rb_hash_aset(rv, ID2SYM(rb_intern("bytes")), SIZET2NUM(b));
+	rb_hash_aset(rv, ID2SYM(rb_intern("peak_bytes")), SIZET2NUM(p));
+	rb_hash_aset(rv, ID2SYM(rb_intern("grows")), ULL2NUM(g));
+	rb_hash_aset(rv, ID2SYM(rb_intern("trims")), ULL2NUM(s));
+
+	return rv;
+}
+
+static void atfork_prepare(void)
+{
+	pthread_mutex_lock(&arena_lock);
+}
+
+static void atfork_parent(void)
+{
+	pthread_mutex_unlock(&arena_lock);
+}
+
+/* other threads are gone in the child, so is their need for memory */
+static void atfork_child(void)
+{
+	struct arena *a, *next;
+
+	pthread_mutex_init(&arena_lock, NULL);
+	for (a = live; a; a = next) {
+		next = a->next;
+		if (a != mine && !a->gc)
+			arena_free(a);
+	}
+}
+
+void sleepy_penguin_init_arena(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	int err = pthread_key_create(&arena_key, thread_exit);
+
+	if (err) {
+		errno = err;
+		rb_sys_fail("pthread_key_create");
+	}
+	pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+	id_arena = rb_intern("__sleepy_penguin_arena");
+
+	rb_define_singleton_method(mSleepyPenguin, "arena_stats",
+				   sp_arena_stats, 0);
+}
@@ -0,0 +1,40 @@
+#ifndef SLEEPY_PENGUIN_ARENA_H
+#define SLEEPY_PENGUIN_ARENA_H
+#include "sleepy_penguin.h"
+
+/*
+ * Per-thread scratch memory shared by all subsystems, each of which gets
+ * its own slot.  Slots are cache-aligned and grow on demand.  Slots
+ * which stay much larger than the high-water mark of recent requests are
+ * trimmed, so one burst does not pin memory forever.  Everything is
+ * freed when the thread exits.  Must be called with the GVL held.
+ *
+ * Whenever rb_sp_park_p() is true, memory belongs to the current fiber
+ * instead of the native thread, so it stays valid across waits.
+ */
+enum rb_sp_arena_slot {
+	RB_SP_ARENA_EPOLL,
+	RB_SP_ARENA_INOTIFY,
+	RB_SP_ARENA_KQUEUE,
+	RB_SP_ARENA_FIBER,
+	RB_SP_ARENA_NR
+};
+
+/*
+ * Returns at least +size+ bytes of memory for +slot+ in the current
+ * thread, and stores the usable size in +capa+ if non-NULL.  Contents
+ * are undefined, and the memory is only valid until the next call for
+ * the same +slot+ in the same thread.
+ */
+void *rb_sp_arena_get(enum rb_sp_arena_slot slot, size_t size, size_t *capa);
+
+/*
+ * Keeps the memory last returned for +slot+ valid while Ruby code runs,
+ * e.g. when yielding events straight out of it.  Until the matching
+ * rb_sp_arena_release, rb_sp_arena_get on the same +slot+ returns
+ * other memory instead of resizing or reusing it.  Holds nest.
+ */
+void *rb_sp_arena_hold(enum rb_sp_arena_slot slot);
+void rb_sp_arena_release(void *held);
+
+#endif /* SLEEPY_PENGUIN_ARENA_H */
@@ -2,24 +2,46 @@
 #include "clock_gettime.h"
 #ifdef HAVE_SYS_EPOLL_H
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <time.h>
 #include "missing_epoll.h"
 #include "missing_rb_thread_fd_close.h"
 #include "missing_rb_update_max_fd.h"
+#include "fdtab.h"
+#include "arena.h"
+#include "stats.h"
+#include "probes.h"
 
-static ID id_for_fd;
+static ID id_for_fd, id_busy_poll;
 static VALUE cEpoll;
 
-static uint64_t now_ms(void)
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+
+/* far enough to be forever, small enough to never overflow */
+#define NSEC_MAX (NSEC_PER_SEC * 86400ULL * 365ULL * 100ULL)
+
+static uint64_t now_ns(void)
 {
 	struct timespec now;
 
 	CLOCK_GETTIME(&now);
 
-	return now.tv_sec * 1000 + (now.tv_nsec + 500000) / 1000000;
+	return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
 }
 
+static void ns2timespec(struct timespec *ts, uint64_t ns)
+{
+	ts->tv_sec = (time_t)(ns / NSEC_PER_SEC);
+	ts->tv_nsec = (long)(ns % NSEC_PER_SEC);
+}
+
+/*
+ * +obj+ is either a real object which the caller must keep alive and
+ * unmoved, or a Fixnum token.  Fixnums are immediates with a tag bit no
+ * object pointer can have, so both kinds may be mixed in one epoll set.
+ */
 static void pack_event_data(struct epoll_event *event, VALUE obj)
 {
 	event->data.ptr = (void *)obj;
@@ -30,12 +52,30 @@ static VALUE unpack_event_data(struct epoll_event *event)
 	return (VALUE)event->data.ptr;
 }
 
+/*
+ * adaptive busy polling state, hung off an Epoll::IO in a hidden ivar
+ * by Epoll::IO#busy_poll=.  Spinning is only worth it if the next event
+ * is likely to arrive before the spin budget runs out, so we track the
+ * average gap between waits which returned events.
+ */
+struct ep_busy_poll {
+	uint64_t max_ns; /* configured budget */
+	uint64_t last_ns; /* when the last events arrived */
+	uint64_t avg_gap_ns; /* moving average of inter-arrival times */
+};
+
 struct ep_per_thread {
 	VALUE io;
 	int fd;
-	int timeout;
 	int maxevents;
-	int capa;
+	struct timespec *tsp; /* NULL waits forever */
+	struct timespec ts;
+	uint64_t expire_at; /* CLOCK_MONOTONIC nanoseconds */
+	const sigset_t *sigmask;
+	sigset_t sigset;
+	struct ep_busy_poll *bp; /* NULL unless busy polling */
+	uint64_t spin_ns;
+	unsigned long spins; /* empty zero-timeout waits while spinning */
 	struct epoll_event events[FLEX_ARRAY];
 };
 
@@ -50,12 +90,51 @@ static int ep_fd_check(struct ep_per_thread *ept)
 	return 1;
 }
 
+static const rb_data_type_t bp_type = {
+	"SleepyPenguin::Epoll::IO busy_poll",
+	{ 0, RUBY_TYPED_DEFAULT_FREE, 0, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static struct ep_busy_poll *ep_busy_poll(VALUE self)
+{
+	VALUE bp = rb_attr_get(self, id_busy_poll);
+
+	return NIL_P(bp) ? NULL : DATA_PTR(bp);
+}
+
+/* how long the next wait should spin before sleeping */
+static uint64_t bp_spin_ns(const struct ep_busy_poll *bp)
+{
+	uint64_t gap = bp->avg_gap_ns;
+
+	if (!gap) /* no history, yet */
+		return bp->max_ns;
+	if (gap > bp->max_ns) /* events too sparse to catch by spinning */
+		return 0;
+
+	/* give the next event some slack to arrive */
+	return gap * 2 < bp->max_ns ? gap * 2 : bp->max_ns;
+}
+
+static void bp_update(struct ep_busy_poll *bp, int n)
+{
+	uint64_t now, gap;
+
+	if (n <= 0)
+		return;
+	now = now_ns();
+	if (bp->last_ns) {
+		gap = now - bp->last_ns;
+		bp->avg_gap_ns = bp->avg_gap_ns ?
+				 (bp->avg_gap_ns * 7 + gap) / 8 : gap;
+	}
+	bp->last_ns = now;
+}
+
 static struct ep_per_thread *ept_get(VALUE self, int maxevents)
 {
-	static __thread struct ep_per_thread *ept;
-	size_t size;
-	int err;
-	void *ptr;
+	struct ep_per_thread *ept;
 
 	/* error check here to prevent OOM from posix_memalign */
 	if (maxevents <= 0) {
@@ -63,28 +142,36 @@ static struct ep_per_thread *ept_get(VALUE self, int maxevents)
 		rb_sys_fail("epoll_wait maxevents <= 0");
 	}
 
-	if (ept && ept->capa >= maxevents)
-		goto out;
-
-	size = sizeof(struct ep_per_thread) +
-	       sizeof(struct epoll_event) * maxevents;
-
-	free(ept); /* free(NULL) is POSIX and works on glibc */
-	err = posix_memalign(&ptr, rb_sp_l1_cache_line_size, size);
-	if (err) {
-		errno = err;
-		rb_memerror();
-	}
-	ept = ptr;
-	ept->capa = maxevents;
-out:
+	ept = rb_sp_arena_get(RB_SP_ARENA_EPOLL, sizeof(struct ep_per_thread) +
+			      sizeof(struct epoll_event) * maxevents, NULL);
 	ept->maxevents = maxevents;
 	ept->io = self;
 	ept->fd = rb_sp_fileno(ept->io);
+	ept->bp = ep_busy_poll(self);
 
 	return ept;
 }
 
+/* we still support integer FDs for some debug functions */
+static int ep_fileno(VALUE io)
+{
+	return FIXNUM_P(io) ? FIX2INT(io) : rb_sp_fileno(io);
+}
+
+static int
+ep_ctl(VALUE epio, int epfd, int op, int fd, VALUE io, uint32_t events)
+{
+	struct epoll_event event;
+	int rc;
+
+	event.events = events;
+	pack_event_data(&event, io);
+	rc = epoll_ctl(epfd, op, fd, &event);
+	rb_sp_stat_syscall(RB_SP_STAT_EPOLL, epio, rc);
+
+	return rc;
+}
+
 /*
  * call-seq:
  *	SleepyPenguin::Epoll::IO.new(flags)	-> Epoll::IO object
@@ -99,6 +186,7 @@ static VALUE s_new(VALUE klass, VALUE _flags)
 	int fd = epoll_create1(flags);
 	VALUE rv;
 
+	rb_sp_stat_syscall(RB_SP_STAT_EPOLL, Qnil, fd);
 	if (fd < 0) {
 		if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
 			rb_gc();
@@ -112,9 +200,21 @@ static VALUE s_new(VALUE klass, VALUE _flags)
 	return rb_call_super(1, &rv);
 }
 
+static VALUE ep_token(VALUE io, VALUE token)
+{
+	if (NIL_P(token))
+		return io;
+	if (TYPE(token) == T_BIGNUM)
+		rb_raise(rb_eRangeError, "token out of Fixnum range");
+	if (!FIXNUM_P(token))
+		rb_raise(rb_eTypeError, "token must be an Integer");
+
+	return token;
+}
+
 /*
  * call-seq:
- * 	epoll_io.epoll_ctl(op, io, events)	-> nil
+ * 	epoll_io.epoll_ctl(op, io, events[, token])	-> nil
  *
  * Register, modify, or register a watch for a given +io+ for events.
  *
@@ -122,32 +222,92 @@ static VALUE s_new(VALUE klass, VALUE _flags)
  * +io+ is an IO object or one which proxies via the +to_io+ method.
  * +events+ is an integer mask of events to watch for.
  *
+ * If +token+ is given, Epoll::IO#epoll_wait returns it in place of +io+.
+ * +token+ must be an Integer which fits in a Fixnum (62 bits
+ * with sign on 64-bit platforms).  Tokens are not objects, so there is
+ * nothing to retain for GC and nothing for GC.compact to move.  +io+ may
+ * also be an Integer file descriptor, which becomes the token itself
+ * if +token+ is omitted.
+ *
  * Returns nil on success.
  */
-static VALUE epctl(VALUE self, VALUE _op, VALUE io, VALUE events)
+static VALUE epctl(int argc, VALUE *argv, VALUE self)
 {
-	struct epoll_event event;
-	int epfd = rb_sp_fileno(self);
-	int fd = rb_sp_fileno(io);
-	int op = NUM2INT(_op);
-	int rv;
+	VALUE _op, io, events, token;
+	int epfd, fd, op;
 
-	event.events = NUM2UINT(events);
-	pack_event_data(&event, io);
+	rb_scan_args(argc, argv, "31", &_op, &io, &events, &token);
+	epfd = rb_sp_fileno(self);
+	fd = ep_fileno(io);
+	op = NUM2INT(_op);
+	token = ep_token(io, token);
 
-	rv = epoll_ctl(epfd, op, fd, &event);
-	if (rv < 0)
+	if (ep_ctl(self, epfd, op, fd, token, NUM2UINT(events)) < 0)
 		rb_sys_fail("epoll_ctl");
 
 	return Qnil;
 }
 
-static VALUE epwait_result(struct ep_per_thread *ept, int n)
+/*
+ * call-seq:
+ *	epoll_io.epoll_ctl_batch(ops)	-> nil or Array
+ *
+ * Applies many epoll_ctl operations in one method call.  +ops+ is an
+ * Array of Arrays, each of which holds the arguments to
+ * Epoll::IO#epoll_ctl:
+ *
+ *	[ [ op, io, events ], [ op, io, events, token ], ... ]
+ *
+ * Every operation is attempted even if earlier ones fail.  Returns +nil+
+ * if all operations succeeded.  Otherwise, returns an Array with one
+ * element per operation: +nil+ for successes and a SystemCallError
+ * (e.g. Errno::ENOENT) for failures.
+ *
+ * Invalid arguments (e.g. closed IO objects) raise immediately, leaving
+ * operations before them applied.
+ */
+static VALUE epctl_batch(VALUE self, VALUE ops)
 {
-	int i;
-	struct epoll_event *epoll_event = ept->events;
-	VALUE obj_events, obj;
+	int epfd = rb_sp_fileno(self);
+	VALUE rv = Qnil;
+	long i, n;
+
+	Check_Type(ops, T_ARRAY);
+	n = RARRAY_LEN(ops);
+	for (i = 0; i < n && i < RARRAY_LEN(ops); i++) {
+		VALUE op = rb_ary_entry(ops, i);
+		VALUE io, token;
+		int fd;
+
+		Check_Type(op, T_ARRAY);
+		if (RARRAY_LEN(op) != 3 && RARRAY_LEN(op) != 4)
+			rb_raise(rb_eArgError,
+				 "epoll_ctl_batch op must have 3 or 4 elements");
+		io = rb_ary_entry(op, 1);
+		token = ep_token(io, rb_ary_entry(op, 3));
+		fd = ep_fileno(io);
+
+		if (ep_ctl(self, epfd, NUM2INT(rb_ary_entry(op, 0)), fd, token,
+			   NUM2UINT(rb_ary_entry(op, 2))) == 0) {
+			if (!NIL_P(rv))
+				rb_ary_push(rv, Qnil);
+		} else {
+			int err = errno;
+
+			if (NIL_P(rv)) {
+				rv = rb_ary_new2(n);
+				while (RARRAY_LEN(rv) < i)
+					rb_ary_push(rv, Qnil);
+			}
+			rb_ary_push(rv, rb_sp_syserr_new(err, "epoll_ctl"));
+		}
+	}
+
+	return rv;
+}
 
+static int epwait_check(int n)
+{
 	if (n < 0) {
 		if (errno == EINTR)
 			n = 0;
@@ -155,16 +315,74 @@ static VALUE epwait_result(struct ep_per_thread *ept, int n)
 			rb_sys_fail("epoll_wait");
 	}
 
-	for (i = n; --i >= 0; epoll_event++) {
+	return n;
+}
+
+struct epwait_yield_args {
+	struct ep_per_thread *ept;
+	int n;
+};
+
+static VALUE epwait_yield(VALUE ptr)
+{
+	struct epwait_yield_args *a = (struct epwait_yield_args *)ptr;
+	struct epoll_event *epoll_event = a->ept->events;
+	VALUE obj_events, obj;
+	int i;
+
+	for (i = a->n; --i >= 0; epoll_event++) {
 		obj_events = UINT2NUM(epoll_event->events);
 		obj = unpack_event_data(epoll_event);
 		rb_yield_values(2, obj_events, obj);
 	}
 
+	return Qnil;
+}
+
+static VALUE ept_release(VALUE held)
+{
+	rb_sp_arena_release((void *)held);
+
+	return Qnil;
+}
+
+/* the block may call epoll_wait again, so +ept+ is held while yielding */
+static VALUE epwait_result(struct ep_per_thread *ept, int n)
+{
+	struct epwait_yield_args a;
+
+	a.ept = ept;
+	a.n = epwait_check(n);
+	if (a.n > 0)
+		rb_ensure(epwait_yield, (VALUE)&a, ept_release,
+			  (VALUE)rb_sp_arena_hold(RB_SP_ARENA_EPOLL));
+
+	return INT2NUM(a.n);
+}
+
+/*
+ * stores events into a caller-supplied array as flat [events, io] pairs,
+ * the events are Fixnums and the IOs already exist, so we never allocate
+ * Ruby objects here.
+ */
+static VALUE epwait_into_result(struct ep_per_thread *ept, int n, VALUE ary)
+{
+	int i;
+	long j = 0;
+	struct epoll_event *epoll_event = ept->events;
+
+	n = epwait_check(n);
+	for (i = n; --i >= 0; epoll_event++) {
+		rb_ary_store(ary, j++, UINT2NUM(epoll_event->events));
+		rb_ary_store(ary, j++, unpack_event_data(epoll_event));
+	}
+	if (RARRAY_LEN(ary) != j)
+		rb_ary_resize(ary, j);
+
 	return INT2NUM(n);
 }
 
-static int epoll_resume_p(uint64_t expire_at, struct ep_per_thread *ept)
+static int epoll_resume_p(struct ep_per_thread *ept)
 {
 	uint64_t now;
 
@@ -172,31 +390,250 @@ static int epoll_resume_p(uint64_t expire_at, struct ep_per_thread *ept)
 
 	if (errno != EINTR)
 		return 0;
-	if (ept->timeout < 0)
+	if (!ept->tsp)
 		return 1;
-	now = now_ms();
-	ept->timeout = now > expire_at ? 0 : (int)(expire_at - now);
+	now = now_ns();
+	ns2timespec(ept->tsp, now > ept->expire_at ? 0 : ept->expire_at - now);
 	return 1;
 }
 
+#ifdef HAVE_EPOLL_PWAIT2
+/* Linux 5.11+, we only hit ENOSYS once with older kernels */
+static int epoll_pwait2_ok = 1;
+#endif
+
+/*
+ * spins with zero timeouts for up to ept->spin_ns before the caller
+ * blocks, the GVL is released so other threads may run meanwhile
+ */
+static int ep_spin(struct ep_per_thread *ept)
+{
+	uint64_t now = now_ns();
+	uint64_t end = now + ept->spin_ns;
+	int n;
+
+	ept->spin_ns = 0; /* don't spin again if we're retried after EINTR */
+	if (ept->tsp && end > ept->expire_at)
+		end = ept->expire_at;
+	while (now < end) {
+		n = epoll_pwait(ept->fd, ept->events, ept->maxevents, 0,
+				ept->sigmask);
+		if (n != 0)
+			return n;
+		ept->spins++;
+		now = now_ns();
+	}
+	if (ept->tsp)
+		ns2timespec(ept->tsp, now > ept->expire_at ?
+			    0 : ept->expire_at - now);
+
+	return 0;
+}
+
+static int ep_wait(struct ep_per_thread *ept)
+{
+	int timeout = -1;
+	int n;
+
+	if (ept->spin_ns) {
+		n = ep_spin(ept);
+		if (n != 0)
+			return n;
+	}
+
+#ifdef HAVE_EPOLL_PWAIT2
+	if (epoll_pwait2_ok) {
+		n = epoll_pwait2(ept->fd, ept->events, ept->maxevents,
+				 ept->tsp, ept->sigmask);
+		if (n >= 0 || errno != ENOSYS)
+			return n;
+		epoll_pwait2_ok = 0;
+	}
+#endif
+	if (ept->tsp) {
+		/* round up, waking early would be worse than a bit late */
+		uint64_t ms = ((uint64_t)ept->tsp->tv_sec * NSEC_PER_SEC +
+		               ept->tsp->tv_nsec + NSEC_PER_MSEC - 1) /
+			       NSEC_PER_MSEC;
+
+		timeout = ms > INT_MAX ? INT_MAX : (int)ms;
+	}
+	return epoll_pwait(ept->fd, ept->events, ept->maxevents, timeout,
+			   ept->sigmask);
+}
+
 static VALUE nogvl_wait(void *args)
 {
 	struct ep_per_thread *ept = args;
-	int n = epoll_wait(ept->fd, ept->events, ept->maxevents, ept->timeout);
+	int n;
+
+	SP_PROBE2(epoll_wait_entry, ept->fd, ept->maxevents);
+	n = ep_wait(ept);
+	SP_PROBE4(epoll_wait_return, ept->fd, ept->maxevents, n,
+		  SP_PROBE_ERRNO(n));
 
 	return (VALUE)n;
 }
 
-static VALUE real_epwait(struct ep_per_thread *ept)
+#ifdef HAVE_RB_IO_WAIT
+/*
+ * for M:N threads and fiber schedulers: polls without sleeping, and
+ * parks in Ruby's event hub (or the scheduler) until the epoll descriptor
+ * is readable, so no native thread sleeps on our behalf.  Every waiter
+ * on one Epoll::IO may wake up for a single event, the losers find
+ * nothing and park again.
+ */
+static long ep_park(struct ep_per_thread *ept)
 {
+	struct timespec *tsp = ept->tsp;
+	struct timespec zero = { 0, 0 };
+	VALUE timeout = Qnil;
 	long n;
-	uint64_t expire_at = ept->timeout > 0 ? now_ms() + ept->timeout : 0;
 
-	do {
-		n = (long)rb_sp_fd_region(nogvl_wait, ept, ept->fd);
-	} while (n < 0 && epoll_resume_p(expire_at, ept));
+	for (;;) {
+		ept->tsp = &zero;
+		n = (long)rb_sp_stat_call(RB_SP_STAT_EPOLL, ept->io,
+					  nogvl_wait, ept);
+		ept->tsp = tsp;
+		if (n != 0)
+			return n;
+		if (tsp) {
+			uint64_t now = now_ns();
 
-	return epwait_result(ept, (int)n);
+			if (now >= ept->expire_at)
+				return 0;
+			timeout = DBL2NUM((double)(ept->expire_at - now) /
+					  NSEC_PER_SEC);
+		}
+		if (!RTEST(rb_io_wait(ept->io, INT2FIX(RUBY_IO_READABLE),
+				      timeout)))
+			return 0; /* timed out */
+		ep_fd_check(ept); /* may raise IOError */
+	}
+}
+#endif /* HAVE_RB_IO_WAIT */
+
+static int real_epwait(struct ep_per_thread *ept)
+{
+	long n;
+	struct ep_busy_poll *bp = ept->bp;
+
+	ept->spins = 0;
+
+	/* polling can't sleep, so releasing the GVL would cost more */
+	if (ept->tsp && ept->tsp->tv_sec == 0 && ept->tsp->tv_nsec == 0) {
+		ept->spin_ns = 0;
+		do {
+			n = (long)rb_sp_stat_call(RB_SP_STAT_EPOLL, ept->io,
+						  nogvl_wait, ept);
+		} while (n < 0 && epoll_resume_p(ept));
+#ifdef HAVE_RB_IO_WAIT
+	} else if (!ept->sigmask && rb_sp_park_p()) {
+		ept->spin_ns = 0; /* spinning would pin a native thread */
+		do {
+			n = ep_park(ept);
+		} while (n < 0 && epoll_resume_p(ept));
+#endif
+	} else {
+		ept->spin_ns = bp ? bp_spin_ns(bp) : 0;
+		do {
+			n = (long)rb_sp_stat_region(RB_SP_STAT_EPOLL, ept->io,
+						    nogvl_wait, ept, ept->fd);
+		} while (n < 0 && epoll_resume_p(ept));
+	}
+
+	if (ept->spins)
+		rb_sp_stat_syscalls(RB_SP_STAT_EPOLL, ept->io, ept->spins);
+	rb_sp_stat_events(RB_SP_STAT_EPOLL, ept->io, n);
+	if (bp)
+		bp_update(bp, (int)n);
+
+	return (int)n;
+}
+
+/* +timeout+ is relative, in milliseconds */
+static void ep_timeout(struct ep_per_thread *ept, VALUE timeout)
+{
+	uint64_t ns;
+
+	switch (TYPE(timeout)) {
+	case T_NIL:
+		ept->tsp = NULL;
+		return;
+	case T_FIXNUM:
+	case T_BIGNUM: {
+		LONG_LONG ms = NUM2LL(timeout);
+
+		if (ms < 0) {
+			ept->tsp = NULL;
+			return;
+		}
+		ns = (uint64_t)ms > NSEC_MAX / NSEC_PER_MSEC ?
+		     NSEC_MAX : (uint64_t)ms * NSEC_PER_MSEC;
+		break;
+	}
+	default: { /* Float, Rational, ... */
+		double ms = NUM2DBL(timeout);
+
+		if (ms < 0) {
+			ept->tsp = NULL;
+			return;
+		}
+		ns = ms * NSEC_PER_MSEC >= (double)NSEC_MAX ?
+		     NSEC_MAX : (uint64_t)(ms * NSEC_PER_MSEC + 0.5);
+	}
+	}
+	ept->expire_at = now_ns() + ns;
+	ns2timespec(&ept->ts, ns);
+	ept->tsp = &ept->ts;
+}
+
+/* +deadline+ is absolute on CLOCK_MONOTONIC */
+static void ep_deadline(struct ep_per_thread *ept, VALUE deadline)
+{
+	uint64_t now = now_ns();
+	uint64_t max = now + NSEC_MAX;
+	double ns;
+
+	switch (TYPE(deadline)) {
+	case T_FIXNUM: /* nanoseconds */
+		ns = (double)FIX2LONG(deadline);
+		break;
+	default: /* Float seconds, like Process.clock_gettime */
+		ns = NUM2DBL(deadline) * NSEC_PER_SEC;
+	}
+	if (ns <= 0)
+		ept->expire_at = 0;
+	else if (ns >= (double)max)
+		ept->expire_at = max;
+	else if (FIXNUM_P(deadline))
+		ept->expire_at = (uint64_t)FIX2LONG(deadline);
+	else
+		ept->expire_at = (uint64_t)(ns + 0.5);
+	ns2timespec(&ept->ts, now > ept->expire_at ? 0 : ept->expire_at - now);
+	ept->tsp = &ept->ts;
+}
+
+static void ep_sigmask(struct ep_per_thread *ept, VALUE sigmask)
+{
+	if (NIL_P(sigmask)) {
+		ept->sigmask = NULL;
+	} else {
+		rb_sp_value2sigset(&ept->sigset, sigmask);
+		ept->sigmask = &ept->sigset;
+	}
+}
+
+static struct ep_per_thread *
+epwait_prepare(VALUE self, VALUE maxevents, VALUE timeout)
+{
+	struct ep_per_thread *ept;
+
+	ept = ept_get(self, NIL_P(maxevents) ? 64 : NUM2INT(maxevents));
+	ep_timeout(ept, timeout);
+	ept->sigmask = NULL;
+
+	return ept;
 }
 
 /*
@@ -210,6 +647,14 @@ static VALUE real_epwait(struct ep_per_thread *ept)
  * single-threaded applications. +maxevents+ defaults to 64 events.
  * +timeout+ is specified in milliseconds, +nil+
  * (the default) meaning it will block and wait indefinitely.
+ * Float and Rational +timeout+ values may specify fractions of a
+ * millisecond, epoll_pwait2(2) honors them with nanosecond precision
+ * on Linux 5.11 and later.
+ *
+ * With M:N threads (Ruby 3.3+) or a Fiber scheduler, waiting threads
+ * and fibers are parked by Ruby (or the scheduler) until the epoll
+ * descriptor is readable, instead of sleeping in the kernel on a native
+ * thread of their own.  Busy polling is disabled for those waits.
  */
 static VALUE epwait(int argc, VALUE *argv, VALUE self)
 {
@@ -218,11 +663,216 @@ static VALUE epwait(int argc, VALUE *argv, VALUE self)
 
 	rb_need_block();
 	rb_scan_args(argc, argv, "02", &maxevents, &timeout);
+	ept = epwait_prepare(self, maxevents, timeout);
 
+	return epwait_result(ept, real_epwait(ept));
+}
+
+/*
+ * call-seq:
+ *	ep_io.epoll_pwait([maxevents[, timeout[, sigmask]]]) { |events, io| ... }
+ *
+ * Like Epoll::IO#epoll_wait, but replaces the signal mask of the calling
+ * thread with +sigmask+ while waiting.  +sigmask+ is an Array of signals
+ * (or a single signal) as accepted by Signal.trap, or +nil+ to leave
+ * the signal mask alone.  Since Ruby handles signals internally, this
+ * is rarely needed outside of specialized applications.
+ */
+static VALUE epwait_sigmask(int argc, VALUE *argv, VALUE self)
+{
+	VALUE timeout, maxevents, sigmask;
+	struct ep_per_thread *ept;
+
+	rb_need_block();
+	rb_scan_args(argc, argv, "03", &maxevents, &timeout, &sigmask);
+	ept = epwait_prepare(self, maxevents, timeout);
+	ep_sigmask(ept, sigmask);
+
+	return epwait_result(ept, real_epwait(ept));
+}
+
+/*
+ * call-seq:
+ *	ep_io.epoll_wait_until(maxevents, deadline[, sigmask]) { |events, io| ... }
+ *
+ * Like Epoll::IO#epoll_pwait, but waits until an absolute +deadline+ on
+ * the monotonic clock instead of a relative timeout.  +deadline+ is an
+ * Integer number of nanoseconds or a Float number of seconds, as
+ * returned by:
+ *
+ *	Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+ *	Process.clock_gettime(Process::CLOCK_MONOTONIC)
+ *
+ * A +deadline+ in the past polls without blocking.  Retries after
+ * signals do not need to recompute anything, so repeated calls
+ * with the same +deadline+ never drift.
+ */
+static VALUE epwait_until(int argc, VALUE *argv, VALUE self)
+{
+	VALUE maxevents, deadline, sigmask;
+	struct ep_per_thread *ept;
+
+	rb_need_block();
+	rb_scan_args(argc, argv, "21", &maxevents, &deadline, &sigmask);
 	ept = ept_get(self, NIL_P(maxevents) ? 64 : NUM2INT(maxevents));
-	ept->timeout = NIL_P(timeout) ? -1 : NUM2INT(timeout);
+	ep_deadline(ept, deadline);
+	ep_sigmask(ept, sigmask);
 
-	return real_epwait(ept);
+	return epwait_result(ept, real_epwait(ept));
+}
+
+/*
+ * call-seq:
+ *	ep_io.epoll_wait_into(ary[, maxevents[, timeout]])	-> Integer
+ *
+ * Like Epoll::IO#epoll_wait, but instead of yielding, this replaces the
+ * contents of +ary+ with flat pairs of Integer +events+ and IO objects:
+ *
+ *	[ events, io, events, io, ... ]
+ *
+ * Returns the number of pairs stored, so +ary+ will contain twice as many
+ * elements.  Reusing the same +ary+ across calls avoids allocating Ruby
+ * objects and invoking a block for every event, which is useful when
+ * +maxevents+ is large.  +maxevents+ and +timeout+ are the same as they
+ * are for Epoll::IO#epoll_wait.
+ */
+static VALUE epwait_into(int argc, VALUE *argv, VALUE self)
+{
+	VALUE ary, timeout, maxevents;
+	struct ep_per_thread *ept;
+
+	rb_scan_args(argc, argv, "12", &ary, &maxevents, &timeout);
+	Check_Type(ary, T_ARRAY);
+	rb_check_frozen(ary);
+	ept = epwait_prepare(self, maxevents, timeout);
+
+	return epwait_into_result(ept, real_epwait(ept), ary);
+}
+
+/*
+ * call-seq:
+ *	ep_io.busy_poll = usecs
+ *
+ * Opts into busy polling: waits spin with zero timeouts for up to
+ * +usecs+ microseconds before sleeping in the kernel.  This trades CPU
+ * time for lower wakeup latency when events arrive in quick succession.
+ * The spin budget adapts to the average time between events and drops
+ * to zero when events are further apart than +usecs+.  +nil+ or +0+
+ * disables busy polling.
+ *
+ * Other threads may run while spinning.  See also
+ * Epoll::IO#busy_poll_params= for busy polling network devices in
+ * the kernel.
+ */
+static VALUE set_busy_poll(VALUE self, VALUE usecs)
+{
+	struct ep_busy_poll *bp;
+	VALUE obj;
+	long us = NIL_P(usecs) ? 0 : NUM2LONG(usecs);
+
+	if (us < 0)
+		rb_raise(rb_eArgError, "busy_poll must not be negative");
+	if (us == 0) {
+		rb_ivar_set(self, id_busy_poll, Qnil);
+		return usecs;
+	}
+	bp = ep_busy_poll(self);
+	if (!bp) {
+		obj = TypedData_Make_Struct(rb_cObject, struct ep_busy_poll,
+					    &bp_type, bp);
+		rb_ivar_set(self, id_busy_poll, obj);
+	}
+	bp->max_ns = (uint64_t)us * 1000;
+
+	return usecs;
+}
+
+/*
+ * call-seq:
+ *	ep_io.busy_poll	-> Integer or nil
+ *
+ * Returns the busy polling budget in microseconds set by
+ * Epoll::IO#busy_poll=, or +nil+ if busy polling is disabled.
+ */
+static VALUE busy_poll(VALUE self)
+{
+	struct ep_busy_poll *bp = ep_busy_poll(self);
+
+	return bp ? ULL2NUM(bp->max_ns / 1000) : Qnil;
+}
+
+static VALUE sym_busy_poll_usecs, sym_busy_poll_budget, sym_prefer_busy_poll;
+
+static void get_params(VALUE self, struct epoll_params *p)
+{
+	memset(p, 0, sizeof(*p));
+	if (ioctl(rb_sp_fileno(self), EPIOCGPARAMS, p) < 0)
+		rb_sys_fail("ioctl(EPIOCGPARAMS)");
+}
+
+/*
+ * call-seq:
+ *	ep_io.busy_poll_params	-> Hash
+ *
+ * Returns the busy poll parameters of the kernel for this epoll
+ * descriptor as a Hash with the +:busy_poll_usecs+, +:busy_poll_budget+
+ * and +:prefer_busy_poll+ keys.  Requires Linux 6.9 or later, older
+ * kernels raise Errno::ENOTTY.
+ */
+static VALUE busy_poll_params(VALUE self)
+{
+	struct epoll_params p;
+	VALUE rv = rb_hash_new();
+
+	get_params(self, &p);
+	rb_hash_aset(rv, sym_busy_poll_usecs, UINT2NUM(p.busy_poll_usecs));
+	rb_hash_aset(rv, sym_busy_poll_budget, UINT2NUM(p.busy_poll_budget));
+	rb_hash_aset(rv, sym_prefer_busy_poll,
+		     p.prefer_busy_poll ? Qtrue : Qfalse);
+
+	return rv;
+}
+
+/*
+ * call-seq:
+ *	ep_io.busy_poll_params = { busy_poll_usecs: 50, ... }
+ *
+ * Sets the busy poll parameters of the kernel for this epoll
+ * descriptor (EPIOCSPARAMS).  Keys are the same as the ones returned
+ * by Epoll::IO#busy_poll_params, missing keys keep their current
+ * values.  The kernel busy polls the network device queues of sockets
+ * in the epoll set, which only works for NAPI-capable devices.  Budgets
+ * above 64 require CAP_NET_ADMIN.  Requires Linux 6.9 or later, older
+ * kernels raise Errno::ENOTTY.
+ */
+static VALUE set_busy_poll_params(VALUE self, VALUE hash)
+{
+	struct epoll_params p;
+	VALUE v;
+
+	Check_Type(hash, T_HASH);
+	get_params(self, &p);
+
+	v = rb_hash_aref(hash, sym_busy_poll_usecs);
+	if (!NIL_P(v))
+		p.busy_poll_usecs = NUM2UINT(v);
+	v = rb_hash_aref(hash, sym_busy_poll_budget);
+	if (!NIL_P(v)) {
+		unsigned budget = NUM2UINT(v);
+
+		if (budget > 0xffff)
+			rb_raise(rb_eRangeError, "busy_poll_budget too big");
+		p.busy_poll_budget = (uint16_t)budget;
+	}
+	v = rb_hash_lookup2(hash, sym_prefer_busy_poll, Qundef);
+	if (v != Qundef)
+		p.prefer_busy_poll = RTEST(v) ? 1 : 0;
+	p.__pad = 0;
+
+	if (ioctl(rb_sp_fileno(self), EPIOCSPARAMS, &p) < 0)
+		rb_sys_fail("ioctl(EPIOCSPARAMS)");
+
+	return hash;
 }
 
 /* :nodoc: */
@@ -231,6 +881,327 @@ static VALUE event_flags(VALUE self, VALUE flags)
 	return UINT2NUM(rb_sp_get_uflags(self, flags));
 }
 
+/*
+ * The registration table for the high-level Epoll class.  Every method
+ * below issues epoll_ctl(2) and updates the table without releasing the
+ * GVL or calling into Ruby in between, so concurrent add/mod/del from
+ * many threads need no Mutex.  Epoll#dup copies share the same table.
+ */
+static void ep_mark(void *ptr)
+{
+	if (ptr)
+		rb_sp_fdtab_mark(ptr);
+}
+
+static void ep_free(void *ptr)
+{
+	if (ptr)
+		rb_sp_fdtab_unref(ptr);
+}
+
+static size_t ep_memsize(const void *ptr)
+{
+	return ptr ? rb_sp_fdtab_memsize(ptr) : 0;
+}
+
+static const rb_data_type_t ep_type = {
+	"SleepyPenguin::Epoll",
+	{ ep_mark, ep_free, ep_memsize, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE ep_alloc(VALUE klass)
+{
+	VALUE self = TypedData_Wrap_Struct(klass, &ep_type, NULL);
+
+	DATA_PTR(self) = rb_sp_fdtab_new();
+
+	return self;
+}
+
+static struct rb_sp_fdtab *ep_tab(VALUE self)
+{
+	return rb_check_typeddata(self, &ep_type);
+}
+
+/* :nodoc: */
+static VALUE ep_share(VALUE self, VALUE src)
+{
+	struct rb_sp_fdtab *tab = ep_tab(self);
+	struct rb_sp_fdtab *src_tab = ep_tab(src);
+
+	if (tab != src_tab) {
+		DATA_PTR(self) = rb_sp_fdtab_ref(src_tab);
+		rb_sp_fdtab_unref(tab);
+	}
+
+	return self;
+}
+
+#ifdef EPOLLEXCLUSIVE
+#  ifdef EPOLLWAKEUP
+#    define EP_WAKEUP EPOLLWAKEUP
+#  else
+#    define EP_WAKEUP 0
+#  endif
+/* the kernel rejects anything else combined with EPOLLEXCLUSIVE */
+#  define EP_EXCLUSIVE_OK (EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | \
+			   EP_WAKEUP | EPOLLET | EPOLLEXCLUSIVE)
+
+/* raises ArgumentError for combinations the kernel rejects with EINVAL */
+static void ep_exclusive_check(int op, uint32_t ev, uint32_t cur_ev)
+{
+	if (op == EPOLL_CTL_ADD) {
+		if ((ev & EPOLLEXCLUSIVE) && (ev & ~EP_EXCLUSIVE_OK))
+			rb_raise(rb_eArgError,
+				 "EXCLUSIVE may only be combined with "
+				 "IN, OUT, ET and WAKEUP");
+		return;
+	}
+	if (ev & EPOLLEXCLUSIVE)
+		rb_raise(rb_eArgError, "EXCLUSIVE may only be used when adding");
+	if (cur_ev & EPOLLEXCLUSIVE)
+		rb_raise(rb_eArgError,
+			 "EXCLUSIVE registrations can not be modified, "
+			 "delete and add them again");
+}
+#else
+#  define ep_exclusive_check(op,ev,cur_ev) do {} while (0)
+#endif
+
+/*
+ * Called after fork with the new Epoll::IO of the child.  Every
+ * registration is dropped, except EXCLUSIVE ones which are re-added to
+ * +epio+ so each child of a prefork server keeps sharing its listen
+ * sockets without waking every child on every connection.
+ */
+/* :nodoc: */
+static VALUE ep_reset(VALUE self, VALUE epio)
+{
+	struct rb_sp_fdtab *tab = ep_tab(self);
+	VALUE keep = rb_ary_new();
+	int epfd = rb_sp_fileno(epio);
+	size_t i;
+	unsigned j;
+	long k;
+
+#ifdef EPOLLEXCLUSIVE
+	for (i = 0; i < tab->npages; i++) {
+		struct rb_sp_fdtab_page *page = tab->pages[i];
+
+		if (!page)
+			continue;
+		for (j = 0; j < RB_SP_FDTAB_PAGE_SIZE; j++) {
+			if (!page->objs[j] ||
+			    !(page->events[j] & EPOLLEXCLUSIVE))
+				continue;
+			rb_ary_push(keep, INT2FIX(i * RB_SP_FDTAB_PAGE_SIZE + j));
+			rb_ary_push(keep, page->objs[j]);
+			rb_ary_push(keep, UINT2NUM(page->events[j]));
+		}
+	}
+#endif
+	rb_sp_fdtab_reset(tab);
+
+	for (k = 0; k < RARRAY_LEN(keep); k += 3) {
+		int fd = FIX2INT(rb_ary_entry(keep, k));
+		VALUE io = rb_ary_entry(keep, k + 1);
+		uint32_t ev = NUM2UINT(rb_ary_entry(keep, k + 2));
+
+		/* the child may have closed it, or reused its descriptor */
+		if (rb_sp_io_closed(io) || rb_sp_fileno(io) != fd)
+			continue;
+		if (ep_ctl(epio, epfd, EPOLL_CTL_ADD, fd, io, ev) == 0)
+			rb_sp_fdtab_set(tab, fd, io, ev);
+	}
+
+	return Qnil;
+}
+
+/* :nodoc: */
+static VALUE ep_add(VALUE self, VALUE epio, VALUE io, VALUE events)
+{
+	uint32_t ev = rb_sp_get_uflags(self, events);
+	int fd = rb_sp_fileno(io);
+	int epfd = rb_sp_fileno(epio);
+
+	ep_exclusive_check(EPOLL_CTL_ADD, ev, 0);
+	if (ep_ctl(epio, epfd, EPOLL_CTL_ADD, fd, io, ev) < 0)
+		rb_sys_fail("epoll_ctl");
+	rb_sp_fdtab_set(ep_tab(self), fd, io, ev);
+
+	return INT2FIX(0);
+}
+
+/* :nodoc: */
+static VALUE ep_mod(VALUE self, VALUE epio, VALUE io, VALUE events)
+{
+	uint32_t ev = rb_sp_get_uflags(self, events);
+	int fd = rb_sp_fileno(io);
+	int epfd = rb_sp_fileno(epio);
+	uint32_t cur_ev = 0;
+
+	rb_sp_fdtab_get(ep_tab(self), fd, &cur_ev);
+	ep_exclusive_check(EPOLL_CTL_MOD, ev, cur_ev);
+	if (ep_ctl(epio, epfd, EPOLL_CTL_MOD, fd, io, ev) < 0)
+		rb_sys_fail("epoll_ctl");
+
+	/* may be a different object with the same fd/file */
+	rb_sp_fdtab_set(ep_tab(self), fd, io, ev);
+
+	return INT2FIX(0);
+}
+
+/* :nodoc: */
+static VALUE ep_del(VALUE self, VALUE epio, VALUE io)
+{
+	int fd = rb_sp_fileno(io);
+	int epfd = rb_sp_fileno(epio);
+
+	if (ep_ctl(epio, epfd, EPOLL_CTL_DEL, fd, io, 0) < 0)
+		rb_sys_fail("epoll_ctl");
+	rb_sp_fdtab_clear(ep_tab(self), fd);
+
+	return INT2FIX(0);
+}
+
+/* :nodoc: */
+static VALUE ep_delete(VALUE self, VALUE epio, VALUE io)
+{
+	int fd = rb_sp_fileno(io);
+	int epfd = rb_sp_fileno(epio);
+	VALUE cur = rb_sp_fdtab_get(ep_tab(self), fd, NULL);
+
+	if (NIL_P(cur) || rb_sp_io_closed(cur))
+		return Qnil;
+
+	if (ep_ctl(epio, epfd, EPOLL_CTL_DEL, fd, io, 0) < 0) {
+		if (errno == ENOENT || errno == EBADF)
+			return Qnil;
+		rb_sys_fail("epoll_ctl");
+	}
+	rb_sp_fdtab_clear(ep_tab(self), fd);
+
+	return io;
+}
+
+/* :nodoc: */
+static VALUE ep_set(VALUE self, VALUE epio, VALUE io, VALUE events)
+{
+	uint32_t ev = rb_sp_get_uflags(self, events);
+	int fd = rb_sp_fileno(io);
+	int epfd = rb_sp_fileno(epio);
+	uint32_t cur_ev = 0;
+	VALUE cur = rb_sp_fdtab_get(ep_tab(self), fd, &cur_ev);
+
+	if (cur == io) {
+		if ((cur_ev & EPOLLONESHOT) == 0 && cur_ev == ev)
+			return INT2FIX(0);
+		ep_exclusive_check(EPOLL_CTL_MOD, ev, cur_ev);
+		if (ep_ctl(epio, epfd, EPOLL_CTL_MOD, fd, io, ev) < 0) {
+			if (errno != ENOENT)
+				rb_sys_fail("epoll_ctl");
+			rb_warn("epoll event cache failed (mod -> add)");
+			if (ep_ctl(epio, epfd, EPOLL_CTL_ADD, fd, io, ev) < 0)
+				rb_sys_fail("epoll_ctl");
+		}
+	} else {
+		ep_exclusive_check(EPOLL_CTL_ADD, ev, 0);
+		if (ep_ctl(epio, epfd, EPOLL_CTL_ADD, fd, io, ev) < 0) {
+			if (errno != EEXIST)
+				rb_sys_fail("epoll_ctl");
+			rb_warn("epoll event cache failed (add -> mod)");
+			if (ep_ctl(epio, epfd, EPOLL_CTL_MOD, fd, io, ev) < 0)
+				rb_sys_fail("epoll_ctl");
+		}
+	}
+	rb_sp_fdtab_set(ep_tab(self), fd, io, ev);
+
+	return INT2FIX(0);
+}
+
+/* :nodoc: */
+static VALUE ep_io_for(VALUE self, VALUE io)
+{
+	return rb_sp_fdtab_get(ep_tab(self), ep_fileno(io), NULL);
+}
+
+/* :nodoc: */
+static VALUE ep_events_for(VALUE self, VALUE io)
+{
+	uint32_t ev;
+	VALUE cur = rb_sp_fdtab_get(ep_tab(self), ep_fileno(io), &ev);
+
+	return NIL_P(cur) ? Qnil : UINT2NUM(ev);
+}
+
+/* :nodoc: */
+static VALUE ep_rearm(VALUE self, VALUE io, VALUE events)
+{
+	uint32_t ev = rb_sp_get_uflags(self, events);
+	int fd = rb_sp_fileno(io);
+	uint32_t cur_ev = 0;
+
+	rb_sp_fdtab_get(ep_tab(self), fd, &cur_ev);
+	ep_exclusive_check(EPOLL_CTL_MOD, ev, cur_ev);
+
+	rb_sp_fdtab_defer(ep_tab(self), fd, io, ev);
+
+	return INT2FIX(0);
+}
+
+/* :nodoc: */
+static VALUE ep_rearm_flush(VALUE self, VALUE epio)
+{
+	struct rb_sp_fdtab *tab = ep_tab(self);
+	int epfd;
+	int err = 0;
+	size_t i;
+
+	if (tab->ndirty == 0)
+		return Qnil;
+
+	epfd = rb_sp_fileno(epio);
+	for (i = 0; i < tab->ndirty; i++) {
+		int fd = tab->dirty[i];
+		uint32_t ev;
+		VALUE io = rb_sp_fdtab_undefer(tab, fd, &ev);
+
+		if (NIL_P(io))
+			continue; /* deleted or modified since */
+
+		if (ep_ctl(epio, epfd, EPOLL_CTL_MOD, fd, io, ev) == 0)
+			continue;
+
+		/* the descriptor may be gone since, like Epoll#delete */
+		if (errno == ENOENT || errno == EBADF)
+			rb_sp_fdtab_clear(tab, fd);
+		else if (!err)
+			err = errno;
+	}
+	tab->ndirty = 0;
+	if (err) {
+		errno = err;
+		rb_sys_fail("epoll_ctl");
+	}
+
+	return Qnil;
+}
+
+/* :nodoc: */
+static VALUE ep_pin(VALUE self)
+{
+	return ULL2NUM(rb_sp_fdtab_pin(ep_tab(self)));
+}
+
+/* :nodoc: */
+static VALUE ep_unpin(VALUE self, VALUE gen)
+{
+	rb_sp_fdtab_unpin(ep_tab(self), NUM2ULL(gen));
+
+	return Qnil;
+}
+
 void sleepy_penguin_init_epoll(void)
 {
 	VALUE mSleepyPenguin, cEpoll_IO;
@@ -256,6 +1227,11 @@ void sleepy_penguin_init_epoll(void)
 	 * - SP::EventFD
 	 * - SP::Inotify
 	 * - SP::TimerFD
+	 *
+	 * With Ruby 3.0 and later, every Ractor may create and use its own
+	 * objects to run independent event loops in parallel.  Objects
+	 * themselves are not shareable and must stay in the Ractor which
+	 * created them.
 	 */
 	mSleepyPenguin = rb_define_module("SleepyPenguin");
 
@@ -274,15 +1250,40 @@ void sleepy_penguin_init_epoll(void)
 	 *
 	 * Epoll::IO is a low-level class.  It does not provide fork nor
 	 * GC-safety, so Ruby IO objects added via epoll_ctl must be retained
-	 * by the application until IO#close is called.
+	 * (and must not be moved by GC.compact) by the application until
+	 * IO#close is called.  Integer tokens passed to epoll_ctl avoid
+	 * both problems.
 	 */
 	cEpoll_IO = rb_define_class_under(cEpoll, "IO", rb_cIO);
 	rb_define_singleton_method(cEpoll_IO, "new", s_new, 1);
 
-	rb_define_method(cEpoll_IO, "epoll_ctl", epctl, 3);
+	rb_define_method(cEpoll_IO, "epoll_ctl", epctl, -1);
+	rb_define_method(cEpoll_IO, "epoll_ctl_batch", epctl_batch, 1);
 	rb_define_method(cEpoll_IO, "epoll_wait", epwait, -1);
+	rb_define_method(cEpoll_IO, "epoll_wait_into", epwait_into, -1);
+	rb_define_method(cEpoll_IO, "epoll_pwait", epwait_sigmask, -1);
+	rb_define_method(cEpoll_IO, "epoll_wait_until", epwait_until, -1);
+	rb_define_method(cEpoll_IO, "busy_poll=", set_busy_poll, 1);
+	rb_define_method(cEpoll_IO, "busy_poll", busy_poll, 0);
+	rb_define_method(cEpoll_IO, "busy_poll_params", busy_poll_params, 0);
+	rb_define_method(cEpoll_IO, "busy_poll_params=",
+			 set_busy_poll_params, 1);
 
+	rb_define_alloc_func(cEpoll, ep_alloc);
 	rb_define_method(cEpoll, "__event_flags", event_flags, 1);
+	rb_define_method(cEpoll, "__ep_share", ep_share, 1);
+	rb_define_method(cEpoll, "__ep_reset", ep_reset, 1);
+	rb_define_method(cEpoll, "__add", ep_add, 3);
+	rb_define_method(cEpoll, "__mod", ep_mod, 3);
+	rb_define_method(cEpoll, "__del", ep_del, 2);
+	rb_define_method(cEpoll, "__delete", ep_delete, 2);
+	rb_define_method(cEpoll, "__set", ep_set, 3);
+	rb_define_method(cEpoll, "__io_for", ep_io_for, 1);
+	rb_define_method(cEpoll, "__events_for", ep_events_for, 1);
+	rb_define_method(cEpoll, "__rearm", ep_rearm, 2);
+	rb_define_method(cEpoll, "__rearm_flush", ep_rearm_flush, 1);
+	rb_define_method(cEpoll, "__pin", ep_pin, 0);
+	rb_define_method(cEpoll, "__unpin", ep_unpin, 1);
 
 	/* registers an IO object via epoll_ctl */
 	rb_define_const(cEpoll, "CTL_ADD", INT2NUM(EPOLL_CTL_ADD));
@@ -340,7 +1341,23 @@ void sleepy_penguin_init_epoll(void)
 	/* unwatch the descriptor once any event has fired */
 	rb_define_const(cEpoll, "ONESHOT", UINT2NUM(EPOLLONESHOT));
 
+#ifdef EPOLLEXCLUSIVE
+	/*
+	 * Only wake up one (or a few) of the epoll descriptors watching
+	 * the same file when an event fires, avoiding thundering herds
+	 * in prefork servers sharing a listen socket.  This may only be
+	 * combined with IN, OUT, ET and WAKEUP, and only when adding.
+	 * Epoll objects re-add EXCLUSIVE registrations in forked children.
+	 * Available since Linux 4.5
+	 */
+	rb_define_const(cEpoll, "EXCLUSIVE", UINT2NUM(EPOLLEXCLUSIVE));
+#endif
+
 	id_for_fd = rb_intern("for_fd");
+	id_busy_poll = rb_intern("busy_poll"); /* no "@", hidden from Ruby */
+	sym_busy_poll_usecs = ID2SYM(rb_intern("busy_poll_usecs"));
+	sym_busy_poll_budget = ID2SYM(rb_intern("busy_poll_budget"));
+	sym_prefer_busy_poll = ID2SYM(rb_intern("prefer_busy_poll"));
 
 	if (RB_SP_GREEN_THREAD)
 		rb_require("sleepy_penguin/epoll/io");
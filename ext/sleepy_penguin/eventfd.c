@@ -1,6 +1,8 @@
 #ifdef HAVE_SYS_EVENTFD_H
 #include "sleepy_penguin.h"
 #include <sys/eventfd.h>
+#include "stats.h"
+#include "probes.h"
 
 /*
  * call-seq:
@@ -30,6 +32,7 @@ static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 	flags = rb_sp_get_flags(klass, _flags, RB_SP_CLOEXEC(EFD_CLOEXEC));
 
 	fd = eventfd(initval, flags);
+	rb_sp_stat_syscall(RB_SP_STAT_EVENTFD, Qnil, fd);
 	if (fd < 0) {
 		if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
 			rb_gc();
@@ -51,7 +54,12 @@ struct efd_args {
 static VALUE efd_write(void *_args)
 {
 	struct efd_args *args = _args;
-	ssize_t w = write(args->fd, &args->val, sizeof(uint64_t));
+	ssize_t w;
+
+	SP_PROBE2(eventfd_write_entry, args->fd, args->val);
+	w = write(args->fd, &args->val, sizeof(uint64_t));
+	SP_PROBE4(eventfd_write_return, args->fd, args->val,
+		  w < 0 ? (int64_t)w : (int64_t)args->val, SP_PROBE_ERRNO(w));
 
 	return (VALUE)w;
 }
@@ -59,7 +67,12 @@ static VALUE efd_write(void *_args)
 static VALUE efd_read(void *_args)
 {
 	struct efd_args *args = _args;
-	ssize_t r = read(args->fd, &args->val, sizeof(uint64_t));
+	ssize_t r;
+
+	SP_PROBE2(eventfd_read_entry, args->fd, sizeof(uint64_t));
+	r = read(args->fd, &args->val, sizeof(uint64_t));
+	SP_PROBE4(eventfd_read_return, args->fd, sizeof(uint64_t),
+		  r < 0 ? (int64_t)r : (int64_t)args->val, SP_PROBE_ERRNO(r));
 
 	return (VALUE)r;
 }
@@ -81,16 +94,23 @@ static VALUE incr(int argc, VALUE *argv, VALUE self)
 	struct efd_args x;
 	ssize_t w;
 	VALUE value, nonblock;
+	int nb;
 
 	rb_scan_args(argc, argv, "11", &value, &nonblock);
 	x.fd = rb_sp_fileno(self);
-	RTEST(nonblock) ? rb_sp_set_nonblock(x.fd) : blocking_io_prepare(x.fd);
+	nb = rb_sp_io_prepare(nonblock, x.fd);
 	x.val = (uint64_t)NUM2ULL(value);
 retry:
-	w = (ssize_t)rb_sp_fd_region(efd_write, &x, x.fd);
+	w = (ssize_t)(nb ?
+		rb_sp_stat_call(RB_SP_STAT_EVENTFD, self, efd_write, &x) :
+		rb_sp_stat_region(RB_SP_STAT_EVENTFD, self,
+				  efd_write, &x, x.fd));
 	if (w < 0) {
-		if (errno == EAGAIN && RTEST(nonblock))
-			return Qfalse;
+		if (errno == EAGAIN) {
+			if (RTEST(nonblock))
+				return Qfalse;
+			nb = 1; /* O_NONBLOCK is set, retries need not sleep */
+		}
 		if (rb_sp_wait(rb_io_wait_writable, self, &x.fd))
 			goto retry;
 		rb_sys_fail("write(eventfd)");
@@ -118,15 +138,22 @@ static VALUE getvalue(int argc, VALUE *argv, VALUE self)
 	struct efd_args x;
 	ssize_t w;
 	VALUE nonblock;
+	int nb;
 
 	rb_scan_args(argc, argv, "01", &nonblock);
 	x.fd = rb_sp_fileno(self);
-	RTEST(nonblock) ? rb_sp_set_nonblock(x.fd) : blocking_io_prepare(x.fd);
+	nb = rb_sp_io_prepare(nonblock, x.fd);
 retry:
-	w = (ssize_t)rb_sp_fd_region(efd_read, &x, x.fd);
+	w = (ssize_t)(nb ?
+		rb_sp_stat_call(RB_SP_STAT_EVENTFD, self, efd_read, &x) :
+		rb_sp_stat_region(RB_SP_STAT_EVENTFD, self,
+				  efd_read, &x, x.fd));
 	if (w < 0) {
-		if (errno == EAGAIN && RTEST(nonblock))
-			return Qnil;
+		if (errno == EAGAIN) {
+			if (RTEST(nonblock))
+				return Qnil;
+			nb = 1; /* O_NONBLOCK is set, retries need not sleep */
+		}
 		if (rb_sp_wait(rb_io_wait_readable, self, &x.fd))
 			goto retry;
 		rb_sys_fail("read(eventfd)");
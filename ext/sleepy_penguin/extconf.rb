@@ -12,12 +12,22 @@ have_header('sys/eventfd.h')
 
 have_header('sys/timerfd.h')
 have_header('sys/inotify.h')
+have_header('linux/io_uring.h')
+have_header('sys/sdt.h')
 have_header('ruby/io.h') and have_struct_member('rb_io_t', 'fd', 'ruby/io.h')
 have_func('epoll_create1', %w(sys/epoll.h))
+have_func('epoll_pwait2', %w(sys/epoll.h))
 have_func('rb_thread_call_without_gvl')
 have_func('rb_thread_blocking_region')
 have_func('rb_thread_io_blocking_region')
 have_func('rb_thread_fd_close')
 have_func('rb_update_max_fd')
 have_func('rb_fd_fix_cloexec')
+have_func('rb_syserr_new')
+have_func('rb_ext_ractor_safe')
+have_header('ruby/version.h')
+have_func('rb_io_wait', 'ruby/io.h')
+have_func('rb_enc_interned_str', 'ruby/encoding.h')
+have_header('ruby/fiber/scheduler.h') and
+  have_func('rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h')
 create_makefile('sleepy_penguin_ext')
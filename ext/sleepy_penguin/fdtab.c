@@ -0,0 +1,262 @@
+#include "fdtab.h"
+
+struct rb_sp_fdtab *rb_sp_fdtab_new(void)
+{
+	struct rb_sp_fdtab *tab = ALLOC(struct rb_sp_fdtab);
+
+	tab->refcnt = 1;
+	tab->live = 0;
+	tab->npages = 0;
+	tab->pages = NULL;
+	tab->gen = 0;
+	tab->npins = tab->pins_capa = 0;
+	tab->pins = NULL;
+	tab->nretired = tab->retired_capa = 0;
+	tab->retired = NULL;
+	tab->ndirty = tab->dirty_capa = 0;
+	tab->dirty = NULL;
+
+	return tab;
+}
+
+struct rb_sp_fdtab *rb_sp_fdtab_ref(struct rb_sp_fdtab *tab)
+{
+	tab->refcnt++;
+	return tab;
+}
+
+void rb_sp_fdtab_reset(struct rb_sp_fdtab *tab)
+{
+	size_t i;
+
+	for (i = 0; i < tab->npages; i++)
+		xfree(tab->pages[i]);
+	xfree(tab->pages);
+	tab->pages = NULL;
+	tab->npages = 0;
+	tab->live = 0;
+
+	/* only used after fork, waiters in other threads are gone */
+	xfree(tab->pins);
+	tab->pins = NULL;
+	tab->npins = tab->pins_capa = 0;
+	xfree(tab->retired);
+	tab->retired = NULL;
+	tab->nretired = tab->retired_capa = 0;
+	xfree(tab->dirty);
+	tab->dirty = NULL;
+	tab->ndirty = tab->dirty_capa = 0;
+}
+
+void rb_sp_fdtab_unref(struct rb_sp_fdtab *tab)
+{
+	if (--tab->refcnt > 0)
+		return;
+	rb_sp_fdtab_reset(tab);
+	xfree(tab);
+}
+
+void rb_sp_fdtab_mark(const struct rb_sp_fdtab *tab)
+{
+	size_t i;
+	unsigned j;
+
+	for (i = 0; i < tab->npages; i++) {
+		const struct rb_sp_fdtab_page *page = tab->pages[i];
+
+		if (!page)
+			continue;
+		/*
+		 * rb_gc_mark pins objects: their addresses live in the kernel
+		 * as epoll_event.data and must not be moved by GC.compact
+		 */
+		for (j = 0; j < RB_SP_FDTAB_PAGE_SIZE; j++)
+			if (page->objs[j])
+				rb_gc_mark(page->objs[j]);
+	}
+	for (i = 0; i < tab->nretired; i++)
+		rb_gc_mark(tab->retired[i].obj);
+}
+
+size_t rb_sp_fdtab_memsize(const struct rb_sp_fdtab *tab)
+{
+	size_t i;
+	size_t rv = sizeof(*tab) + tab->npages * sizeof(tab->pages[0]);
+
+	rv += tab->pins_capa * sizeof(tab->pins[0]);
+	rv += tab->retired_capa * sizeof(tab->retired[0]);
+	rv += tab->dirty_capa * sizeof(tab->dirty[0]);
+
+	for (i = 0; i < tab->npages; i++)
+		if (tab->pages[i])
+			rv += sizeof(struct rb_sp_fdtab_page);
+
+	return rv;
+}
+
+/* drops retired objects no pinned waiter could have seen */
+static void release(struct rb_sp_fdtab *tab)
+{
+	size_t n = 0;
+
+	if (tab->npins == 0) {
+		n = tab->nretired;
+	} else {
+		uint64_t oldest = tab->pins[0].gen;
+
+		while (n < tab->nretired && tab->retired[n].gen < oldest)
+			n++;
+	}
+	if (n == 0)
+		return;
+	tab->nretired -= n;
+	MEMMOVE(tab->retired, tab->retired + n,
+		struct rb_sp_fdtab_retired, tab->nretired);
+}
+
+static void retire(struct rb_sp_fdtab *tab, VALUE obj)
+{
+	struct rb_sp_fdtab_retired *r;
+
+	if (tab->npins == 0)
+		return; /* nobody is waiting, GC may take it right away */
+
+	if (tab->nretired == tab->retired_capa) {
+		tab->retired_capa = tab->retired_capa ? tab->retired_capa * 2 : 8;
+		REALLOC_N(tab->retired, struct rb_sp_fdtab_retired,
+			  tab->retired_capa);
+	}
+	r = &tab->retired[tab->nretired++];
+	r->gen = tab->gen++; /* new waiters can't see obj */
+	r->obj = obj;
+}
+
+uint64_t rb_sp_fdtab_pin(struct rb_sp_fdtab *tab)
+{
+	struct rb_sp_fdtab_pin *pin;
+
+	if (tab->npins && tab->pins[tab->npins - 1].gen == tab->gen) {
+		pin = &tab->pins[tab->npins - 1];
+	} else {
+		if (tab->npins == tab->pins_capa) {
+			tab->pins_capa = tab->pins_capa ? tab->pins_capa * 2 : 4;
+			REALLOC_N(tab->pins, struct rb_sp_fdtab_pin,
+				  tab->pins_capa);
+		}
+		pin = &tab->pins[tab->npins++];
+		pin->gen = tab->gen;
+		pin->count = 0;
+	}
+	pin->count++;
+
+	return tab->gen;
+}
+
+void rb_sp_fdtab_unpin(struct rb_sp_fdtab *tab, uint64_t gen)
+{
+	size_t i;
+
+	for (i = 0; i < tab->npins; i++) {
+		struct rb_sp_fdtab_pin *pin = &tab->pins[i];
+
+		if (pin->gen != gen)
+			continue;
+		if (--pin->count == 0) {
+			tab->npins--;
+			MEMMOVE(pin, pin + 1, struct rb_sp_fdtab_pin,
+				tab->npins - i);
+			if (i == 0)
+				release(tab);
+		}
+		return;
+	}
+	/* unknown generation, may happen if we were reset after fork */
+}
+
+static struct rb_sp_fdtab_page *
+fdtab_store(struct rb_sp_fdtab *tab, int fd, VALUE obj, uint32_t ev)
+{
+	size_t idx = (size_t)fd >> RB_SP_FDTAB_SHIFT;
+	unsigned off = (unsigned)fd & RB_SP_FDTAB_PAGE_MASK;
+	struct rb_sp_fdtab_page *page;
+
+	assert(fd >= 0 && "negative FD stored in fdtab");
+	if (idx >= tab->npages) {
+		size_t n = idx + 1;
+
+		/* grow the page directory geometrically */
+		if (n < tab->npages * 2)
+			n = tab->npages * 2;
+		REALLOC_N(tab->pages, struct rb_sp_fdtab_page *, n);
+		MEMZERO(tab->pages + tab->npages,
+			struct rb_sp_fdtab_page *, n - tab->npages);
+		tab->npages = n;
+	}
+	page = tab->pages[idx];
+	if (!page) {
+		page = ZALLOC(struct rb_sp_fdtab_page);
+		tab->pages[idx] = page;
+	}
+	if (!page->objs[off]) {
+		page->live++;
+		tab->live++;
+	} else if (page->objs[off] != obj) {
+		retire(tab, page->objs[off]);
+	}
+	page->objs[off] = obj;
+	page->events[off] = ev;
+
+	return page;
+}
+
+void rb_sp_fdtab_set(struct rb_sp_fdtab *tab, int fd, VALUE obj, uint32_t ev)
+{
+	struct rb_sp_fdtab_page *page = fdtab_store(tab, fd, obj, ev);
+
+	/* the kernel is up-to-date, nothing left to flush */
+	page->dirty[(unsigned)fd & RB_SP_FDTAB_PAGE_MASK] = 0;
+}
+
+void rb_sp_fdtab_defer(struct rb_sp_fdtab *tab, int fd, VALUE obj,
+			uint32_t ev)
+{
+	struct rb_sp_fdtab_page *page;
+	unsigned off = (unsigned)fd & RB_SP_FDTAB_PAGE_MASK;
+
+	/* reserve space first so we can't fail after storing */
+	if (tab->ndirty == tab->dirty_capa) {
+		tab->dirty_capa = tab->dirty_capa ? tab->dirty_capa * 2 : 64;
+		REALLOC_N(tab->dirty, int, tab->dirty_capa);
+	}
+	page = fdtab_store(tab, fd, obj, ev);
+	if (!page->dirty[off]) {
+		page->dirty[off] = 1;
+		tab->dirty[tab->ndirty++] = fd;
+	}
+}
+
+VALUE rb_sp_fdtab_clear(struct rb_sp_fdtab *tab, int fd)
+{
+	size_t idx = (size_t)fd >> RB_SP_FDTAB_SHIFT;
+	unsigned off = (unsigned)fd & RB_SP_FDTAB_PAGE_MASK;
+	struct rb_sp_fdtab_page *page;
+	VALUE old;
+
+	if (fd < 0 || idx >= tab->npages || !(page = tab->pages[idx]))
+		return Qnil;
+	old = page->objs[off];
+	if (!old)
+		return Qnil;
+
+	retire(tab, old);
+	page->objs[off] = 0;
+	page->events[off] = 0;
+	page->dirty[off] = 0;
+	tab->live--;
+	if (--page->live == 0) {
+		tab->pages[idx] = NULL;
+		xfree(page);
+	}
+
+	return old;
+}
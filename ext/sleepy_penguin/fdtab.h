@@ -0,0 +1,124 @@
+#ifndef SLEEPY_PENGUIN_FDTAB_H
+#define SLEEPY_PENGUIN_FDTAB_H
+#include "sleepy_penguin.h"
+
+/*
+ * A file descriptor-indexed table of Ruby objects and the events they
+ * are registered for.  It is split into fixed-size pages which are
+ * allocated when the first descriptor in their range is stored and
+ * freed when the last one is removed, so memory usage follows the
+ * number of live descriptors rather than the highest descriptor number.
+ *
+ * Callers must hold the GVL.  None of these functions call back into
+ * Ruby, so the GVL alone serializes all updates to a table without any
+ * extra locking.
+ *
+ * Threads sitting in epoll_wait may receive objects which were removed
+ * from the table while they were sleeping.  Instead of snapshotting
+ * the whole table for every wait, waiters pin the current generation
+ * and removed objects are retired with the generation they were removed
+ * in.  Retired objects stay marked until every waiter which could have
+ * seen them has unpinned, RCU-style.
+ */
+#define RB_SP_FDTAB_SHIFT 8
+#define RB_SP_FDTAB_PAGE_SIZE (1U << RB_SP_FDTAB_SHIFT)
+#define RB_SP_FDTAB_PAGE_MASK (RB_SP_FDTAB_PAGE_SIZE - 1)
+
+/* empty slots in objs[] are zero */
+struct rb_sp_fdtab_page {
+	unsigned live;
+	uint32_t events[RB_SP_FDTAB_PAGE_SIZE];
+	VALUE objs[RB_SP_FDTAB_PAGE_SIZE];
+	unsigned char dirty[RB_SP_FDTAB_PAGE_SIZE];
+};
+
+struct rb_sp_fdtab_pin {
+	uint64_t gen;
+	unsigned long count;
+};
+
+struct rb_sp_fdtab_retired {
+	uint64_t gen;
+	VALUE obj;
+};
+
+struct rb_sp_fdtab {
+	long refcnt; /* shared by Epoll#dup copies */
+	size_t live;
+	size_t npages;
+	struct rb_sp_fdtab_page **pages;
+	uint64_t gen;
+
+	/* ascending by gen, at most one entry per generation */
+	size_t npins;
+	size_t pins_capa;
+	struct rb_sp_fdtab_pin *pins;
+
+	/* ascending by gen */
+	size_t nretired;
+	size_t retired_capa;
+	struct rb_sp_fdtab_retired *retired;
+
+	/*
+	 * descriptors whose stored events have not been applied to the
+	 * kernel yet, each is queued at most once
+	 */
+	size_t ndirty;
+	size_t dirty_capa;
+	int *dirty;
+};
+
+struct rb_sp_fdtab *rb_sp_fdtab_new(void);
+struct rb_sp_fdtab *rb_sp_fdtab_ref(struct rb_sp_fdtab *);
+void rb_sp_fdtab_unref(struct rb_sp_fdtab *);
+void rb_sp_fdtab_mark(const struct rb_sp_fdtab *);
+size_t rb_sp_fdtab_memsize(const struct rb_sp_fdtab *);
+void rb_sp_fdtab_set(struct rb_sp_fdtab *, int fd, VALUE obj, uint32_t);
+VALUE rb_sp_fdtab_clear(struct rb_sp_fdtab *, int fd);
+void rb_sp_fdtab_reset(struct rb_sp_fdtab *);
+void rb_sp_fdtab_defer(struct rb_sp_fdtab *, int fd, VALUE obj, uint32_t);
+uint64_t rb_sp_fdtab_pin(struct rb_sp_fdtab *);
+void rb_sp_fdtab_unpin(struct rb_sp_fdtab *, uint64_t gen);
+
+/* returns Qnil if +fd+ is not stored */
+static inline VALUE
+rb_sp_fdtab_get(const struct rb_sp_fdtab *tab, int fd, uint32_t *events)
+{
+	size_t idx = (size_t)fd >> RB_SP_FDTAB_SHIFT;
+	struct rb_sp_fdtab_page *page;
+	unsigned off;
+
+	if (fd < 0 || idx >= tab->npages || !(page = tab->pages[idx]))
+		return Qnil;
+	off = (unsigned)fd & RB_SP_FDTAB_PAGE_MASK;
+	if (!page->objs[off])
+		return Qnil;
+	if (events)
+		*events = page->events[off];
+
+	return page->objs[off];
+}
+
+/*
+ * returns the object stored at +fd+ if it was deferred and clears the
+ * deferred state, Qnil otherwise
+ */
+static inline VALUE
+rb_sp_fdtab_undefer(struct rb_sp_fdtab *tab, int fd, uint32_t *events)
+{
+	size_t idx = (size_t)fd >> RB_SP_FDTAB_SHIFT;
+	struct rb_sp_fdtab_page *page;
+	unsigned off;
+
+	if (fd < 0 || idx >= tab->npages || !(page = tab->pages[idx]))
+		return Qnil;
+	off = (unsigned)fd & RB_SP_FDTAB_PAGE_MASK;
+	if (!page->dirty[off])
+		return Qnil;
+	page->dirty[off] = 0;
+	*events = page->events[off];
+
+	return page->objs[off];
+}
+
+#endif /* SLEEPY_PENGUIN_FDTAB_H */
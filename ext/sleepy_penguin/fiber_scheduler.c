@@ -0,0 +1,327 @@
+#include "sleepy_penguin.h"
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H) && \
+    defined(HAVE_SYS_EVENTFD_H)
+#include <sys/epoll.h>
+#include "missing_epoll.h"
+#include "fdtab.h"
+#include "arena.h"
+#include "stats.h"
+#include "probes.h"
+
+/*
+ * The C half of SleepyPenguin::FiberScheduler, everything which happens
+ * once per wait lives here.  Waiting fibers are kept in a fdtab indexed
+ * by descriptor, each slot holds a flat Array of [waiter, events, ...]
+ * pairs and whether the descriptor is armed in the kernel.  Waiters
+ * are whatever the Ruby side passes in, one object per suspension.
+ * Registrations are always ONESHOT: every wakeup disarms the descriptor,
+ * and it is only rearmed if some fibers are still waiting on it.  Nothing here
+ * calls into Ruby, so the table needs no locking beyond the GVL.
+ */
+
+/* IO::READABLE, IO::PRIORITY and IO::WRITABLE in Ruby 3.0+ */
+#define FS_READABLE 1
+#define FS_PRIORITY 2
+#define FS_WRITABLE 4
+#define FS_EVENTS (FS_READABLE|FS_PRIORITY|FS_WRITABLE)
+
+/* events returned by one epoll_wait, the rest wait for the next round */
+#define FS_MAXEVENTS 256
+
+struct fs_wait {
+	int epfd;
+	int timeout;
+	struct epoll_event events[FS_MAXEVENTS];
+};
+
+static uint32_t to_epoll(int want)
+{
+	uint32_t ev = EPOLLONESHOT;
+
+	if (want & FS_READABLE)
+		ev |= EPOLLIN;
+	if (want & FS_PRIORITY)
+		ev |= EPOLLPRI;
+	if (want & FS_WRITABLE)
+		ev |= EPOLLOUT;
+
+	return ev;
+}
+
+static int from_epoll(uint32_t ev)
+{
+	int got = 0;
+
+	/* everybody retries their I/O to find out about errors */
+	if (ev & (EPOLLERR|EPOLLHUP))
+		return FS_EVENTS;
+	if (ev & EPOLLIN)
+		got |= FS_READABLE;
+	if (ev & EPOLLPRI)
+		got |= FS_PRIORITY;
+	if (ev & EPOLLOUT)
+		got |= FS_WRITABLE;
+
+	return got;
+}
+
+static void fs_mark(void *ptr)
+{
+	if (ptr)
+		rb_sp_fdtab_mark(ptr);
+}
+
+static void fs_free(void *ptr)
+{
+	if (ptr)
+		rb_sp_fdtab_unref(ptr);
+}
+
+static size_t fs_memsize(const void *ptr)
+{
+	return ptr ? rb_sp_fdtab_memsize(ptr) : 0;
+}
+
+static const rb_data_type_t fs_type = {
+	"SleepyPenguin::FiberScheduler",
+	{ fs_mark, fs_free, fs_memsize, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE fs_alloc(VALUE klass)
+{
+	VALUE self = TypedData_Wrap_Struct(klass, &fs_type, NULL);
+
+	DATA_PTR(self) = rb_sp_fdtab_new();
+
+	return self;
+}
+
+static struct rb_sp_fdtab *fs_tab(VALUE self)
+{
+	return rb_check_typeddata(self, &fs_type);
+}
+
+/* union of the events all fibers in +waiters+ are waiting for */
+static int waiters_events(VALUE waiters)
+{
+	long i, n = RARRAY_LEN(waiters);
+	int want = 0;
+
+	for (i = 1; i < n; i += 2)
+		want |= FIX2INT(rb_ary_entry(waiters, i));
+
+	return want;
+}
+
+/*
+ * arms +fd+ for +want+ with a single epoll_ctl in the common case, the
+ * kernel forgets descriptors on close, so they are added again if needed
+ */
+static int fs_arm(VALUE epio, int epfd, int fd, int want)
+{
+	struct epoll_event event;
+	int rc;
+
+	event.events = to_epoll(want);
+	event.data.fd = fd;
+	rc = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &event);
+	rb_sp_stat_syscall(RB_SP_STAT_EPOLL, epio, rc);
+	if (rc < 0 && errno == ENOENT) {
+		rc = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+		rb_sp_stat_syscall(RB_SP_STAT_EPOLL, epio, rc);
+	}
+
+	return rc;
+}
+
+/* :nodoc: */
+static VALUE fs_wait_io(VALUE self, VALUE epio, VALUE io, VALUE events,
+			VALUE fiber)
+{
+	struct rb_sp_fdtab *tab = fs_tab(self);
+	int epfd = rb_sp_fileno(epio);
+	int fd = rb_sp_fileno(io);
+	int want = NUM2INT(events) & FS_EVENTS;
+	VALUE waiters;
+
+	if (!want)
+		rb_raise(rb_eArgError, "no events to wait for");
+	waiters = rb_sp_fdtab_get(tab, fd, NULL);
+	if (NIL_P(waiters))
+		waiters = rb_ary_new();
+	if (fs_arm(epio, epfd, fd, want | waiters_events(waiters)) < 0) {
+		if (errno == EPERM)
+			return Qnil; /* regular files are always ready */
+		rb_sys_fail("epoll_ctl");
+	}
+	rb_ary_push(waiters, fiber);
+	rb_ary_push(waiters, INT2FIX(want));
+	rb_sp_fdtab_set(tab, fd, waiters, 1);
+
+	return INT2FIX(fd);
+}
+
+/* :nodoc: */
+static VALUE fs_cancel_io(VALUE self, VALUE epio, VALUE _fd, VALUE fiber)
+{
+	struct rb_sp_fdtab *tab = fs_tab(self);
+	int fd = NUM2INT(_fd);
+	uint32_t armed = 0;
+	VALUE waiters = rb_sp_fdtab_get(tab, fd, &armed);
+	long i, j = 0, n;
+
+	if (NIL_P(waiters))
+		return Qfalse;
+	n = RARRAY_LEN(waiters);
+	for (i = 0; i < n; i += 2) {
+		VALUE f = rb_ary_entry(waiters, i);
+
+		if (f == fiber)
+			continue;
+		rb_ary_store(waiters, j++, f);
+		rb_ary_store(waiters, j++, rb_ary_entry(waiters, i + 1));
+	}
+	if (j == n)
+		return Qfalse;
+	rb_ary_resize(waiters, j);
+
+	/* others may fire spuriously, they rearm in fs_select */
+	if (j == 0 && armed) {
+		int epfd = rb_sp_fileno(epio);
+		struct epoll_event event; /* ignored, needed for Linux <2.6.9 */
+
+		/* ENOENT or EBADF if it was closed while we waited, fine */
+		rb_sp_stat_syscall(RB_SP_STAT_EPOLL, epio,
+				   epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &event));
+		rb_sp_fdtab_set(tab, fd, waiters, 0);
+	}
+
+	return Qtrue;
+}
+
+static VALUE nogvl_wait(void *args)
+{
+	struct fs_wait *w = args;
+	int n;
+
+	SP_PROBE2(epoll_wait_entry, w->epfd, FS_MAXEVENTS);
+	n = epoll_wait(w->epfd, w->events, FS_MAXEVENTS, w->timeout);
+	SP_PROBE4(epoll_wait_return, w->epfd, FS_MAXEVENTS, n,
+		  SP_PROBE_ERRNO(n));
+
+	return (VALUE)n;
+}
+
+/*
+ * moves fibers waiting on +fd+ for any of +got+ to +ary+ starting at
+ * index +j+, and rearms +fd+ for the ones left behind
+ */
+static long fs_wake(struct rb_sp_fdtab *tab, VALUE epio, int epfd,
+		    int fd, int got, VALUE ary, long j)
+{
+	VALUE waiters = rb_sp_fdtab_get(tab, fd, NULL);
+	long i, k = 0, n;
+	int left = 0;
+
+	if (NIL_P(waiters))
+		return j;
+	n = RARRAY_LEN(waiters);
+	for (i = 0; i < n; i += 2) {
+		VALUE fiber = rb_ary_entry(waiters, i);
+		int want = FIX2INT(rb_ary_entry(waiters, i + 1));
+
+		if (want & got) {
+			rb_ary_store(ary, j++, fiber);
+			rb_ary_store(ary, j++, INT2FIX(want & got));
+		} else {
+			rb_ary_store(waiters, k++, fiber);
+			rb_ary_store(waiters, k++, INT2FIX(want));
+			left |= want;
+		}
+	}
+
+	/* wake the rest, too, if we can't rearm, they'll see the error */
+	if (left && fs_arm(epio, epfd, fd, left) < 0) {
+		for (i = 0; i < k; i += 2) {
+			rb_ary_store(ary, j++, rb_ary_entry(waiters, i));
+			rb_ary_store(ary, j++, rb_ary_entry(waiters, i + 1));
+		}
+		left = k = 0;
+	}
+	rb_ary_resize(waiters, k);
+	rb_sp_fdtab_set(tab, fd, waiters, left ? 1 : 0);
+
+	return j;
+}
+
+/* :nodoc: */
+static VALUE fs_select(VALUE self, VALUE epio, VALUE ary, VALUE timeout)
+{
+	struct rb_sp_fdtab *tab = fs_tab(self);
+	struct fs_wait *w;
+	long j = 0;
+	int i, n;
+
+	Check_Type(ary, T_ARRAY);
+	w = rb_sp_arena_get(RB_SP_ARENA_FIBER, sizeof(struct fs_wait), NULL);
+	w->epfd = rb_sp_fileno(epio);
+	w->timeout = NIL_P(timeout) ? -1 : NUM2INT(timeout);
+
+	/* polling can't sleep, so releasing the GVL would cost more */
+	if (w->timeout == 0)
+		n = (int)rb_sp_stat_call(RB_SP_STAT_EPOLL, epio, nogvl_wait, w);
+	else
+		n = (int)rb_sp_stat_region(RB_SP_STAT_EPOLL, epio,
+					   nogvl_wait, w, w->epfd);
+	if (n < 0) {
+		if (errno != EINTR)
+			rb_sys_fail("epoll_wait");
+		n = 0; /* let the caller run signal handlers */
+	}
+	rb_sp_stat_events(RB_SP_STAT_EPOLL, epio, n);
+
+	for (i = 0; i < n; i++)
+		j = fs_wake(tab, epio, w->epfd, w->events[i].data.fd,
+			    from_epoll(w->events[i].events), ary, j);
+	if (RARRAY_LEN(ary) != j)
+		rb_ary_resize(ary, j);
+
+	return LONG2NUM(j / 2);
+}
+
+void sleepy_penguin_init_fiber_scheduler(void)
+{
+	VALUE mSleepyPenguin, cFiberScheduler;
+
+	mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-class: SleepyPenguin::FiberScheduler
+	 *
+	 * A Fiber::Scheduler (Ruby 3.0+) built on one Epoll::IO, one
+	 * TimerFD and one EventFD:
+	 *
+	 *	Fiber.set_scheduler(SleepyPenguin::FiberScheduler.new)
+	 *	Fiber.schedule { ... }
+	 *
+	 * Each fiber waiting for I/O is a ONESHOT registration, all timeouts
+	 * share a TimerFD armed for the earliest deadline, and other threads
+	 * wake the scheduler up through the EventFD.  The scheduler belongs
+	 * to the thread which created it.
+	 *
+	 * With any scheduler (Ruby 3.1+), EventFD#value, EventFD#incr,
+	 * TimerFD#expirations, Inotify#take and Epoll waits without a
+	 * signal mask suspend only the calling fiber while they wait.
+	 */
+	cFiberScheduler = rb_define_class_under(mSleepyPenguin,
+						"FiberScheduler", rb_cObject);
+	rb_define_alloc_func(cFiberScheduler, fs_alloc);
+	rb_define_private_method(cFiberScheduler, "__wait_io", fs_wait_io, 4);
+	rb_define_private_method(cFiberScheduler, "__cancel_io",
+				 fs_cancel_io, 3);
+	rb_define_private_method(cFiberScheduler, "__select", fs_select, 3);
+
+	rb_require("sleepy_penguin/fiber_scheduler");
+}
+#endif /* HAVE_SYS_EPOLL_H && HAVE_SYS_TIMERFD_H && HAVE_SYS_EVENTFD_H */
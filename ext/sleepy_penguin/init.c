@@ -6,6 +6,10 @@
 #define L1_CACHE_LINE_MAX 128 /* largest I've seen (Pentium 4) */
 size_t rb_sp_l1_cache_line_size;
 
+void sleepy_penguin_init_util(void);
+void sleepy_penguin_init_stats(void);
+void sleepy_penguin_init_arena(void);
+
 #ifdef HAVE_SYS_EVENT_H
 void sleepy_penguin_init_kqueue(void);
 #else
@@ -32,8 +36,10 @@ void sleepy_penguin_init_eventfd(void);
 
 #ifdef HAVE_SYS_INOTIFY_H
 void sleepy_penguin_init_inotify(void);
+void sleepy_penguin_init_inotify_tree(void);
 #else
 #  define sleepy_penguin_init_inotify() for(;0;)
+#  define sleepy_penguin_init_inotify_tree() for(;0;)
 #endif
 
 #ifdef HAVE_SYS_SIGNALFD_H
@@ -42,6 +48,19 @@ void sleepy_penguin_init_signalfd(void);
 #  define sleepy_penguin_init_signalfd() for(;0;)
 #endif
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H) && \
+    defined(HAVE_SYS_EVENTFD_H)
+void sleepy_penguin_init_fiber_scheduler(void);
+#else
+#  define sleepy_penguin_init_fiber_scheduler() for(;0;)
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+void sleepy_penguin_init_uring(void);
+#else
+#  define sleepy_penguin_init_uring() for(;0;)
+#endif
+
 static size_t l1_cache_line_size_detect(void)
 {
 #ifdef _SC_LEVEL1_DCACHE_LINESIZE
@@ -57,16 +76,25 @@ void Init_sleepy_penguin_ext(void)
 {
 	VALUE mSleepyPenguin;
 
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+	rb_ext_ractor_safe(true);
+#endif
 	rb_sp_l1_cache_line_size = l1_cache_line_size_detect();
 
 	mSleepyPenguin = rb_define_module("SleepyPenguin");
 	rb_define_const(mSleepyPenguin, "SLEEPY_PENGUIN_VERSION",
-			rb_str_new2(MY_GIT_VERSION));
+			rb_obj_freeze(rb_str_new2(MY_GIT_VERSION)));
 
+	sleepy_penguin_init_util();
+	sleepy_penguin_init_stats();
+	sleepy_penguin_init_arena();
 	sleepy_penguin_init_kqueue();
 	sleepy_penguin_init_epoll();
 	sleepy_penguin_init_timerfd();
 	sleepy_penguin_init_eventfd();
 	sleepy_penguin_init_inotify();
+	sleepy_penguin_init_inotify_tree();
 	sleepy_penguin_init_signalfd();
+	sleepy_penguin_init_fiber_scheduler();
+	sleepy_penguin_init_uring();
 }
@@ -2,7 +2,14 @@
 #include "sleepy_penguin.h"
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <limits.h>
+#ifdef HAVE_RB_ENC_INTERNED_STR
+#  include <ruby/encoding.h>
+#endif
 #include "missing_inotify.h"
+#include "stats.h"
+#include "probes.h"
+#include "arena.h"
 
 struct inbuf {
 	size_t capa;
@@ -30,6 +37,7 @@ static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 	flags = rb_sp_get_flags(klass, _flags, RB_SP_CLOEXEC(IN_CLOEXEC));
 
 	fd = inotify_init1(flags);
+	rb_sp_stat_syscall(RB_SP_STAT_INOTIFY, Qnil, fd);
 	if (fd < 0) {
 		if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
 			rb_gc();
@@ -93,6 +101,7 @@ static VALUE add_watch(VALUE self, VALUE path, VALUE vmask)
 	uint32_t mask = rb_sp_get_uflags(self, vmask);
 	int rc = inotify_add_watch(fd, pathname, mask);
 
+	rb_sp_stat_syscall(RB_SP_STAT_INOTIFY, self, rc);
 	if (rc < 0)
 		rb_sys_fail("inotify_add_watch");
 
@@ -112,6 +121,7 @@ static VALUE rm_watch(VALUE self, VALUE vwd)
 	int fd = rb_sp_fileno(self);
 	int rc = inotify_rm_watch(fd, wd);
 
+	rb_sp_stat_syscall(RB_SP_STAT_INOTIFY, self, rc);
 	if (rc < 0)
 		rb_sys_fail("inotify_rm_watch");
 	return INT2NUM(rc);
@@ -122,6 +132,17 @@ static size_t event_len(struct inotify_event *e)
 	return sizeof(struct inotify_event) + e->len;
 }
 
+/* name is zero-padded to the alignment, only the padding is scanned */
+static long name_len(const struct inotify_event *e)
+{
+	long len = (long)e->len;
+
+	while (len > 0 && e->name[len - 1] == 0)
+		len--;
+
+	return len;
+}
+
 static VALUE event_new(struct inotify_event *e)
 {
 	VALUE wd = INT2NUM(e->wd);
@@ -129,13 +150,13 @@ static VALUE event_new(struct inotify_event *e)
 	VALUE cookie = UINT2NUM(e->cookie);
 	VALUE name;
 
-	/* name may be zero-padded, so we do strlen() */
-	name = e->len ? rb_str_new(e->name, strlen(e->name)) : Qnil;
+	name = e->len ? rb_str_new(e->name, name_len(e)) : Qnil;
 
 	return rb_struct_new(cEvent, wd, mask, cookie, name);
 }
 
 struct inread_args {
+	VALUE self;
 	int fd;
 	struct inbuf *inbuf;
 };
@@ -143,33 +164,33 @@ struct inread_args {
 static VALUE inread(void *ptr)
 {
 	struct inread_args *args = ptr;
+	ssize_t r;
+
+	SP_PROBE2(inotify_read_entry, args->fd, args->inbuf->capa);
+	r = read(args->fd, args->inbuf->ptr, args->inbuf->capa);
+	SP_PROBE4(inotify_read_return, args->fd, args->inbuf->capa, r,
+		  SP_PROBE_ERRNO(r));
 
-	return (VALUE)read(args->fd, args->inbuf->ptr, args->inbuf->capa);
+	return (VALUE)r;
 }
 
 static void inbuf_grow(struct inbuf *inbuf, size_t size)
 {
-	int err;
-
 	if (inbuf->capa >= size)
 		return;
-	free(inbuf->ptr);
-	err = posix_memalign(&inbuf->ptr, rb_sp_l1_cache_line_size, size);
-	if (err) {
-		errno = err;
-		rb_memerror();
-	}
-	inbuf->capa = size;
+	inbuf->ptr = rb_sp_arena_get(RB_SP_ARENA_INOTIFY, size, &inbuf->capa);
 }
 
 static void resize_internal_buffer(struct inread_args *args)
 {
-	int newlen;
+	int newlen, rc;
 
 	if (args->inbuf->capa > 0x10000)
 		rb_raise(rb_eRuntimeError, "path too long");
 
-	if (ioctl(args->fd, FIONREAD, &newlen) != 0)
+	rc = ioctl(args->fd, FIONREAD, &newlen);
+	rb_sp_stat_syscall(RB_SP_STAT_INOTIFY, args->self, rc);
+	if (rc != 0)
 		rb_sys_fail("ioctl(inotify,FIONREAD)");
 
 	if (newlen > 0)
@@ -192,45 +213,56 @@ static void resize_internal_buffer(struct inread_args *args)
  */
 static VALUE take(int argc, VALUE *argv, VALUE self)
 {
-	static __thread struct inbuf inbuf;
-
+	struct inbuf inbuf;
 	struct inread_args args;
 	VALUE tmp = rb_ivar_get(self, id_inotify_tmp);
 	struct inotify_event *e, *end;
 	ssize_t r;
 	VALUE rv = Qnil;
 	VALUE nonblock;
+	int nb;
 
 	if (RARRAY_LEN(tmp) > 0)
 		return rb_ary_shift(tmp);
 
 	rb_scan_args(argc, argv, "01", &nonblock);
 
-	inbuf_grow(&inbuf, 128);
+	inbuf.ptr = rb_sp_arena_get(RB_SP_ARENA_INOTIFY, 128, &inbuf.capa);
+	args.self = self;
 	args.fd = rb_sp_fileno(self);
 	args.inbuf = &inbuf;
 
-	if (RTEST(nonblock))
-		rb_sp_set_nonblock(args.fd);
-	else
-		blocking_io_prepare(args.fd);
+	nb = rb_sp_io_prepare(nonblock, args.fd);
 	do {
-		r = (ssize_t)rb_sp_fd_region(inread, &args, args.fd);
+		r = (ssize_t)(nb ?
+			rb_sp_stat_call(RB_SP_STAT_INOTIFY, self,
+					inread, &args) :
+			rb_sp_stat_region(RB_SP_STAT_INOTIFY, self,
+					  inread, &args, args.fd));
 		if (r == 0 /* Linux < 2.6.21 */
 		    ||
 		    (r < 0 && errno == EINVAL) /* Linux >= 2.6.21 */
 		   ) {
 			resize_internal_buffer(&args);
 		} else if (r < 0) {
-			if (errno == EAGAIN && RTEST(nonblock))
-				return Qnil;
+			if (errno == EAGAIN) {
+				if (RTEST(nonblock))
+					return Qnil;
+				nb = 1; /* O_NONBLOCK is set */
+			}
 			if (!rb_sp_wait(rb_io_wait_readable, self, &args.fd))
 				rb_sys_fail("read(inotify)");
+
+			/* other fibers may have taken the arena meanwhile */
+			inbuf.ptr = rb_sp_arena_get(RB_SP_ARENA_INOTIFY,
+						    inbuf.capa, &inbuf.capa);
 		} else {
+			long n = 0;
+
 			/* buffer in userspace to minimize read() calls */
 			end = (struct inotify_event *)
 					((char *)args.inbuf->ptr + r);
-			for (e = args.inbuf->ptr; e < end; ) {
+			for (e = args.inbuf->ptr; e < end; n++) {
 				VALUE event = event_new(e);
 				if (NIL_P(rv))
 					rv = event;
@@ -239,12 +271,258 @@ static VALUE take(int argc, VALUE *argv, VALUE self)
 				e = (struct inotify_event *)
 				    ((char *)e + event_len(e));
 			}
+			rb_sp_stat_events(RB_SP_STAT_INOTIFY, self, n);
 		}
 	} while (NIL_P(rv));
 
 	return rv;
 }
 
+/* the smallest buffer read(2) will accept for any event */
+#define IN_EVENT_MIN (sizeof(struct inotify_event) + NAME_MAX + 1)
+
+/* default ceiling for Inotify#take_all */
+#define IN_TAKE_ALL_MAX (4 * 1024 * 1024)
+
+static size_t take_all_max(VALUE max_bytes)
+{
+	long max;
+
+	if (NIL_P(max_bytes))
+		return IN_TAKE_ALL_MAX;
+	max = NUM2LONG(max_bytes);
+
+	return max < (long)IN_EVENT_MIN ? IN_EVENT_MIN : (size_t)max;
+}
+
+/* bytes ready to be read, without waiting */
+static size_t inotify_ready(VALUE self, int fd)
+{
+	int n, rc = ioctl(fd, FIONREAD, &n);
+
+	rb_sp_stat_syscall(RB_SP_STAT_INOTIFY, self, rc);
+	if (rc != 0)
+		rb_sys_fail("ioctl(inotify,FIONREAD)");
+
+	return n > 0 ? (size_t)n : 0;
+}
+
+typedef void (*inbuf_reserve)(struct inbuf *, size_t);
+
+static void arena_reserve(struct inbuf *inbuf, size_t size)
+{
+	inbuf->ptr = rb_sp_arena_get(RB_SP_ARENA_INOTIFY, size, &inbuf->capa);
+}
+
+/*
+ * reads all ready events (up to +max+ bytes) into +inbuf+, waiting for
+ * some unless +nonblock+.  Returns the number of bytes read, or zero if
+ * +nonblock+ and nothing was ready.
+ */
+static ssize_t read_ready(VALUE self, struct inbuf *inbuf,
+			  inbuf_reserve reserve, size_t max, VALUE nonblock)
+{
+	struct inread_args args;
+	size_t ready, want;
+	ssize_t r;
+	int nb;
+
+	args.self = self;
+	args.fd = rb_sp_fileno(self);
+	args.inbuf = inbuf;
+
+	nb = rb_sp_io_prepare(nonblock, args.fd);
+	for (;;) {
+		ready = inotify_ready(self, args.fd);
+		if (!ready && RTEST(nonblock))
+			return 0;
+
+		/* blocking reads reuse whatever the last burst needed */
+		want = ready < IN_EVENT_MIN ? IN_EVENT_MIN : ready;
+		if (want > max)
+			want = max;
+		reserve(inbuf, want);
+		if (inbuf->capa > max)
+			inbuf->capa = max;
+
+		/*
+		 * FIONREAD is only a hint: other threads or processes may
+		 * drain the queue first, so only keep the GVL when
+		 * O_NONBLOCK is known to be set
+		 */
+		r = (ssize_t)(nb ?
+			rb_sp_stat_call(RB_SP_STAT_INOTIFY, self,
+					inread, &args) :
+			rb_sp_stat_region(RB_SP_STAT_INOTIFY, self,
+					  inread, &args, args.fd));
+		if (r > 0)
+			return r;
+		/* IN_EVENT_MIN fits any event, so EINVAL can't happen */
+		if (r == 0 || errno != EAGAIN)
+			rb_sys_fail("read(inotify)");
+		nb = 1; /* O_NONBLOCK is set */
+		if (!rb_sp_wait(rb_io_wait_readable, self, &args.fd))
+			rb_sys_fail("read(inotify)");
+	}
+}
+
+#define EVENT_EACH(e, ptr, r) \
+	for (e = (ptr); \
+	     (char *)e < (char *)(ptr) + (r); \
+	     e = (struct inotify_event *)((char *)e + event_len(e)))
+
+/*
+ * call-seq:
+ *	ino.take_all([max_bytes[, nonblock]]) -> Array or nil
+ *
+ * Returns an Array of all Inotify::Event objects which are ready, using
+ * one read(2) sized by ioctl(FIONREAD) and capped at +max_bytes+
+ * (default: 4 megabytes).  Waits for events unless +nonblock+ is +true+,
+ * in which case +nil+ is returned if there are none.
+ *
+ * This is meant for draining bursts of hundreds of thousands of events,
+ * Inotify#take reads events in much smaller batches.  Events buffered by
+ * an earlier Inotify#take are returned first.
+ */
+static VALUE take_all(int argc, VALUE *argv, VALUE self)
+{
+	struct inbuf inbuf;
+	VALUE tmp = rb_ivar_get(self, id_inotify_tmp);
+	VALUE max_bytes, nonblock, rv;
+	struct inotify_event *e;
+	ssize_t r;
+
+	rb_scan_args(argc, argv, "02", &max_bytes, &nonblock);
+	if (RARRAY_LEN(tmp) > 0) {
+		rv = rb_ary_dup(tmp);
+		rb_ary_clear(tmp);
+		return rv;
+	}
+	inbuf.capa = 0;
+	r = read_ready(self, &inbuf, arena_reserve, take_all_max(max_bytes),
+		       nonblock);
+	if (r == 0)
+		return Qnil;
+
+	rv = rb_ary_new2(r / sizeof(struct inotify_event));
+	EVENT_EACH(e, inbuf.ptr, r)
+		rb_ary_push(rv, event_new(e));
+	rb_sp_stat_events(RB_SP_STAT_INOTIFY, self, RARRAY_LEN(rv));
+
+	return rv;
+}
+
+static VALUE raw_str(const char *ptr, long len)
+{
+#ifdef HAVE_RB_ENC_INTERNED_STR
+	return rb_enc_interned_str(ptr, len, rb_ascii8bit_encoding());
+#else
+	return rb_obj_freeze(rb_str_new(ptr, len));
+#endif
+}
+
+static VALUE raw_name(const struct inotify_event *e)
+{
+	return e->len ? raw_str(e->name, name_len(e)) : Qnil;
+}
+
+/* yields Inotify::Event objects buffered by Inotify#take */
+static void each_raw_tmp(VALUE self)
+{
+	VALUE tmp = rb_ivar_get(self, id_inotify_tmp);
+	VALUE buf, event, name;
+	long i;
+
+	if (RARRAY_LEN(tmp) == 0)
+		return;
+	buf = rb_ary_dup(tmp);
+	rb_ary_clear(tmp);
+	for (i = 0; i < RARRAY_LEN(buf); i++) {
+		event = rb_ary_entry(buf, i);
+		name = rb_struct_aref(event, INT2FIX(3));
+		if (!NIL_P(name))
+			name = raw_str(RSTRING_PTR(name), RSTRING_LEN(name));
+		rb_yield_values(4, rb_struct_aref(event, INT2FIX(0)),
+				rb_struct_aref(event, INT2FIX(1)),
+				rb_struct_aref(event, INT2FIX(2)), name);
+	}
+}
+
+struct each_raw_args {
+	VALUE self;
+	VALUE nonblock;
+	size_t max;
+	struct inbuf inbuf;
+};
+
+/* the block may use the arena, so each_raw gets a buffer of its own */
+static void raw_reserve(struct inbuf *inbuf, size_t size)
+{
+	if (inbuf->capa < size) {
+		inbuf->ptr = xrealloc(inbuf->ptr, size);
+		inbuf->capa = size;
+	}
+}
+
+static VALUE each_raw_loop(VALUE ptr)
+{
+	struct each_raw_args *a = (struct each_raw_args *)ptr;
+	struct inotify_event *e;
+	ssize_t r;
+	long n;
+
+	each_raw_tmp(a->self);
+	while ((r = read_ready(a->self, &a->inbuf, raw_reserve, a->max,
+			       a->nonblock)) > 0) {
+		n = 0;
+		EVENT_EACH(e, a->inbuf.ptr, r) {
+			rb_yield_values(4, INT2NUM(e->wd), UINT2NUM(e->mask),
+					UINT2NUM(e->cookie), raw_name(e));
+			n++;
+		}
+		rb_sp_stat_events(RB_SP_STAT_INOTIFY, a->self, n);
+	}
+
+	return a->self;
+}
+
+static VALUE each_raw_done(VALUE ptr)
+{
+	struct each_raw_args *a = (struct each_raw_args *)ptr;
+
+	xfree(a->inbuf.ptr);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	ino.each_raw([max_bytes[, nonblock]]) { |wd, mask, cookie, name| ... }
+ *
+ * Yields the fields of every event as they are read, without creating
+ * Inotify::Event objects.  +name+ is +nil+ or a frozen String, and
+ * repeated names are the same object on Ruby 3.0+, so busy files
+ * do not allocate a String for every event.  Reads are batched like
+ * Inotify#take_all, with the same +max_bytes+ ceiling.
+ *
+ * This loops forever unless +nonblock+ is +true+, in which case it
+ * returns +ino+ once no events are ready.  Events buffered by an
+ * earlier Inotify#take are yielded first.
+ */
+static VALUE each_raw(int argc, VALUE *argv, VALUE self)
+{
+	struct each_raw_args a;
+	VALUE max_bytes;
+
+	rb_scan_args(argc, argv, "02", &max_bytes, &a.nonblock);
+	a.self = self;
+	a.max = take_all_max(max_bytes);
+	a.inbuf.ptr = NULL;
+	a.inbuf.capa = 0;
+
+	return rb_ensure(each_raw_loop, (VALUE)&a, each_raw_done, (VALUE)&a);
+}
+
 /*
  * call-seq:
  *	inotify_event.events => [ :MOVED_TO, ... ]
@@ -252,7 +530,7 @@ static VALUE take(int argc, VALUE *argv, VALUE self)
  * Returns an array of symbolic event names based on the contents of
  * the +mask+ field.
  */
-static VALUE events(VALUE self)
+VALUE rb_sp_inotify_events(VALUE self)
 {
 	long len = RARRAY_LEN(checks);
 	VALUE *ptr = RARRAY_PTR(checks);
@@ -287,6 +565,25 @@ static VALUE each(VALUE self)
 	return self;
 }
 
+/*
+ * call-seq:
+ *	ino.each_batch([max_bytes]) { |events| ... } -> ino
+ *
+ * Yields an Array of Inotify::Event objects for every Inotify#take_all
+ * call in a blocking fashion.
+ */
+static VALUE each_batch(int argc, VALUE *argv, VALUE self)
+{
+	VALUE args[2];
+
+	rb_scan_args(argc, argv, "01", &args[0]);
+	args[1] = Qfalse;
+	while (1)
+		rb_yield(take_all(2, args, self));
+
+	return self;
+}
+
 void sleepy_penguin_init_inotify(void)
 {
 	VALUE mSleepyPenguin, cInotify;
@@ -318,6 +615,9 @@ void sleepy_penguin_init_inotify(void)
 	rb_define_method(cInotify, "rm_watch", rm_watch, 1);
 	rb_define_method(cInotify, "take", take, -1);
 	rb_define_method(cInotify, "each", each, 0);
+	rb_define_method(cInotify, "take_all", take_all, -1);
+	rb_define_method(cInotify, "each_batch", each_batch, -1);
+	rb_define_method(cInotify, "each_raw", each_raw, -1);
 
 	/*
 	 * Document-class: SleepyPenguin::Inotify::Event
@@ -343,7 +643,7 @@ void sleepy_penguin_init_inotify(void)
 	 */
 	cEvent = rb_struct_define("Event", "wd", "mask", "cookie", "name", 0);
 	cEvent = rb_define_class_under(cInotify, "Event", cEvent);
-	rb_define_method(cEvent, "events", events, 0);
+	rb_define_method(cEvent, "events", rb_sp_inotify_events, 0);
 	rb_define_singleton_method(cInotify, "new", s_new, -1);
 	id_inotify_tmp = rb_intern("@inotify_tmp");
 	id_mask = rb_intern("mask");
@@ -378,6 +678,7 @@ void sleepy_penguin_init_inotify(void)
 	IN2(Q_OVERFLOW);
 	IN2(IGNORED);
 	IN2(ISDIR);
+	rb_obj_freeze(checks); /* read by all Ractors */
 
 /* helpers */
 	IN(CLOSE);
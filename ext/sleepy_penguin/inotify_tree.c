@@ -0,0 +1,785 @@
+#ifdef HAVE_SYS_INOTIFY_H
+#include "sleepy_penguin.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <limits.h>
+#include <string.h>
+#include "stats.h"
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#  include <ruby/thread.h>
+#endif
+
+/*
+ * Inotify::Tree keeps every watched directory in a table indexed by its
+ * watch descriptor.  Nodes only know their parent and their own name, so
+ * renaming a directory updates one node no matter how much is under it,
+ * and full paths are built when events are returned.  The table is plain
+ * C memory because directories are scanned without the GVL.
+ */
+
+#ifndef IN_EXCL_UNLINK
+#  define IN_EXCL_UNLINK 0x04000000
+#endif
+
+/* events needed to keep the table up-to-date, users may not want them */
+#define TREE_MASK (IN_CREATE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+
+/* getdents64(2) buffer, one per directory being scanned */
+#define TREE_DENTS 32768
+
+VALUE rb_sp_inotify_events(VALUE self); /* inotify.c */
+
+struct tree_node {
+	char *name; /* full path for roots, NULL for unused slots */
+	size_t len;
+	int parent; /* watch descriptor of the parent, -1 for roots */
+	uint32_t mask; /* events the user wants, 0 if moved out of the tree */
+};
+
+struct tree {
+	VALUE ino;
+	struct tree_node *nodes;
+	size_t capa;
+	long nr; /* directories watched */
+	int busy; /* scanning without the GVL */
+
+	/* the last IN_MOVED_FROM, waiting for its IN_MOVED_TO */
+	VALUE move_path;
+	VALUE move_name;
+	int move_wd;
+	uint32_t move_cookie;
+	uint32_t move_mask;
+	uint32_t move_want;
+};
+
+struct tree_scan {
+	struct tree *t;
+	int fd; /* inotify */
+	uint32_t mask;
+	int rescan; /* descend into directories which are already watched */
+	int err;
+	volatile int stop;
+	unsigned long syscalls;
+	long added;
+	const char *name; /* node name for the top directory, in path */
+	size_t nlen;
+	int parent;
+	size_t len;
+	char path[PATH_MAX];
+};
+
+struct tree_take {
+	struct tree *t;
+	VALUE rv;
+};
+
+static ID id_each_raw, id_close, id_closed_p;
+static VALUE cInotify, cTreeEvent;
+
+static void tree_mark(void *ptr)
+{
+	struct tree *t = ptr;
+
+	rb_gc_mark(t->ino);
+	rb_gc_mark(t->move_path);
+	rb_gc_mark(t->move_name);
+}
+
+static void nodes_free(struct tree *t)
+{
+	size_t i;
+
+	for (i = 0; i < t->capa; i++)
+		free(t->nodes[i].name);
+	free(t->nodes);
+	t->nodes = NULL;
+	t->capa = 0;
+	t->nr = 0;
+}
+
+static void tree_free(void *ptr)
+{
+	nodes_free(ptr);
+	xfree(ptr);
+}
+
+static size_t tree_memsize(const void *ptr)
+{
+	const struct tree *t = ptr;
+	size_t i, n = sizeof(*t);
+
+	/* the scan may be reallocating nodes without the GVL */
+	if (t->busy)
+		return n;
+	n += t->capa * sizeof(struct tree_node);
+	for (i = 0; i < t->capa; i++)
+		if (t->nodes[i].name)
+			n += t->nodes[i].len + 1;
+
+	return n;
+}
+
+static const rb_data_type_t tree_type = {
+	"SleepyPenguin::Inotify::Tree",
+	{ tree_mark, tree_free, tree_memsize, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE tree_alloc(VALUE klass)
+{
+	struct tree *t;
+	VALUE self = TypedData_Make_Struct(klass, struct tree, &tree_type, t);
+
+	t->ino = Qnil;
+	t->move_path = Qnil;
+	t->move_name = Qnil;
+
+	return self;
+}
+
+/* returns the tree, unless another thread is scanning it */
+static struct tree *tree_get(VALUE self)
+{
+	struct tree *t = rb_check_typeddata(self, &tree_type);
+
+	if (t->busy)
+		rb_raise(rb_eRuntimeError,
+			 "Inotify::Tree in use by another thread");
+	if (NIL_P(t->ino))
+		rb_raise(rb_eIOError, "uninitialized Inotify::Tree");
+
+	return t;
+}
+
+static struct tree_node *node_get(struct tree *t, int wd)
+{
+	if (wd <= 0 || (size_t)wd >= t->capa || !t->nodes[wd].name)
+		return NULL;
+
+	return &t->nodes[wd];
+}
+
+/* may run without the GVL, so no Ruby memory allocation */
+static int node_set(struct tree *t, int wd, int parent,
+		    const char *name, size_t len, uint32_t mask)
+{
+	struct tree_node *n;
+	char *copy;
+
+	if ((size_t)wd >= t->capa) {
+		size_t capa = t->capa ? t->capa : 64;
+
+		while (capa <= (size_t)wd)
+			capa *= 2;
+		n = realloc(t->nodes, capa * sizeof(struct tree_node));
+		if (!n)
+			return -1;
+		memset(n + t->capa, 0,
+		       (capa - t->capa) * sizeof(struct tree_node));
+		t->nodes = n;
+		t->capa = capa;
+	}
+	copy = malloc(len + 1);
+	if (!copy)
+		return -1;
+	memcpy(copy, name, len);
+	copy[len] = 0;
+
+	n = &t->nodes[wd];
+	if (n->name)
+		free(n->name);
+	else
+		t->nr++;
+	n->name = copy;
+	n->len = len;
+	n->parent = parent;
+	n->mask = mask;
+
+	return 0;
+}
+
+static void node_del(struct tree *t, int wd)
+{
+	struct tree_node *n = node_get(t, wd);
+
+	if (n) {
+		free(n->name);
+		n->name = NULL;
+		t->nr--;
+	}
+}
+
+/* no separator after "/" as a root */
+static int node_sep(struct tree *t, int wd)
+{
+	struct tree_node *n = node_get(t, wd);
+
+	return !(n && n->parent < 0 && n->len == 1 && n->name[0] == '/');
+}
+
+static void scan_dir(struct tree_scan *s, int dirfd, const char *open_name,
+		     int parent, const char *name, size_t nlen, int follow);
+
+static void scan_entries(struct tree_scan *s, int fd, int wd)
+{
+	char *buf = malloc(TREE_DENTS);
+	int sep = node_sep(s->t, wd);
+	long n, off;
+
+	if (!buf) {
+		s->err = ENOMEM;
+		return;
+	}
+	while (!s->stop && !s->err) {
+		n = syscall(SYS_getdents64, fd, buf, TREE_DENTS);
+		s->syscalls++;
+		if (n <= 0)
+			break;
+		for (off = 0; off < n && !s->stop && !s->err;) {
+			struct dirent64 *d = (struct dirent64 *)(buf + off);
+			const char *dn = d->d_name;
+			size_t dlen, save = s->len;
+
+			off += d->d_reclen;
+			if (dn[0] == '.' && (!dn[1] ||
+					     (dn[1] == '.' && !dn[2])))
+				continue;
+			if (d->d_type == DT_UNKNOWN) {
+				struct stat st;
+
+				s->syscalls++;
+				if (fstatat(fd, dn, &st, AT_SYMLINK_NOFOLLOW) ||
+				    !S_ISDIR(st.st_mode))
+					continue;
+			} else if (d->d_type != DT_DIR) {
+				continue;
+			}
+			dlen = strlen(dn);
+			if (s->len + sep + dlen >= sizeof(s->path))
+				continue; /* ENAMETOOLONG */
+			if (sep)
+				s->path[s->len++] = '/';
+			memcpy(s->path + s->len, dn, dlen + 1);
+			s->len += dlen;
+			scan_dir(s, fd, dn, wd, dn, dlen, 0);
+			s->len = save;
+			s->path[save] = 0;
+		}
+	}
+	free(buf);
+}
+
+/*
+ * watches s->path (opened as +open_name+ relative to +dirfd+) before
+ * reading it, so nothing created meanwhile is missed, then descends
+ */
+static void scan_dir(struct tree_scan *s, int dirfd, const char *open_name,
+		     int parent, const char *name, size_t nlen, int follow)
+{
+	uint32_t mask = s->mask | TREE_MASK | (follow ? 0 : IN_DONT_FOLLOW);
+	int wd, fd, existed;
+
+	s->syscalls++;
+	wd = inotify_add_watch(s->fd, s->path, mask);
+	if (wd < 0) {
+		/* vanished, unreadable or not a directory: skip it */
+		if (parent < 0 || errno == ENOSPC || errno == ENOMEM ||
+		    errno == EBADF)
+			s->err = errno;
+		return;
+	}
+	existed = node_get(s->t, wd) != NULL;
+	if (node_set(s->t, wd, parent, name, nlen, s->mask) < 0) {
+		s->err = ENOMEM;
+		return;
+	}
+	if (existed && !s->rescan)
+		return; /* renamed within the tree */
+	s->added += !existed;
+
+	s->syscalls++;
+	fd = openat(dirfd, open_name, O_RDONLY|O_DIRECTORY|O_CLOEXEC|
+		    (follow ? 0 : O_NOFOLLOW));
+	if (fd < 0)
+		return;
+	scan_entries(s, fd, wd);
+	close(fd);
+}
+
+static void *scan_nogvl(void *ptr)
+{
+	struct tree_scan *s = ptr;
+
+	scan_dir(s, AT_FDCWD, s->path, s->parent, s->name, s->nlen,
+		 s->parent < 0);
+
+	return NULL;
+}
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+static void scan_stop(void *ptr)
+{
+	struct tree_scan *s = ptr;
+
+	s->stop = 1;
+}
+#endif
+
+/*
+ * watches +path+ and all directories under it, the last +nlen+ bytes of
+ * +path+ are the node name for +path+ itself.  Returns the number of
+ * directories added, or -1 with errno set if some could not be watched.
+ * Only our copy of +path+ is used without the GVL.
+ */
+static long tree_scan(struct tree *t, const char *path, size_t len,
+		      int parent, size_t nlen, uint32_t mask, int rescan)
+{
+	struct tree_scan scan, *s = &scan;
+
+	if (len >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	s->t = t;
+	s->fd = rb_sp_fileno(t->ino);
+	s->mask = mask;
+	s->rescan = rescan;
+	s->err = 0;
+	s->syscalls = 0;
+	s->added = 0;
+	s->parent = parent;
+	s->len = len;
+	memcpy(s->path, path, len);
+	s->path[len] = 0;
+	s->name = s->path + len - nlen;
+	s->nlen = nlen;
+
+	/* interrupts restart the scan, already watched directories are cheap */
+	do {
+		s->stop = 0;
+		t->busy = 1;
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+		rb_thread_call_without_gvl(scan_nogvl, s, scan_stop, s);
+#else
+		scan_nogvl(s);
+#endif
+		t->busy = 0;
+		if (s->stop && !s->err)
+			rb_thread_check_ints();
+	} while (s->stop && !s->err);
+
+	rb_sp_stat_syscalls(RB_SP_STAT_INOTIFY, t->ino, s->syscalls);
+	if (s->err) {
+		errno = s->err;
+		return -1;
+	}
+
+	return s->added;
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Inotify::Tree.new([flags]) -> Tree object
+ *
+ * Creates a new Tree with its own Inotify object, +flags+ are the same
+ * as for Inotify.new.
+ */
+static VALUE tree_init(int argc, VALUE *argv, VALUE self)
+{
+	struct tree *t = rb_check_typeddata(self, &tree_type);
+	VALUE flags;
+
+	rb_scan_args(argc, argv, "01", &flags);
+	t->ino = rb_funcall(cInotify, rb_intern("new"), 1, flags);
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	tree.add(path, mask) -> Integer
+ *
+ * Watches the directory at +path+ and every directory under it for the
+ * events in +mask+ (see Inotify#add_watch), and returns the number of
+ * directories which were not already watched.  Directories created or
+ * moved into the tree later are watched automatically.  Symbolic links
+ * are only followed for +path+ itself.
+ *
+ * The tree is scanned with openat(2) and getdents64(2) without holding
+ * the GVL.  Errno::ENOSPC is raised if the fs.inotify.max_user_watches
+ * sysctl is too low for the whole tree.
+ */
+static VALUE tree_add(VALUE self, VALUE path, VALUE vmask)
+{
+	struct tree *t = tree_get(self);
+	uint32_t mask = rb_sp_get_uflags(cInotify, vmask);
+	const char *p = StringValueCStr(path);
+	size_t len = (size_t)RSTRING_LEN(path);
+	long added;
+
+	while (len > 1 && p[len - 1] == '/')
+		len--;
+	mask &= IN_ALL_EVENTS|IN_EXCL_UNLINK;
+
+	added = tree_scan(t, p, len, -1, len, mask, 1);
+	if (added < 0)
+		rb_sys_fail_str(path);
+
+	return LONG2NUM(added);
+}
+
+/* full path of +wd+ plus +name+, nil if +wd+ is no longer in the tree */
+static VALUE tree_path(struct tree *t, int wd, VALUE name)
+{
+	struct tree_node *n;
+	long len = NIL_P(name) ? 0 : RSTRING_LEN(name) + node_sep(t, wd);
+	VALUE path;
+	char *p;
+	int i;
+
+	for (i = wd; i >= 0; i = n->parent) {
+		n = node_get(t, i);
+		if (!n)
+			return Qnil;
+		len += (long)n->len + (n->parent < 0 ? 0 :
+				       node_sep(t, n->parent));
+	}
+	path = rb_str_new(NULL, len);
+	p = RSTRING_PTR(path) + len;
+	if (!NIL_P(name)) {
+		p -= RSTRING_LEN(name);
+		memcpy(p, RSTRING_PTR(name), RSTRING_LEN(name));
+		if (node_sep(t, wd))
+			*--p = '/';
+	}
+	for (i = wd; i >= 0; i = n->parent) {
+		n = node_get(t, i);
+		p -= n->len;
+		memcpy(p, n->name, n->len);
+		if (n->parent >= 0 && node_sep(t, n->parent))
+			*--p = '/';
+	}
+
+	return path;
+}
+
+static int node_under(struct tree *t, int wd, int top)
+{
+	struct tree_node *n;
+
+	for (; wd >= 0; wd = n->parent) {
+		if (wd == top)
+			return 1;
+		n = node_get(t, wd);
+		if (!n)
+			return 0;
+	}
+
+	return 0;
+}
+
+/*
+ * a directory was moved out of the tree, stop watching everything under
+ * it.  The nodes go away once IN_IGNORED arrives for each of them.
+ */
+static void tree_detach(struct tree *t, int parent, VALUE name)
+{
+	int fd = rb_sp_fileno(t->ino);
+	unsigned long syscalls = 0;
+	size_t i;
+	int top = -1;
+
+	for (i = 1; i < t->capa; i++) {
+		struct tree_node *n = &t->nodes[i];
+
+		if (n->name && n->parent == parent &&
+		    n->len == (size_t)RSTRING_LEN(name) &&
+		    !memcmp(n->name, RSTRING_PTR(name), n->len)) {
+			top = (int)i;
+			break;
+		}
+	}
+	if (top < 0)
+		return;
+	for (i = 1; i < t->capa; i++) {
+		if (t->nodes[i].name && node_under(t, (int)i, top)) {
+			inotify_rm_watch(fd, (int)i);
+			t->nodes[i].mask = 0;
+			syscalls++;
+		}
+	}
+	rb_sp_stat_syscalls(RB_SP_STAT_INOTIFY, t->ino, syscalls);
+}
+
+static void tree_emit(struct tree_take *tk, uint32_t mask, VALUE path,
+		      VALUE from)
+{
+	rb_ary_push(tk->rv, rb_struct_new(cTreeEvent, UINT2NUM(mask),
+					  path, from));
+}
+
+/*
+ * watches a directory which appeared under +wd+, raising here would lose
+ * the rest of the batch, so failures become :Q_OVERFLOW events for +path+
+ */
+static void tree_scan_event(struct tree_take *tk, VALUE path, int wd,
+			    VALUE name, uint32_t want, int rescan)
+{
+	if (tree_scan(tk->t, RSTRING_PTR(path), RSTRING_LEN(path), wd,
+		      RSTRING_LEN(name), want, rescan) < 0)
+		tree_emit(tk, IN_Q_OVERFLOW | IN_ISDIR, path, Qnil);
+}
+
+/* the IN_MOVED_FROM had no IN_MOVED_TO: it left the tree */
+static void move_flush(struct tree_take *tk)
+{
+	struct tree *t = tk->t;
+	VALUE path = t->move_path;
+
+	if (t->move_mask & IN_ISDIR)
+		tree_detach(t, t->move_wd, t->move_name);
+	t->move_path = t->move_name = Qnil;
+	if (t->move_want & IN_MOVED_FROM)
+		tree_emit(tk, t->move_mask, path, Qnil);
+}
+
+static VALUE tree_event_i(RB_BLOCK_CALL_FUNC_ARGLIST(x, ptr))
+{
+	struct tree_take *tk = (struct tree_take *)ptr;
+	struct tree *t = tk->t;
+	int wd = NUM2INT(argv[0]);
+	uint32_t mask = NUM2UINT(argv[1]);
+	uint32_t cookie = NUM2UINT(argv[2]);
+	VALUE name = argv[3];
+	struct tree_node *n;
+	uint32_t want;
+	VALUE path;
+
+	if (!NIL_P(t->move_path) &&
+	    !((mask & IN_MOVED_TO) && cookie == t->move_cookie))
+		move_flush(tk);
+	if (mask & IN_Q_OVERFLOW) {
+		tree_emit(tk, mask, Qnil, Qnil);
+		return Qnil;
+	}
+	n = node_get(t, wd);
+	if (!n)
+		return Qnil;
+	if (mask & IN_IGNORED) {
+		node_del(t, wd);
+		return Qnil;
+	}
+	want = n->mask;
+	if (!want)
+		return Qnil; /* moved out, IN_IGNORED is on its way */
+	path = tree_path(t, wd, name);
+	if (NIL_P(path))
+		return Qnil;
+
+	if (mask & IN_MOVED_FROM) {
+		t->move_path = path;
+		t->move_name = name;
+		t->move_wd = wd;
+		t->move_cookie = cookie;
+		t->move_mask = mask;
+		t->move_want = want;
+		return Qnil;
+	}
+	if ((mask & IN_MOVED_TO) && !NIL_P(t->move_path)) {
+		VALUE from = t->move_path;
+
+		want |= t->move_want;
+		t->move_path = t->move_name = Qnil;
+
+		/* the kernel hands back the old wd, only that node changes */
+		if (want & IN_MOVE)
+			tree_emit(tk, mask | IN_MOVED_FROM, path, from);
+		if (mask & IN_ISDIR)
+			tree_scan_event(tk, path, wd, name, want, 0);
+		return Qnil;
+	}
+	if (mask & want)
+		tree_emit(tk, mask, path, Qnil);
+	if ((mask & IN_ISDIR) && (mask & (IN_CREATE|IN_MOVED_TO)))
+		tree_scan_event(tk, path, wd, name, want, 1);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	tree.take_all([max_bytes[, nonblock]]) -> Array or nil
+ *
+ * Returns an Array of Inotify::Tree::Event objects for all events which
+ * are ready, reading them like Inotify#each_raw with the same
+ * +max_bytes+ ceiling.  Waits for events unless +nonblock+ is +true+, in
+ * which case +nil+ is returned if there are none.
+ *
+ * A file or directory renamed within the tree is one event with both
+ * :MOVED_FROM and :MOVED_TO set, its +path+ is the new path and +from+
+ * is the old one.  An :Q_OVERFLOW event has a +nil+ +path+, the tree
+ * must be rescanned by the caller since events were lost.  If a new
+ * directory could not be fully watched (e.g. the fs.inotify.max_user_watches
+ * sysctl was reached), the :Q_OVERFLOW event has that directory as its
+ * +path+, and only it needs to be rescanned once the problem is fixed.
+ *
+ * Entries created in a new directory before it is watched are not
+ * reported, but directories among them are watched.
+ */
+static VALUE tree_take_all(int argc, VALUE *argv, VALUE self)
+{
+	struct tree *t = tree_get(self);
+	struct tree_take tk;
+	VALUE args[2], nonblock;
+	int fd;
+
+	rb_scan_args(argc, argv, "02", &args[0], &nonblock);
+	args[1] = Qtrue;
+	tk.t = t;
+	tk.rv = rb_ary_new();
+	for (;;) {
+		rb_block_call(t->ino, id_each_raw, 2, args,
+			      tree_event_i, (VALUE)&tk);
+
+		/* each_raw drained the queue, no IN_MOVED_TO is coming */
+		if (!NIL_P(t->move_path))
+			move_flush(&tk);
+		if (RARRAY_LEN(tk.rv) || RTEST(nonblock))
+			break;
+
+		fd = rb_sp_fileno(t->ino);
+		errno = EAGAIN; /* lets rb_sp_wait park fibers */
+		if (!rb_sp_wait(rb_io_wait_readable, t->ino, &fd))
+			rb_sys_fail("read(inotify)");
+		t = tree_get(self);
+	}
+
+	return RARRAY_LEN(tk.rv) ? tk.rv : Qnil;
+}
+
+/*
+ * call-seq:
+ *	tree.each { |event| ... } -> tree
+ *
+ * Yields each Inotify::Tree::Event received in a blocking fashion.
+ */
+static VALUE tree_each(VALUE self)
+{
+	VALUE events;
+	long i;
+
+	while (1) {
+		events = tree_take_all(0, NULL, self);
+		for (i = 0; i < RARRAY_LEN(events); i++)
+			rb_yield(RARRAY_AREF(events, i));
+	}
+
+	return self;
+}
+
+/*
+ * call-seq:
+ *	tree.size -> Integer
+ *
+ * Returns the number of directories watched.
+ */
+static VALUE tree_size(VALUE self)
+{
+	struct tree *t = rb_check_typeddata(self, &tree_type);
+
+	return LONG2NUM(t->nr);
+}
+
+/*
+ * call-seq:
+ *	tree.to_io -> Inotify
+ *
+ * Returns the Inotify object, for use with IO.select or Epoll.
+ * Reading events from it directly desynchronizes the Tree.
+ */
+static VALUE tree_to_io(VALUE self)
+{
+	return tree_get(self)->ino;
+}
+
+/*
+ * call-seq:
+ *	tree.close -> nil
+ *
+ * Closes the Inotify object and forgets all directories.
+ */
+static VALUE tree_close(VALUE self)
+{
+	struct tree *t = tree_get(self);
+
+	if (!RTEST(rb_funcall(t->ino, id_closed_p, 0)))
+		rb_funcall(t->ino, id_close, 0);
+	nodes_free(t);
+	t->move_path = t->move_name = Qnil;
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	tree.closed? -> true or false
+ */
+static VALUE tree_closed_p(VALUE self)
+{
+	return rb_funcall(tree_get(self)->ino, id_closed_p, 0);
+}
+
+void sleepy_penguin_init_inotify_tree(void)
+{
+	VALUE mSleepyPenguin, cTree;
+
+	mSleepyPenguin = rb_define_module("SleepyPenguin");
+	cInotify = rb_const_get(mSleepyPenguin, rb_intern("Inotify"));
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Tree
+	 *
+	 * Watches whole directory trees with one Inotify object, and
+	 * returns events with full paths:
+	 *
+	 *	tree = SleepyPenguin::Inotify::Tree.new
+	 *	tree.add("/path/to/src", [ :CREATE, :DELETE, :MOVE ])
+	 *	tree.each do |event|
+	 *	  p [ event.events, event.path, event.from ]
+	 *	end
+	 *
+	 * Only one thread may use a Tree at a time.
+	 */
+	cTree = rb_define_class_under(cInotify, "Tree", rb_cObject);
+	rb_define_alloc_func(cTree, tree_alloc);
+	rb_define_method(cTree, "initialize", tree_init, -1);
+	rb_define_method(cTree, "add", tree_add, 2);
+	rb_define_method(cTree, "take_all", tree_take_all, -1);
+	rb_define_method(cTree, "each", tree_each, 0);
+	rb_define_method(cTree, "size", tree_size, 0);
+	rb_define_method(cTree, "to_io", tree_to_io, 0);
+	rb_define_method(cTree, "close", tree_close, 0);
+	rb_define_method(cTree, "closed?", tree_closed_p, 0);
+
+	/*
+	 * Document-class: SleepyPenguin::Inotify::Tree::Event
+	 *
+	 * Returned by SleepyPenguin::Inotify::Tree#take_all.  It is a Struct
+	 * with the following elements:
+	 *
+	 * - mask - mask of events, as in Inotify::Event
+	 * - path - full path of the file or directory (see Tree#take_all
+ *   for :Q_OVERFLOW)
+	 * - from - old full path for renames within the tree, otherwise nil
+	 */
+	cTreeEvent = rb_struct_define(NULL, "mask", "path", "from", NULL);
+	cTreeEvent = rb_define_class_under(cTree, "Event", cTreeEvent);
+	rb_define_method(cTreeEvent, "events", rb_sp_inotify_events, 0);
+
+	id_each_raw = rb_intern("each_raw");
+	id_close = rb_intern("close");
+	id_closed_p = rb_intern("closed?");
+}
+#endif /* HAVE_SYS_INOTIFY_H */
@@ -9,6 +9,8 @@
 #include "missing_rb_thread_fd_close.h"
 #include "missing_rb_update_max_fd.h"
 #include "value2timespec.h"
+#include "arena.h"
+#include "probes.h"
 
 #ifdef HAVE_SYS_MOUNT_H /* for VQ_* flags on FreeBSD */
 #  include <sys/mount.h>
@@ -46,7 +48,6 @@ struct kq_per_thread {
 	int fd;
 	int nchanges;
 	int nevents;
-	int capa;
 	struct timespec *ts;
 	struct kevent events[FLEX_ARRAY];
 };
@@ -74,10 +75,7 @@ static int kq_fd_check(struct kq_per_thread *kpt)
 
 static struct kq_per_thread *kpt_get(VALUE self, int nchanges, int nevents)
 {
-	static __thread struct kq_per_thread *kpt;
-	size_t size;
-	void *ptr;
-	int err;
+	struct kq_per_thread *kpt;
 	int max = nchanges > nevents ? nchanges : nevents;
 
 	/* error check here to prevent OOM from posix_memalign */
@@ -86,20 +84,8 @@ static struct kq_per_thread *kpt_get(VALUE self, int nchanges, int nevents)
 		rb_sys_fail("kevent got negative events < 0");
 	}
 
-	if (kpt && kpt->capa >= max)
-		goto out;
-
-	size = sizeof(struct kq_per_thread) + sizeof(struct kevent) * max;
-
-	free(kpt); /* free(NULL) is POSIX */
-	err = posix_memalign(&ptr, rb_sp_l1_cache_line_size, size);
-	if (err) {
-		errno = err;
-		rb_memerror();
-	}
-	kpt = ptr;
-	kpt->capa = max;
-out:
+	kpt = rb_sp_arena_get(RB_SP_ARENA_KQUEUE, sizeof(struct kq_per_thread) +
+			      sizeof(struct kevent) * max, NULL);
 	kpt->nchanges = nchanges;
 	kpt->nevents = nevents;
 	kpt->io = self;
@@ -155,10 +141,34 @@ static void yield_kevent(struct kevent *event)
 	rb_yield_values(6, ident, filter, flags, fflags, data, udata);
 }
 
-static VALUE kevent_result(struct kq_per_thread *kpt, int nevents)
+struct kevent_yield_args {
+	struct kq_per_thread *kpt;
+	int nevents;
+};
+
+static VALUE kevent_yield(VALUE ptr)
 {
+	struct kevent_yield_args *a = (struct kevent_yield_args *)ptr;
+	struct kevent *event = a->kpt->events;
 	int i;
-	struct kevent *event = kpt->events;
+
+	for (i = a->nevents; --i >= 0; event++)
+		yield_kevent(event);
+
+	return Qnil;
+}
+
+static VALUE kpt_release(VALUE held)
+{
+	rb_sp_arena_release((void *)held);
+
+	return Qnil;
+}
+
+/* the block may call kevent again, so +kpt+ is held while yielding */
+static VALUE kevent_result(struct kq_per_thread *kpt, int nevents)
+{
+	struct kevent_yield_args a;
 
 	if (nevents < 0) {
 		if (errno == EINTR)
@@ -167,8 +177,11 @@ static VALUE kevent_result(struct kq_per_thread *kpt, int nevents)
 			rb_sys_fail("kevent");
 	}
 
-	for (i = nevents; --i >= 0; event++)
-		yield_kevent(event);
+	a.kpt = kpt;
+	a.nevents = nevents;
+	if (nevents > 0)
+		rb_ensure(kevent_yield, (VALUE)&a, kpt_release,
+			  (VALUE)rb_sp_arena_hold(RB_SP_ARENA_KQUEUE));
 
 	return INT2NUM(nevents);
 }
@@ -210,8 +223,13 @@ kevent_resume_p(struct timespec *expire_at, struct kq_per_thread *kpt)
 static VALUE nogvl_kevent(void *args)
 {
 	struct kq_per_thread *kpt = args;
-	int nevents = kevent(kpt->fd, kpt->events, kpt->nchanges,
+	int nevents;
+
+	SP_PROBE2(kevent_entry, kpt->fd, kpt->nevents);
+	nevents = kevent(kpt->fd, kpt->events, kpt->nchanges,
 			 kpt->events, kpt->nevents, kpt->ts);
+	SP_PROBE4(kevent_return, kpt->fd, kpt->nevents, nevents,
+		  SP_PROBE_ERRNO(nevents));
 
 	return (VALUE)nevents;
 }
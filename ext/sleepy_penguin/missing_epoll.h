@@ -28,3 +28,19 @@ err:
 }
 #  define epoll_create1 my_epoll_create1
 #endif
+
+/*
+ * Linux 6.9+ per-epoll busy poll parameters, older libc and kernel
+ * headers lack these.  The kernel returns ENOTTY if it is too old.
+ */
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad; /* must be zero */
+};
+#  define EPOLL_IOC_TYPE 0x8A
+#  define EPIOCSPARAMS _IOW(EPOLL_IOC_TYPE, 0x01, struct epoll_params)
+#  define EPIOCGPARAMS _IOR(EPOLL_IOC_TYPE, 0x02, struct epoll_params)
+#endif
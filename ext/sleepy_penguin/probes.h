@@ -0,0 +1,31 @@
+#ifndef SLEEPY_PENGUIN_PROBES_H
+#define SLEEPY_PENGUIN_PROBES_H
+/*
+ * USDT (static tracepoints) for bpftrace, perf, SystemTap and friends,
+ * under the "sleepy_penguin" provider.  Every blocking syscall has a
+ * *_entry probe with the fd and requested count, and a *_return probe
+ * with the fd, requested count, returned count and errno (0 on success).
+ * For EventFD and TimerFD reads, the returned count is the counter value
+ * (or -1), and EventFD writes use the increment as both counts.  e.g.:
+ *
+ *	bpftrace -e 'usdt:./sleepy_penguin_ext.so:epoll_wait_return
+ *		{ @batch = lhist(arg2, 0, 64, 1); }'
+ *
+ * These are only single nops while nothing is attached.  Without
+ * <sys/sdt.h>, they compile to nothing and their arguments are never
+ * evaluated.  Probes fire without the GVL, so arguments must never touch
+ * Ruby objects.
+ */
+#ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define SP_PROBE2(name,a,b) DTRACE_PROBE2(sleepy_penguin,name,a,b)
+#  define SP_PROBE4(name,a,b,c,d) DTRACE_PROBE4(sleepy_penguin,name,a,b,c,d)
+#else
+#  define SP_PROBE2(name,a,b) for (;0;)
+#  define SP_PROBE4(name,a,b,c,d) for (;0;)
+#endif
+
+/* errno for *_return probes, 0 on success */
+#define SP_PROBE_ERRNO(rc) ((rc) < 0 ? errno : 0)
+
+#endif /* SLEEPY_PENGUIN_PROBES_H */
@@ -2,60 +2,10 @@
 #include "sleepy_penguin.h"
 #include <signal.h>
 #include <sys/signalfd.h>
+#include "stats.h"
 static VALUE ssi_members;
 static VALUE cSigInfo;
 
-/* converts a Symbol, String, or Fixnum to an integer signal */
-static int sig2int(VALUE sig)
-{
-	static VALUE list;
-	const char *ptr;
-	long len;
-
-	if (TYPE(sig) == T_FIXNUM)
-		return FIX2INT(sig);
-
-	sig = rb_obj_as_string(sig);
-	len = RSTRING_LEN(sig);
-	ptr = RSTRING_PTR(sig);
-
-	if (len > 3 && !memcmp("SIG", ptr, 3))
-		sig = rb_str_new(ptr + 3, len - 3);
-
-	if (!list) {
-		VALUE tmp = rb_const_get(rb_cObject, rb_intern("Signal"));
-
-		list = rb_funcall(tmp, rb_intern("list"), 0, 0);
-		rb_global_variable(&list);
-	}
-
-	sig = rb_hash_aref(list, sig);
-	if (NIL_P(sig))
-		rb_raise(rb_eArgError, "invalid signal: %s", ptr);
-
-	return NUM2INT(sig);
-}
-
-/* fills sigset_t with an Array of signals */
-static void value2sigset(sigset_t *mask, VALUE set)
-{
-	sigemptyset(mask);
-
-	switch (TYPE(set)) {
-	case T_NIL: return;
-	case T_ARRAY: {
-		VALUE *ptr = RARRAY_PTR(set);
-		long len = RARRAY_LEN(set);
-
-		while (--len >= 0)
-			sigaddset(mask, sig2int(*ptr++));
-		}
-		break;
-	default:
-		sigaddset(mask, sig2int(set));
-	}
-}
-
 static int cur_flags(int fd)
 {
 	int rv = 0;
@@ -94,9 +44,10 @@ static VALUE update_bang(int argc, VALUE *argv, VALUE self)
 	rb_scan_args(argc, argv, "02", &vmask, &vflags);
 	flags = NIL_P(vflags) ? cur_flags(fd)
 				: rb_sp_get_flags(self, vflags, 0);
-	value2sigset(&mask, vmask);
+	rb_sp_value2sigset(&mask, vmask);
 
 	rc = signalfd(fd, &mask, flags);
+	rb_sp_stat_syscall(RB_SP_STAT_SIGNALFD, self, rc);
 	if (rc < 0)
 		rb_sys_fail("signalfd");
 	return self;
@@ -130,9 +81,10 @@ static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 
 	rb_scan_args(argc, argv, "02", &vmask, &vflags);
 	flags = rb_sp_get_flags(klass, vflags, RB_SP_CLOEXEC(SFD_CLOEXEC));
-	value2sigset(&mask, vmask);
+	rb_sp_value2sigset(&mask, vmask);
 
 	fd = signalfd(-1, &mask, flags);
+	rb_sp_stat_syscall(RB_SP_STAT_SIGNALFD, Qnil, fd);
 	if (fd < 0) {
 		if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
 			rb_gc();
@@ -186,19 +138,23 @@ static VALUE sfd_take(int argc, VALUE *argv, VALUE self)
 	ssize_t r;
 	int fd;
 	VALUE nonblock;
+	int nb;
 
 	rb_scan_args(argc, argv, "01", &nonblock);
 	fd = rb_sp_fileno(self);
-	if (RTEST(nonblock))
-		rb_sp_set_nonblock(fd);
-	else
-		blocking_io_prepare(fd);
+	nb = rb_sp_io_prepare(nonblock, fd);
 retry:
 	ssi->ssi_fd = fd;
-	r = (ssize_t)rb_sp_fd_region(sfd_read, ssi, fd);
+	r = (ssize_t)(nb ?
+		rb_sp_stat_call(RB_SP_STAT_SIGNALFD, self, sfd_read, ssi) :
+		rb_sp_stat_region(RB_SP_STAT_SIGNALFD, self,
+				  sfd_read, ssi, fd));
 	if (r < 0) {
-		if (errno == EAGAIN && RTEST(nonblock))
-			return Qnil;
+		if (errno == EAGAIN) {
+			if (RTEST(nonblock))
+				return Qnil;
+			nb = 1; /* O_NONBLOCK is set, retries need not sleep */
+		}
 		if (rb_sp_wait(rb_io_wait_readable, self, &fd))
 			goto retry;
 		rb_sys_fail("read(signalfd)");
@@ -11,6 +11,7 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <unistd.h>
+#include <signal.h>
 
 extern size_t rb_sp_l1_cache_line_size;
 unsigned rb_sp_get_uflags(VALUE klass, VALUE flags);
@@ -18,6 +19,8 @@ int rb_sp_get_flags(VALUE klass, VALUE flags, int default_flags);
 int rb_sp_io_closed(VALUE io);
 int rb_sp_fileno(VALUE io);
 void rb_sp_set_nonblock(int fd);
+void rb_sp_value2sigset(sigset_t *, VALUE);
+VALUE rb_sp_syserr_new(int err, const char *msg);
 
 #if defined(HAVE_RB_THREAD_BLOCKING_REGION) || \
     defined(HAVE_RB_THREAD_IO_BLOCKING_REGION) || \
@@ -77,6 +80,10 @@ static inline VALUE fake_blocking_region(VALUE (*fn)(void *), void *data)
 
 typedef int rb_sp_waitfn(int fd);
 int rb_sp_wait(rb_sp_waitfn waiter, VALUE obj, int *fd);
+int rb_sp_fiber_scheduler_p(void);
+int rb_sp_mn_p(void);
+int rb_sp_park_p(void);
+int rb_sp_io_prepare(VALUE nonblock, int fd);
 
 /* Flexible array elements are standard in C99 */
 #if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)
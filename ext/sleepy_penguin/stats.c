@@ -0,0 +1,340 @@
+#include "stats.h"
+#include "clock_gettime.h"
+#include <pthread.h>
+#include <string.h>
+
+struct sp_stats {
+	struct rb_sp_stat kinds[RB_SP_STAT_NR];
+	struct sp_stats *next;
+};
+
+static __thread struct sp_stats *mine;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static struct sp_stats *live; /* one per thread which counted anything */
+static struct sp_stats dead; /* sums of threads which exited */
+
+static int tracking; /* nonzero once any object is tracked */
+static ID id_sp_stats;
+static VALUE sym_kinds[RB_SP_STAT_NR];
+static VALUE sym_syscalls, sym_eintr, sym_eagain, sym_nogvl_ns;
+static VALUE sym_batches, sym_events, sym_histogram;
+
+static void stat_add(struct rb_sp_stat *dst, const struct rb_sp_stat *src)
+{
+	size_t i;
+
+	dst->syscalls += src->syscalls;
+	dst->eintr += src->eintr;
+	dst->eagain += src->eagain;
+	dst->nogvl_ns += src->nogvl_ns;
+	dst->batches += src->batches;
+	dst->events += src->events;
+	for (i = 0; i < RB_SP_STAT_BUCKETS; i++)
+		dst->hist[i] += src->hist[i];
+}
+
+/* caller holds stats_lock */
+static void retire(struct sp_stats *st)
+{
+	struct sp_stats **pp;
+	size_t i;
+
+	for (pp = &live; *pp; pp = &(*pp)->next) {
+		if (*pp == st) {
+			*pp = st->next;
+			break;
+		}
+	}
+	for (i = 0; i < RB_SP_STAT_NR; i++)
+		stat_add(&dead.kinds[i], &st->kinds[i]);
+	free(st);
+}
+
+/* pthread_key_create destructor, runs without the GVL at thread exit */
+static void thread_exit(void *ptr)
+{
+	pthread_mutex_lock(&stats_lock);
+	retire(ptr);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static struct rb_sp_stat *thread_stat(enum rb_sp_stat_kind kind)
+{
+	if (!mine) {
+		void *ptr;
+		int err = posix_memalign(&ptr, rb_sp_l1_cache_line_size,
+					 sizeof(struct sp_stats));
+
+		if (err) {
+			errno = err;
+			rb_memerror();
+		}
+		memset(ptr, 0, sizeof(struct sp_stats));
+		pthread_mutex_lock(&stats_lock);
+		mine = ptr;
+		mine->next = live;
+		live = mine;
+		pthread_mutex_unlock(&stats_lock);
+		pthread_setspecific(stats_key, mine);
+	}
+
+	return &mine->kinds[kind];
+}
+
+static const rb_data_type_t stat_type = {
+	"SleepyPenguin stats",
+	{ 0, RUBY_TYPED_DEFAULT_FREE, 0, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static struct rb_sp_stat *obj_stat(VALUE obj)
+{
+	VALUE st;
+
+	if (!tracking || NIL_P(obj) || FIXNUM_P(obj))
+		return NULL;
+	st = rb_attr_get(obj, id_sp_stats);
+
+	return NIL_P(st) ? NULL : DATA_PTR(st);
+}
+
+static void syscall_add(struct rb_sp_stat *st, long rc, int err)
+{
+	st->syscalls++;
+	if (rc < 0) {
+		if (err == EINTR)
+			st->eintr++;
+		else if (err == EAGAIN)
+			st->eagain++;
+	}
+}
+
+void rb_sp_stat_syscall(enum rb_sp_stat_kind kind, VALUE obj, long rc)
+{
+	int err = errno;
+	struct rb_sp_stat *st = obj_stat(obj);
+
+	syscall_add(thread_stat(kind), rc, err);
+	if (st)
+		syscall_add(st, rc, err);
+	errno = err;
+}
+
+void rb_sp_stat_syscalls(enum rb_sp_stat_kind kind, VALUE obj,
+			unsigned long n)
+{
+	struct rb_sp_stat *st = obj_stat(obj);
+
+	thread_stat(kind)->syscalls += n;
+	if (st)
+		st->syscalls += n;
+}
+
+static void events_add(struct rb_sp_stat *st, long n)
+{
+	unsigned i = 0;
+
+	st->batches++;
+	st->events += n;
+	while (n > 0 && i < RB_SP_STAT_BUCKETS - 1) {
+		n >>= 1;
+		i++;
+	}
+	st->hist[i]++;
+}
+
+void rb_sp_stat_events(enum rb_sp_stat_kind kind, VALUE obj, long n)
+{
+	struct rb_sp_stat *st = obj_stat(obj);
+
+	if (n < 0)
+		return;
+	events_add(thread_stat(kind), n);
+	if (st)
+		events_add(st, n);
+}
+
+static uint64_t ts2ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+VALUE rb_sp_stat_region(enum rb_sp_stat_kind kind, VALUE obj,
+			VALUE (*fn)(void *), void *data, int fd)
+{
+	struct timespec t0, t1;
+	struct rb_sp_stat *st;
+	uint64_t ns;
+	VALUE rv;
+	int err;
+
+	CLOCK_GETTIME(&t0);
+	rv = rb_sp_fd_region(fn, data, fd);
+	err = errno;
+	CLOCK_GETTIME(&t1);
+	ns = ts2ns(&t1) - ts2ns(&t0);
+
+	st = thread_stat(kind);
+	st->nogvl_ns += ns;
+	syscall_add(st, (long)rv, err);
+	st = obj_stat(obj);
+	if (st) {
+		st->nogvl_ns += ns;
+		syscall_add(st, (long)rv, err);
+	}
+	errno = err;
+
+	return rv;
+}
+
+VALUE rb_sp_stat_call(enum rb_sp_stat_kind kind, VALUE obj,
+			VALUE (*fn)(void *), void *data)
+{
+	VALUE rv = fn(data);
+
+	rb_sp_stat_syscall(kind, obj, (long)rv);
+
+	return rv;
+}
+
+static VALUE stat_hash(const struct rb_sp_stat *st)
+{
+	VALUE rv = rb_hash_new();
+	VALUE hist = rb_ary_new2(RB_SP_STAT_BUCKETS);
+	size_t i;
+
+	rb_hash_aset(rv, sym_syscalls, ULL2NUM(st->syscalls));
+	rb_hash_aset(rv, sym_eintr, ULL2NUM(st->eintr));
+	rb_hash_aset(rv, sym_eagain, ULL2NUM(st->eagain));
+	rb_hash_aset(rv, sym_nogvl_ns, ULL2NUM(st->nogvl_ns));
+	rb_hash_aset(rv, sym_batches, ULL2NUM(st->batches));
+	rb_hash_aset(rv, sym_events, ULL2NUM(st->events));
+	for (i = 0; i < RB_SP_STAT_BUCKETS; i++)
+		rb_ary_push(hist, ULL2NUM(st->hist[i]));
+	rb_hash_aset(rv, sym_histogram, hist);
+
+	return rv;
+}
+
+static VALUE obj_stats(VALUE obj)
+{
+	VALUE st;
+
+	if (TYPE(obj) != T_FILE)
+		obj = rb_convert_type(obj, T_FILE, "IO", "to_io");
+	st = rb_attr_get(obj, id_sp_stats);
+	if (NIL_P(st)) {
+		struct rb_sp_stat *ptr;
+
+		st = TypedData_Make_Struct(rb_cObject, struct rb_sp_stat,
+					   &stat_type, ptr);
+		rb_ivar_set(obj, id_sp_stats, st);
+		tracking = 1;
+	}
+
+	return stat_hash(DATA_PTR(st));
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin.stats	-> Hash
+ *	SleepyPenguin.stats(io)	-> Hash
+ *
+ * Returns a snapshot of syscall and event counters for the whole
+ * process, keyed by :epoll, :inotify, :eventfd, :timerfd and :signalfd:
+ *
+ * - :syscalls - syscalls issued, including failed and retried ones
+ * - :eintr - syscalls interrupted by signals
+ * - :eagain - syscalls which would have blocked
+ * - :nogvl_ns - nanoseconds spent without the GVL in blocking calls
+ * - :batches - epoll_wait(2) calls and Inotify reads returning events
+ * - :events - events returned by those
+ * - :histogram - Array of batch counts by size: the first element
+ *   counts empty batches, the element at index +i+ counts batches of
+ *   2**(i-1) up to 2**i - 1 events, the last one includes larger ones
+ *
+ * Counters are kept per-thread and summed up here, so they are cheap to
+ * update but may be slightly behind for threads which are running.
+ * Children inherit the counters of their parent process.
+ *
+ * Given an +io+ (e.g. an Epoll, Inotify or EventFD object), returns the
+ * same counters for that object alone.  Objects are only tracked
+ * individually once they were passed here, so the first call returns
+ * zeroes.  Epoll objects start over with zeroes in forked children.
+ */
+static VALUE sp_stats(int argc, VALUE *argv, VALUE self)
+{
+	struct rb_sp_stat sum[RB_SP_STAT_NR];
+	struct sp_stats *st;
+	VALUE obj, rv;
+	size_t i;
+
+	rb_scan_args(argc, argv, "01", &obj);
+	if (!NIL_P(obj))
+		return obj_stats(obj);
+
+	pthread_mutex_lock(&stats_lock);
+	memcpy(sum, dead.kinds, sizeof(sum));
+	for (st = live; st; st = st->next)
+		for (i = 0; i < RB_SP_STAT_NR; i++)
+			stat_add(&sum[i], &st->kinds[i]);
+	pthread_mutex_unlock(&stats_lock);
+
+	rv = rb_hash_new();
+	for (i = 0; i < RB_SP_STAT_NR; i++)
+		rb_hash_aset(rv, sym_kinds[i], stat_hash(&sum[i]));
+
+	return rv;
+}
+
+static void atfork_prepare(void)
+{
+	pthread_mutex_lock(&stats_lock);
+}
+
+static void atfork_parent(void)
+{
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/* other threads are gone in the child, fold their counters */
+static void atfork_child(void)
+{
+	struct sp_stats *st, *next;
+
+	pthread_mutex_init(&stats_lock, NULL);
+	for (st = live; st; st = next) {
+		next = st->next;
+		if (st != mine)
+			retire(st);
+	}
+}
+
+void sleepy_penguin_init_stats(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	int err = pthread_key_create(&stats_key, thread_exit);
+
+	if (err) {
+		errno = err;
+		rb_sys_fail("pthread_key_create");
+	}
+	pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+
+	rb_define_singleton_method(mSleepyPenguin, "stats", sp_stats, -1);
+
+	id_sp_stats = rb_intern("sp_stats"); /* no "@", hidden from Ruby */
+	sym_kinds[RB_SP_STAT_EPOLL] = ID2SYM(rb_intern("epoll"));
+	sym_kinds[RB_SP_STAT_INOTIFY] = ID2SYM(rb_intern("inotify"));
+	sym_kinds[RB_SP_STAT_EVENTFD] = ID2SYM(rb_intern("eventfd"));
+	sym_kinds[RB_SP_STAT_TIMERFD] = ID2SYM(rb_intern("timerfd"));
+	sym_kinds[RB_SP_STAT_SIGNALFD] = ID2SYM(rb_intern("signalfd"));
+	sym_syscalls = ID2SYM(rb_intern("syscalls"));
+	sym_eintr = ID2SYM(rb_intern("eintr"));
+	sym_eagain = ID2SYM(rb_intern("eagain"));
+	sym_nogvl_ns = ID2SYM(rb_intern("nogvl_ns"));
+	sym_batches = ID2SYM(rb_intern("batches"));
+	sym_events = ID2SYM(rb_intern("events"));
+	sym_histogram = ID2SYM(rb_intern("histogram"));
+}
@@ -0,0 +1,60 @@
+#ifndef SLEEPY_PENGUIN_STATS_H
+#define SLEEPY_PENGUIN_STATS_H
+#include "sleepy_penguin.h"
+
+/*
+ * Syscall and event accounting.  Every thread counts into its own
+ * cache-aligned counters without any locking or atomics, and readers
+ * sum up all threads (plus threads which exited) under a mutex.
+ *
+ * Objects passed to SleepyPenguin.stats are tracked individually as
+ * well, through a hidden ivar which is only looked up once any object
+ * was tracked.  All functions here must be called with the GVL held.
+ */
+enum rb_sp_stat_kind {
+	RB_SP_STAT_EPOLL,
+	RB_SP_STAT_INOTIFY,
+	RB_SP_STAT_EVENTFD,
+	RB_SP_STAT_TIMERFD,
+	RB_SP_STAT_SIGNALFD,
+	RB_SP_STAT_NR
+};
+
+/* hist[0] counts empty batches, hist[i] those of 2**(i-1) events or more */
+#define RB_SP_STAT_BUCKETS 17
+
+struct rb_sp_stat {
+	uint64_t syscalls;
+	uint64_t eintr;
+	uint64_t eagain;
+	uint64_t nogvl_ns; /* spent in rb_sp_stat_region */
+	uint64_t batches; /* waits or reads returning events */
+	uint64_t events;
+	uint64_t hist[RB_SP_STAT_BUCKETS];
+};
+
+/* accounts for a syscall which returned +rc+, errno is kept intact */
+void rb_sp_stat_syscall(enum rb_sp_stat_kind, VALUE obj, long rc);
+
+/* accounts for +n+ syscalls which succeeded */
+void rb_sp_stat_syscalls(enum rb_sp_stat_kind, VALUE obj, unsigned long n);
+
+/* accounts for a batch of +n+ events returned to the caller */
+void rb_sp_stat_events(enum rb_sp_stat_kind, VALUE obj, long n);
+
+/*
+ * rb_sp_fd_region which accounts for the syscall made by +fn+ and the
+ * time spent without the GVL
+ */
+VALUE rb_sp_stat_region(enum rb_sp_stat_kind, VALUE obj,
+			VALUE (*fn)(void *), void *data, int fd);
+
+/*
+ * calls +fn+ while holding the GVL and accounts for its syscall, for
+ * nonblocking calls where releasing and reacquiring the GVL would cost
+ * more than the syscall itself
+ */
+VALUE rb_sp_stat_call(enum rb_sp_stat_kind, VALUE obj,
+			VALUE (*fn)(void *), void *data);
+
+#endif /* SLEEPY_PENGUIN_STATS_H */
@@ -2,6 +2,8 @@
 #include "sleepy_penguin.h"
 #include <sys/timerfd.h>
 #include "value2timespec.h"
+#include "stats.h"
+#include "probes.h"
 
 /*
  * call-seq:
@@ -30,6 +32,7 @@ static VALUE s_new(int argc, VALUE *argv, VALUE klass)
 	flags = rb_sp_get_flags(klass, fl, RB_SP_CLOEXEC(TFD_CLOEXEC));
 
 	fd = timerfd_create(clockid, flags);
+	rb_sp_stat_syscall(RB_SP_STAT_TIMERFD, Qnil, fd);
 	if (fd < 0) {
 		if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
 			rb_gc();
@@ -68,11 +71,14 @@ static VALUE settime(VALUE self, VALUE fl, VALUE interval, VALUE value)
 	int fd = rb_sp_fileno(self);
 	int flags = rb_sp_get_flags(self, fl, 0);
 	struct itimerspec old, new;
+	int rc;
 
 	value2timespec(&new.it_interval, interval);
 	value2timespec(&new.it_value, value);
 
-	if (timerfd_settime(fd, flags, &new, &old) < 0)
+	rc = timerfd_settime(fd, flags, &new, &old);
+	rb_sp_stat_syscall(RB_SP_STAT_TIMERFD, self, rc);
+	if (rc < 0)
 		rb_sys_fail("timerfd_settime");
 
 	return itimerspec2ary(&old);
@@ -88,8 +94,10 @@ static VALUE gettime(VALUE self)
 {
 	int fd = rb_sp_fileno(self);
 	struct itimerspec curr;
+	int rc = timerfd_gettime(fd, &curr);
 
-	if (timerfd_gettime(fd, &curr) < 0)
+	rb_sp_stat_syscall(RB_SP_STAT_TIMERFD, self, rc);
+	if (rc < 0)
 		rb_sys_fail("timerfd_gettime");
 
 	return itimerspec2ary(&curr);
@@ -99,7 +107,12 @@ static VALUE tfd_read(void *args)
 {
 	uint64_t *buf = args;
 	int fd = (int)(*buf);
-	ssize_t r = read(fd, buf, sizeof(uint64_t));
+	ssize_t r;
+
+	SP_PROBE2(timerfd_read_entry, fd, sizeof(uint64_t));
+	r = read(fd, buf, sizeof(uint64_t));
+	SP_PROBE4(timerfd_read_return, fd, sizeof(uint64_t),
+		  r < 0 ? (int64_t)r : (int64_t)*buf, SP_PROBE_ERRNO(r));
 
 	return (VALUE)r;
 }
@@ -116,19 +129,24 @@ static VALUE expirations(int argc, VALUE *argv, VALUE self)
 {
 	ssize_t r;
 	int fd = rb_sp_fileno(self);
-	uint64_t buf = (uint64_t)fd;
+	uint64_t buf;
 	VALUE nonblock;
+	int nb;
 
 	rb_scan_args(argc, argv, "01", &nonblock);
-	if (RTEST(nonblock))
-		rb_sp_set_nonblock(fd);
-	else
-		blocking_io_prepare(fd);
+	nb = rb_sp_io_prepare(nonblock, fd);
 retry:
-	r = (ssize_t)rb_sp_fd_region(tfd_read, &buf, fd);
+	buf = (uint64_t)fd; /* tfd_read takes the descriptor in here */
+	r = (ssize_t)(nb ?
+		rb_sp_stat_call(RB_SP_STAT_TIMERFD, self, tfd_read, &buf) :
+		rb_sp_stat_region(RB_SP_STAT_TIMERFD, self,
+				  tfd_read, &buf, fd));
 	if (r < 0) {
-		if (errno == EAGAIN && RTEST(nonblock))
-			return Qnil;
+		if (errno == EAGAIN) {
+			if (RTEST(nonblock))
+				return Qnil;
+			nb = 1; /* O_NONBLOCK is set, retries need not sleep */
+		}
 		if (rb_sp_wait(rb_io_wait_readable, self, &fd))
 			goto retry;
 		rb_sys_fail("read(timerfd)");
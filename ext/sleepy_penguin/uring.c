@@ -0,0 +1,830 @@
+#include "sleepy_penguin.h"
+#ifdef HAVE_LINUX_IO_URING_H
+#include "uring.h"
+#include "fdtab.h"
+#include "clock_gettime.h"
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <string.h>
+
+unsigned long rb_sp_uring_forks;
+static ID id_for_fd, id_close;
+static VALUE cUring;
+
+static void *ring_mmap(size_t size, int fd, off_t off)
+{
+	void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_POPULATE, fd, off);
+
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+int rb_sp_uring_setup(struct rb_sp_uring *ring, unsigned entries,
+			unsigned features)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+	unsigned *array;
+	unsigned i;
+	int fd, err;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CLAMP;
+	fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0)
+		return -1;
+	if ((p.features & features) != features) {
+		close(fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	ring->fd = fd;
+	ring->features = p.features;
+	ring->forks = rb_sp_uring_forks;
+	ring->sq_entries = p.sq_entries;
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes +
+			     p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+	ring->sq_ring = ring_mmap(ring->sq_ring_size, fd, IORING_OFF_SQ_RING);
+	if (!ring->sq_ring)
+		goto err;
+	if (ring->cq_ring_size) {
+		ring->cq_ring = ring_mmap(ring->cq_ring_size, fd,
+					  IORING_OFF_CQ_RING);
+		if (!ring->cq_ring)
+			goto err;
+	} else {
+		ring->cq_ring = ring->sq_ring;
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = ring_mmap(ring->sqes_size, fd, IORING_OFF_SQES);
+	if (!ring->sqes)
+		goto err;
+
+	sq = ring->sq_ring;
+	ring->sq_khead = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_ktail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_kmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	array = (unsigned *)(sq + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++)
+		array[i] = i;
+	ring->sq_tail = *ring->sq_ktail;
+
+	cq = ring->cq_ring;
+	ring->cq_khead = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_ktail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_kmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return fd;
+err:
+	err = errno;
+	rb_sp_uring_unmap(ring);
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+/* does not close ring->fd, callers usually have an IO object for that */
+void rb_sp_uring_unmap(struct rb_sp_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	ring->sqes = NULL;
+	ring->cq_ring = ring->sq_ring = NULL;
+}
+
+/*
+ * returns a zeroed SQE, the caller fills it in and calls
+ * rb_sp_uring_push.  Submits everything queued if the SQ is full.
+ */
+struct io_uring_sqe *rb_sp_uring_sqe(struct rb_sp_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	if (rb_sp_uring_pending(ring) >= ring->sq_entries) {
+		rb_sp_uring_submit(ring);
+		if (rb_sp_uring_pending(ring) >= ring->sq_entries) {
+			errno = EBUSY;
+			rb_sys_fail("io_uring SQ full");
+		}
+	}
+	sqe = &ring->sqes[ring->sq_tail & *ring->sq_kmask];
+	ring->sq_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+/*
+ * Submits +to_submit+ SQEs and waits for +min_complete+ CQEs or until
+ * +ts+ (relative) expires.  This may be called without the GVL.
+ */
+int rb_sp_uring_enter(struct rb_sp_uring *ring, unsigned to_submit,
+			unsigned min_complete,
+			const struct __kernel_timespec *ts)
+{
+	struct io_uring_getevents_arg arg;
+	unsigned flags = 0;
+	void *argp = NULL;
+	size_t argsz = 0;
+
+	if (min_complete) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (ts) {
+			memset(&arg, 0, sizeof(arg));
+			arg.ts = (uint64_t)(uintptr_t)ts;
+			flags |= IORING_ENTER_EXT_ARG;
+			argp = &arg;
+			argsz = sizeof(arg);
+		}
+	}
+
+	return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit,
+			    min_complete, flags, argp, argsz);
+}
+
+/* submits everything queued without waiting */
+void rb_sp_uring_submit(struct rb_sp_uring *ring)
+{
+	unsigned n;
+
+	rb_sp_uring_push(ring);
+	while ((n = rb_sp_uring_pending(ring))) {
+		int rc = rb_sp_uring_enter(ring, n, 0, NULL);
+
+		if (rc > 0)
+			continue;
+		if (rc == 0)
+			return;
+		if (errno == EINTR)
+			continue;
+		if (errno == EBUSY || errno == EAGAIN)
+			return; /* completions must be reaped first */
+		rb_sys_fail("io_uring_enter");
+	}
+}
+
+/*
+ * sets up +ring+ and returns an IO object which owns its descriptor,
+ * raises on failure
+ */
+VALUE rb_sp_uring_io_new(struct rb_sp_uring *ring, unsigned entries,
+			unsigned features)
+{
+	int fd = rb_sp_uring_setup(ring, entries, features);
+
+	if (fd < 0) {
+		if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
+			rb_gc();
+			fd = rb_sp_uring_setup(ring, entries, features);
+		}
+		if (fd < 0)
+			rb_sys_fail("io_uring_setup");
+	}
+
+	return rb_funcall(rb_cIO, id_for_fd, 1, INT2NUM(fd));
+}
+
+/* copies up to +max+ CQEs into +buf+ and frees their CQ slots */
+unsigned rb_sp_uring_reap(struct rb_sp_uring *ring, struct io_uring_cqe *buf,
+			unsigned max)
+{
+	unsigned head = *ring->cq_khead;
+	unsigned tail = RB_SP_URING_LOAD_ACQ(ring->cq_ktail);
+	unsigned mask = *ring->cq_kmask;
+	unsigned n = 0;
+
+	while (head != tail && n < max)
+		buf[n++] = ring->cqes[head++ & mask];
+	RB_SP_URING_STORE_REL(ring->cq_khead, head);
+
+	return n;
+}
+
+/*
+ * The readiness poller.  Registrations live in the same table Epoll
+ * uses, and each armed poll request is tagged with the descriptor and a
+ * sequence number in its user_data.  Completions from polls which were
+ * removed or replaced since carry an outdated sequence number and are
+ * dropped, so there is never a stale object pointer to worry about.
+ *
+ * Level-triggered (the default) registrations use single-shot polls
+ * which are requeued when their completion is reaped, so they fire again
+ * on the next wait if the descriptor is still ready.  Edge-triggered
+ * (ET) registrations use multishot polls.  ONESHOT registrations are not
+ * requeued until Uring#mod.
+ */
+#define UP_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | \
+		     IORING_FEAT_CQE_SKIP)
+#define UP_POLL_MASK (EPOLLIN|EPOLLPRI|EPOLLOUT|EPOLLERR|EPOLLHUP|EPOLLRDHUP)
+#define UP_REAP_MAX 256 /* events yielded per wait at most */
+
+struct uring_poller {
+	struct rb_sp_uring ring;
+	unsigned entries;
+	unsigned nwaiters;
+	VALUE io; /* owns ring.fd */
+	struct rb_sp_fdtab *tab;
+	uint32_t seq;
+	size_t nseqs;
+	uint32_t *seqs; /* indexed by descriptor, zero if not armed */
+};
+
+struct up_event {
+	uint32_t events;
+	VALUE obj;
+};
+
+static void up_mark(void *ptr)
+{
+	struct uring_poller *up = ptr;
+
+	rb_gc_mark(up->io);
+	rb_sp_fdtab_mark(up->tab);
+}
+
+static void up_free(void *ptr)
+{
+	struct uring_poller *up = ptr;
+
+	rb_sp_uring_unmap(&up->ring);
+	rb_sp_fdtab_unref(up->tab);
+	xfree(up->seqs);
+	xfree(up);
+}
+
+static size_t up_memsize(const void *ptr)
+{
+	const struct uring_poller *up = ptr;
+
+	return sizeof(*up) + rb_sp_fdtab_memsize(up->tab) +
+	       up->nseqs * sizeof(uint32_t) + up->ring.sq_ring_size +
+	       up->ring.cq_ring_size + up->ring.sqes_size;
+}
+
+static const rb_data_type_t up_type = {
+	"SleepyPenguin::Uring",
+	{ up_mark, up_free, up_memsize, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE up_alloc(VALUE klass)
+{
+	struct uring_poller *up;
+	VALUE self = TypedData_Make_Struct(klass, struct uring_poller,
+					   &up_type, up);
+
+	up->io = Qnil;
+	up->tab = rb_sp_fdtab_new();
+
+	return self;
+}
+
+static void up_setup(struct uring_poller *up)
+{
+	up->io = rb_sp_uring_io_new(&up->ring, up->entries, UP_FEATURES);
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Uring.new([entries])	-> Uring object
+ *
+ * Creates a new io_uring-based poller with room for +entries+ queued
+ * changes (default: 256).  Raises Errno::ENOSYS if the kernel is too old
+ * (Linux 5.17 or later is required) and Errno::EPERM if io_uring is
+ * disabled, see SleepyPenguin::Uring.poller for falling back to Epoll.
+ */
+static VALUE up_init(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_poller *up = DATA_PTR(self);
+	VALUE entries;
+
+	rb_scan_args(argc, argv, "01", &entries);
+	up->entries = NIL_P(entries) ? 256 : NUM2UINT(entries);
+	up_setup(up);
+
+	return self;
+}
+
+/* the parent still uses the inherited ring, start over like Epoll does */
+static void up_fork_reinit(struct uring_poller *up)
+{
+	rb_sp_uring_unmap(&up->ring);
+	if (!rb_sp_io_closed(up->io)) {
+		rb_funcall(up->io, id_close, 0);
+		rb_sp_fdtab_reset(up->tab);
+		if (up->seqs)
+			MEMZERO(up->seqs, uint32_t, up->nseqs);
+		up->nwaiters = 0;
+		up_setup(up);
+	}
+	up->ring.forks = rb_sp_uring_forks;
+}
+
+/* raises IOError if closed */
+static struct uring_poller *up_get(VALUE self)
+{
+	struct uring_poller *up;
+
+	TypedData_Get_Struct(self, struct uring_poller, &up_type, up);
+	if (NIL_P(up->io))
+		rb_raise(rb_eIOError, "uninitialized Uring");
+	if (up->ring.forks != rb_sp_uring_forks)
+		up_fork_reinit(up);
+	up->ring.fd = rb_sp_fileno(up->io);
+
+	return up;
+}
+
+static uint32_t seq_get(const struct uring_poller *up, int fd)
+{
+	return (size_t)fd < up->nseqs ? up->seqs[fd] : 0;
+}
+
+static void seq_set(struct uring_poller *up, int fd, uint32_t seq)
+{
+	if ((size_t)fd >= up->nseqs) {
+		size_t n = up->nseqs ? up->nseqs : 64;
+
+		if (!seq)
+			return;
+		while (n <= (size_t)fd)
+			n *= 2;
+		REALLOC_N(up->seqs, uint32_t, n);
+		MEMZERO(up->seqs + up->nseqs, uint32_t, n - up->nseqs);
+		up->nseqs = n;
+	}
+	up->seqs[fd] = seq;
+}
+
+static uint64_t up_user_data(int fd, uint32_t seq)
+{
+	return ((uint64_t)seq << 32) | (uint32_t)fd;
+}
+
+static void up_arm(struct uring_poller *up, int fd, uint32_t events)
+{
+	struct io_uring_sqe *sqe = rb_sp_uring_sqe(&up->ring);
+	uint32_t mask = events & UP_POLL_MASK;
+
+	if (++up->seq == 0) /* zero means disarmed */
+		++up->seq;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+#ifdef WORDS_BIGENDIAN
+	mask = (mask << 16) | (mask >> 16); /* like liburing does */
+#endif
+	sqe->poll32_events = mask;
+	if (events & EPOLLET)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = up_user_data(fd, up->seq);
+	rb_sp_uring_push(&up->ring);
+	seq_set(up, fd, up->seq);
+}
+
+static void up_disarm(struct uring_poller *up, int fd)
+{
+	uint32_t seq = seq_get(up, fd);
+	struct io_uring_sqe *sqe;
+
+	if (!seq)
+		return;
+	sqe = rb_sp_uring_sqe(&up->ring);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = up_user_data(fd, seq);
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = 0; /* ENOENT if it already fired, ignored */
+	rb_sp_uring_push(&up->ring);
+	seq_set(up, fd, 0);
+}
+
+/*
+ * changes are submitted by the next wait, unless a thread is already
+ * sleeping in one and would not see them until it wakes up
+ */
+static void up_changed(struct uring_poller *up)
+{
+	if (up->nwaiters)
+		rb_sp_uring_submit(&up->ring);
+}
+
+/*
+ * call-seq:
+ *	uring.add(io, events)	-> 0
+ *
+ * Starts watching +io+ for +events+, which takes the same values as
+ * Epoll#add.  Raises Errno::EEXIST if +io+ is already watched.
+ *
+ * Unlike epoll, io_uring keeps a watched file open even if all of its
+ * descriptors are closed, so call Uring#del before closing +io+.
+ */
+static VALUE up_add(VALUE self, VALUE io, VALUE events)
+{
+	struct uring_poller *up = up_get(self);
+	uint32_t ev = rb_sp_get_uflags(self, events);
+	int fd = rb_sp_fileno(io);
+	VALUE cur = rb_sp_fdtab_get(up->tab, fd, NULL);
+
+	if (!NIL_P(cur)) {
+		if (!rb_sp_io_closed(cur)) {
+			errno = EEXIST;
+			rb_sys_fail("uring add");
+		}
+		up_disarm(up, fd); /* a closed IO left behind */
+	}
+	up_arm(up, fd, ev);
+	rb_sp_fdtab_set(up->tab, fd, io, ev);
+	up_changed(up);
+
+	return INT2FIX(0);
+}
+
+/*
+ * call-seq:
+ *	uring.mod(io, events)	-> 0
+ *
+ * Changes the +events+ +io+ is watched for, rearming it if it was
+ * registered with ONESHOT.  Raises Errno::ENOENT if +io+ is not watched.
+ */
+static VALUE up_mod(VALUE self, VALUE io, VALUE events)
+{
+	struct uring_poller *up = up_get(self);
+	uint32_t ev = rb_sp_get_uflags(self, events);
+	int fd = rb_sp_fileno(io);
+
+	if (NIL_P(rb_sp_fdtab_get(up->tab, fd, NULL))) {
+		errno = ENOENT;
+		rb_sys_fail("uring mod");
+	}
+	up_disarm(up, fd);
+	up_arm(up, fd, ev);
+	rb_sp_fdtab_set(up->tab, fd, io, ev);
+	up_changed(up);
+
+	return INT2FIX(0);
+}
+
+/*
+ * call-seq:
+ *	uring.del(io)	-> 0
+ *
+ * Stops watching +io+.  Raises Errno::ENOENT if +io+ is not watched.
+ */
+static VALUE up_del(VALUE self, VALUE io)
+{
+	struct uring_poller *up = up_get(self);
+	int fd = rb_sp_fileno(io);
+
+	if (NIL_P(rb_sp_fdtab_get(up->tab, fd, NULL))) {
+		errno = ENOENT;
+		rb_sys_fail("uring del");
+	}
+	up_disarm(up, fd);
+	rb_sp_fdtab_clear(up->tab, fd);
+	up_changed(up);
+
+	return INT2FIX(0);
+}
+
+/* turns completions into events and requeues polls as needed */
+static unsigned up_reap(struct uring_poller *up, struct up_event *evs,
+			unsigned max)
+{
+	struct io_uring_cqe cqes[64];
+	unsigned n = 0;
+
+	while (n < max) {
+		unsigned i;
+		unsigned nr = max - n;
+
+		nr = rb_sp_uring_reap(&up->ring, cqes,
+				      nr < 64 ? nr : 64);
+		if (!nr)
+			break;
+		for (i = 0; i < nr; i++) {
+			struct io_uring_cqe *cqe = &cqes[i];
+			int fd = (int)(uint32_t)cqe->user_data;
+			uint32_t seq = (uint32_t)(cqe->user_data >> 32);
+			uint32_t ev;
+			VALUE obj;
+
+			if (!seq || seq_get(up, fd) != seq)
+				continue; /* ignored or outdated */
+			obj = rb_sp_fdtab_get(up->tab, fd, &ev);
+			if (NIL_P(obj))
+				continue;
+			if (cqe->flags & IORING_CQE_F_MORE) {
+				if (cqe->res < 0)
+					continue;
+			} else if (cqe->res < 0 || (ev & EPOLLONESHOT)) {
+				/* canceled or failed, never loop on errors */
+				seq_set(up, fd, 0);
+			} else {
+				up_arm(up, fd, ev);
+			}
+			if (cqe->res >= 0) {
+				evs[n].events = (uint32_t)cqe->res;
+				evs[n].obj = obj;
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+struct up_wait {
+	struct uring_poller *up;
+	unsigned to_submit;
+	struct __kernel_timespec *tsp;
+	struct __kernel_timespec ts;
+};
+
+static VALUE nogvl_enter(void *ptr)
+{
+	struct up_wait *w = ptr;
+
+	return (VALUE)(long)rb_sp_uring_enter(&w->up->ring, w->to_submit, 1,
+					      w->tsp);
+}
+
+static VALUE up_enter(VALUE ptr)
+{
+	struct up_wait *w = (struct up_wait *)ptr;
+
+	w->up->nwaiters++;
+	return (VALUE)rb_sp_fd_region(nogvl_enter, w, w->up->ring.fd);
+}
+
+static VALUE up_leave(VALUE ptr)
+{
+	struct up_wait *w = (struct up_wait *)ptr;
+
+	w->up->nwaiters--;
+	return Qnil;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+
+	CLOCK_GETTIME(&now);
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* returns false once +expire_at+ passed */
+static int up_remaining(struct up_wait *w, uint64_t expire_at)
+{
+	uint64_t now;
+
+	if (!w->tsp)
+		return 1;
+	now = now_ns();
+	if (now >= expire_at)
+		return 0;
+	w->ts.tv_sec = (expire_at - now) / 1000000000ULL;
+	w->ts.tv_nsec = (expire_at - now) % 1000000000ULL;
+
+	return 1;
+}
+
+/*
+ * call-seq:
+ *	uring.wait([maxevents[, timeout]]) { |events, io| ... }	-> Integer
+ *
+ * Like Epoll#wait: yields Integer +events+ and IO objects which are
+ * ready and returns the number of events.  Changes made by Uring#add,
+ * Uring#mod and Uring#del since the last call are submitted by the same
+ * io_uring_enter(2) call which waits for events.  At most 256 events
+ * are yielded by one call.  +timeout+ is in milliseconds, +nil+ (the
+ * default) waits indefinitely.
+ */
+static VALUE up_wait(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_poller *up = up_get(self);
+	struct up_event evs[UP_REAP_MAX];
+	VALUE maxevents, timeout;
+	struct up_wait w;
+	uint64_t expire_at = 0;
+	unsigned i, n, max;
+	int rc, nonblock = 0;
+
+	rb_need_block();
+	rb_scan_args(argc, argv, "02", &maxevents, &timeout);
+	rc = NIL_P(maxevents) ? 64 : NUM2INT(maxevents);
+	if (rc <= 0) {
+		errno = EINVAL;
+		rb_sys_fail("uring wait maxevents <= 0");
+	}
+	max = rc > UP_REAP_MAX ? UP_REAP_MAX : (unsigned)rc;
+
+	w.up = up;
+	w.tsp = NULL;
+	if (!NIL_P(timeout)) {
+		double ms = NUM2DBL(timeout);
+
+		if (ms >= 0) {
+			expire_at = now_ns() + (uint64_t)(ms * 1000000.0);
+			w.tsp = &w.ts;
+			nonblock = ms == 0;
+		}
+	}
+
+	for (;;) {
+		n = up_reap(up, evs, max);
+		if (n || !up_remaining(&w, expire_at))
+			break;
+		rb_sp_uring_push(&up->ring);
+		w.to_submit = rb_sp_uring_pending(&up->ring);
+		rc = (int)(long)rb_ensure(up_enter, (VALUE)&w,
+					  up_leave, (VALUE)&w);
+		up->ring.fd = rb_sp_fileno(up->io); /* raise if closed */
+		if (rc < 0 && errno != ETIME && errno != EINTR &&
+		    errno != EBUSY && errno != EAGAIN)
+			rb_sys_fail("io_uring_enter");
+	}
+
+	/*
+	 * zero timeouts are common when we're nested in another event loop
+	 * via to_io, don't leave requeued polls unsubmitted in that case
+	 */
+	if (nonblock && rb_sp_uring_pending(&up->ring)) {
+		rb_sp_uring_submit(&up->ring);
+		if (!n)
+			n = up_reap(up, evs, max);
+	}
+
+	for (i = 0; i < n; i++)
+		rb_yield_values(2, UINT2NUM(evs[i].events), evs[i].obj);
+
+	return UINT2NUM(n);
+}
+
+/*
+ * call-seq:
+ *	uring.submit	-> nil
+ *
+ * Submits queued changes without waiting for events.  Uring#wait does
+ * this on its own, this is only needed before watching Uring#to_io with
+ * something else.
+ */
+static VALUE up_submit(VALUE self)
+{
+	rb_sp_uring_submit(&up_get(self)->ring);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	uring.to_io	-> IO
+ *
+ * Returns the IO object for the underlying io_uring descriptor, which
+ * is readable when events are ready and may be watched by IO.select,
+ * Epoll, or similar.  Call Uring#submit first and use a zero timeout
+ * for Uring#wait once it is readable.
+ */
+static VALUE up_to_io(VALUE self)
+{
+	return up_get(self)->io;
+}
+
+/*
+ * call-seq:
+ *	uring.close	-> nil
+ *
+ * Closes the Uring object.  Raises IOError if it is already closed.
+ */
+static VALUE up_close(VALUE self)
+{
+	struct uring_poller *up = up_get(self);
+
+	rb_funcall(up->io, id_close, 0);
+	rb_sp_uring_unmap(&up->ring);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	uring.closed?	-> true or false
+ */
+static VALUE up_closed_p(VALUE self)
+{
+	struct uring_poller *up;
+
+	TypedData_Get_Struct(self, struct uring_poller, &up_type, up);
+
+	return NIL_P(up->io) || rb_sp_io_closed(up->io) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *	uring.io_for(io)	-> object
+ *
+ * Returns the IO object watched for the descriptor of +io+, if any.
+ */
+static VALUE up_io_for(VALUE self, VALUE io)
+{
+	return rb_sp_fdtab_get(up_get(self)->tab, rb_sp_fileno(io), NULL);
+}
+
+/*
+ * call-seq:
+ *	uring.events_for(io)	-> Integer
+ *
+ * Returns the events +io+ is watched for, or +nil+.
+ */
+static VALUE up_events_for(VALUE self, VALUE io)
+{
+	uint32_t ev;
+	VALUE obj = rb_sp_fdtab_get(up_get(self)->tab, rb_sp_fileno(io), &ev);
+
+	return NIL_P(obj) ? Qnil : UINT2NUM(ev);
+}
+
+/*
+ * call-seq:
+ *	uring.include?(io)	-> true or false
+ */
+static VALUE up_include_p(VALUE self, VALUE io)
+{
+	return NIL_P(up_io_for(self, io)) ? Qfalse : Qtrue;
+}
+
+static void uring_atfork_child(void)
+{
+	rb_sp_uring_forks++;
+}
+
+void sleepy_penguin_init_uring(void)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+
+	/*
+	 * Document-class: SleepyPenguin::Uring
+	 *
+	 * A readiness poller with the same interface as Epoll, built on
+	 * io_uring(7) poll requests.  Changes are queued in memory shared
+	 * with the kernel and submitted together by Uring#wait, so adding,
+	 * modifying or deleting watches costs no syscall of its own.
+	 *
+	 * Uring objects may not be shared across fork: like Epoll, a child
+	 * process starts with a new, empty Uring object.
+	 */
+	cUring = rb_define_class_under(mSleepyPenguin, "Uring", rb_cObject);
+	rb_define_alloc_func(cUring, up_alloc);
+	rb_undef_method(cUring, "initialize_copy");
+	rb_define_method(cUring, "initialize", up_init, -1);
+	rb_define_method(cUring, "add", up_add, 2);
+	rb_define_method(cUring, "mod", up_mod, 2);
+	rb_define_method(cUring, "del", up_del, 1);
+	rb_define_method(cUring, "wait", up_wait, -1);
+	rb_define_method(cUring, "submit", up_submit, 0);
+	rb_define_method(cUring, "to_io", up_to_io, 0);
+	rb_define_method(cUring, "close", up_close, 0);
+	rb_define_method(cUring, "closed?", up_closed_p, 0);
+	rb_define_method(cUring, "io_for", up_io_for, 1);
+	rb_define_method(cUring, "events_for", up_events_for, 1);
+	rb_define_method(cUring, "include?", up_include_p, 1);
+
+	/* same values as Epoll, see Epoll for descriptions */
+	rb_define_const(cUring, "IN", UINT2NUM(EPOLLIN));
+	rb_define_const(cUring, "OUT", UINT2NUM(EPOLLOUT));
+	rb_define_const(cUring, "PRI", UINT2NUM(EPOLLPRI));
+	rb_define_const(cUring, "ERR", UINT2NUM(EPOLLERR));
+	rb_define_const(cUring, "HUP", UINT2NUM(EPOLLHUP));
+	rb_define_const(cUring, "RDHUP", UINT2NUM(EPOLLRDHUP));
+
+	/* watch with multishot polls, see Epoll::ET */
+	rb_define_const(cUring, "ET", UINT2NUM((uint32_t)EPOLLET));
+
+	/* stop watching after the first event until Uring#mod */
+	rb_define_const(cUring, "ONESHOT", UINT2NUM(EPOLLONESHOT));
+
+	id_for_fd = rb_intern("for_fd");
+	id_close = rb_intern("close");
+	pthread_atfork(NULL, NULL, uring_atfork_child);
+
+	rb_sp_uring_file_init(cUring);
+	rb_sp_uring_server_init(cUring);
+
+	rb_require("sleepy_penguin/uring");
+}
+#endif /* HAVE_LINUX_IO_URING_H */
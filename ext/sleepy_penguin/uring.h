@@ -0,0 +1,93 @@
+#ifndef SLEEPY_PENGUIN_URING_H
+#define SLEEPY_PENGUIN_URING_H
+#include "sleepy_penguin.h"
+#include <linux/io_uring.h>
+
+/*
+ * A bare io_uring instance driven through raw syscalls, since liburing
+ * is not commonly installed.  Callers must hold the GVL for everything
+ * except rb_sp_uring_enter: the GVL serializes SQE producers and CQE
+ * consumers, and the kernel serializes concurrent io_uring_enter calls
+ * from threads which released the GVL.
+ *
+ * The SQ array is mapped 1:1 to SQEs at setup, so publishing an SQE is
+ * only a matter of bumping the tail.
+ */
+struct rb_sp_uring {
+	int fd;
+	unsigned features;
+	unsigned long forks; /* rb_sp_uring_forks at setup */
+
+	unsigned sq_entries;
+	unsigned sq_tail; /* ours, published to *sq_ktail */
+	unsigned *sq_khead;
+	unsigned *sq_ktail;
+	unsigned *sq_kmask;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_khead;
+	unsigned *cq_ktail;
+	unsigned *cq_kmask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring; /* may be the same as sq_ring */
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+#define RB_SP_URING_LOAD_ACQ(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RB_SP_URING_STORE_REL(p, v) \
+	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*
+ * bumped in forked children, the mappings are shared with the parent,
+ * so children must set up new rings instead of touching inherited ones
+ */
+extern unsigned long rb_sp_uring_forks;
+
+/* returns -1 and sets errno on failure, ENOSYS if +features+ are missing */
+int rb_sp_uring_setup(struct rb_sp_uring *, unsigned entries,
+			unsigned features);
+void rb_sp_uring_unmap(struct rb_sp_uring *);
+VALUE rb_sp_uring_io_new(struct rb_sp_uring *, unsigned entries,
+			unsigned features);
+struct io_uring_sqe *rb_sp_uring_sqe(struct rb_sp_uring *);
+int rb_sp_uring_enter(struct rb_sp_uring *, unsigned to_submit,
+			unsigned min_complete,
+			const struct __kernel_timespec *);
+void rb_sp_uring_submit(struct rb_sp_uring *);
+unsigned rb_sp_uring_reap(struct rb_sp_uring *, struct io_uring_cqe *,
+			unsigned max);
+
+#ifdef HAVE_SYS_EVENTFD_H
+void rb_sp_uring_file_init(VALUE cUring);
+#else
+#  define rb_sp_uring_file_init(cUring) for(;0;)
+#endif
+
+#ifdef IORING_RECV_MULTISHOT
+void rb_sp_uring_server_init(VALUE cUring);
+#else
+#  define rb_sp_uring_server_init(cUring) for(;0;)
+#endif
+
+/* SQEs filled in but not consumed by the kernel, yet */
+static inline unsigned rb_sp_uring_pending(const struct rb_sp_uring *ring)
+{
+	return ring->sq_tail - RB_SP_URING_LOAD_ACQ(ring->sq_khead);
+}
+
+static inline unsigned rb_sp_uring_ready(const struct rb_sp_uring *ring)
+{
+	return RB_SP_URING_LOAD_ACQ(ring->cq_ktail) - *ring->cq_khead;
+}
+
+/* publishes SQEs returned by rb_sp_uring_sqe to the kernel */
+static inline void rb_sp_uring_push(struct rb_sp_uring *ring)
+{
+	RB_SP_URING_STORE_REL(ring->sq_ktail, ring->sq_tail);
+}
+
+#endif /* SLEEPY_PENGUIN_URING_H */
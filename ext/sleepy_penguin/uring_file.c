@@ -0,0 +1,657 @@
+#include "sleepy_penguin.h"
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_EVENTFD_H)
+#include "uring.h"
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <string.h>
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+#  include <ruby/ractor.h>
+#endif
+
+/*
+ * Asynchronous file I/O.  Regular files are always "ready" as far as
+ * epoll is concerned, so reads and writes are queued on a ring of their
+ * own and completions are announced through an EventFD which may be
+ * watched by Epoll along with sockets.
+ *
+ * Every queued operation occupies a slot holding the Ruby objects it
+ * needs until it completes.  Slots are marked, which also pins the
+ * Strings the kernel reads from or writes into so GC.compact can't
+ * move them.  Objects with operations in flight are themselves kept
+ * alive by a per-Ractor registry, so GC never frees those Strings
+ * while the kernel may still use them, and close waits for the kernel
+ * to finish with them.
+ */
+#define UF_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | \
+		     IORING_FEAT_RW_CUR_POS)
+
+static ID id_new, id_close;
+static VALUE cEventFD, sym_CLOEXEC, sym_NONBLOCK;
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+static rb_ractor_local_key_t busy_key;
+#else
+static VALUE busy;
+#endif
+
+struct uf_op {
+	VALUE tag;
+	VALUE buf; /* String read into or written from, Qnil for fsync */
+	VALUE io; /* keeps the file open until submitted */
+	long next_free;
+	unsigned char opcode; /* 0 (IORING_OP_NOP) for free slots */
+};
+
+struct uring_file {
+	struct rb_sp_uring ring;
+	unsigned entries;
+	VALUE io; /* owns ring.fd */
+	VALUE efd;
+	long capa;
+	long free_head; /* -1 if there are no free slots */
+	long inflight;
+	struct uf_op *ops;
+};
+
+static void uf_mark(void *ptr)
+{
+	struct uring_file *uf = ptr;
+	long i;
+
+	rb_gc_mark(uf->io);
+	rb_gc_mark(uf->efd);
+	for (i = 0; i < uf->capa; i++) {
+		struct uf_op *op = &uf->ops[i];
+
+		if (op->opcode == IORING_OP_NOP)
+			continue;
+		/* rb_gc_mark pins: the kernel has pointers into op->buf */
+		rb_gc_mark(op->tag);
+		rb_gc_mark(op->buf);
+		rb_gc_mark(op->io);
+	}
+}
+
+static void uf_free(void *ptr)
+{
+	struct uring_file *uf = ptr;
+
+	rb_sp_uring_unmap(&uf->ring);
+	xfree(uf->ops);
+	xfree(uf);
+}
+
+static size_t uf_memsize(const void *ptr)
+{
+	const struct uring_file *uf = ptr;
+
+	return sizeof(*uf) + uf->capa * sizeof(struct uf_op) +
+	       uf->ring.sq_ring_size + uf->ring.cq_ring_size +
+	       uf->ring.sqes_size;
+}
+
+static const rb_data_type_t uf_type = {
+	"SleepyPenguin::Uring::File",
+	{ uf_mark, uf_free, uf_memsize, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE uf_alloc(VALUE klass)
+{
+	struct uring_file *uf;
+	VALUE self = TypedData_Make_Struct(klass, struct uring_file,
+					   &uf_type, uf);
+
+	uf->io = uf->efd = Qnil;
+	uf->free_head = -1;
+
+	return self;
+}
+
+/* objects with operations in flight, Hash keys so removal is cheap */
+static VALUE uf_busy(void)
+{
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+	VALUE busy = rb_ractor_local_storage_value(busy_key);
+
+	if (NIL_P(busy)) {
+		busy = rb_hash_new();
+		rb_ractor_local_storage_value_set(busy_key, busy);
+	}
+#endif
+	return busy;
+}
+
+/* called whenever uf->inflight changes from or to zero */
+static void uf_pin(VALUE self, struct uring_file *uf)
+{
+	if (uf->inflight)
+		rb_hash_aset(uf_busy(), self, Qtrue);
+	else
+		rb_hash_delete(uf_busy(), self);
+}
+
+static void uf_register_eventfd(struct uring_file *uf)
+{
+	int efd = rb_sp_fileno(uf->efd);
+
+	if (syscall(__NR_io_uring_register, uf->ring.fd,
+		    IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+		rb_sys_fail("io_uring_register(IORING_REGISTER_EVENTFD)");
+}
+
+static void uf_setup(struct uring_file *uf)
+{
+	uf->io = rb_sp_uring_io_new(&uf->ring, uf->entries, UF_FEATURES);
+	uf_register_eventfd(uf);
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Uring::File.new([entries])	-> Uring::File object
+ *
+ * Creates a new object for queueing up to +entries+ (default: 64) file
+ * operations at once.  More may be queued, but they will be submitted
+ * in batches of +entries+.  Requires Linux 5.11 or later.
+ */
+static VALUE uf_init(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_file *uf = DATA_PTR(self);
+	VALUE entries, flags;
+
+	rb_scan_args(argc, argv, "01", &entries);
+	uf->entries = NIL_P(entries) ? 64 : NUM2UINT(entries);
+	flags = rb_ary_new3(2, sym_CLOEXEC, sym_NONBLOCK);
+	uf->efd = rb_funcall(cEventFD, id_new, 2, INT2FIX(0), flags);
+	uf_setup(uf);
+
+	return self;
+}
+
+/*
+ * the parent still owns the inherited ring and its operations, start
+ * over with a new ring signalling the same EventFD
+ */
+static void uf_fork_reinit(VALUE self, struct uring_file *uf)
+{
+	rb_sp_uring_unmap(&uf->ring);
+	if (!rb_sp_io_closed(uf->io)) {
+		rb_funcall(uf->io, id_close, 0);
+		if (uf->ops)
+			MEMZERO(uf->ops, struct uf_op, uf->capa);
+		uf->capa = uf->inflight = 0;
+		uf->free_head = -1;
+		uf_pin(self, uf);
+		uf_setup(uf);
+	}
+	uf->ring.forks = rb_sp_uring_forks;
+}
+
+static struct uring_file *uf_get(VALUE self)
+{
+	struct uring_file *uf;
+
+	TypedData_Get_Struct(self, struct uring_file, &uf_type, uf);
+	if (NIL_P(uf->io))
+		rb_raise(rb_eIOError, "uninitialized Uring::File");
+	if (uf->ring.forks != rb_sp_uring_forks)
+		uf_fork_reinit(self, uf);
+	uf->ring.fd = rb_sp_fileno(uf->io);
+
+	return uf;
+}
+
+static long uf_slot(struct uring_file *uf)
+{
+	long slot = uf->free_head;
+
+	if (slot < 0) {
+		long i, capa = uf->capa ? uf->capa * 2 : 64;
+
+		REALLOC_N(uf->ops, struct uf_op, capa);
+		MEMZERO(uf->ops + uf->capa, struct uf_op, capa - uf->capa);
+		for (i = capa - 1; i >= uf->capa; i--) {
+			uf->ops[i].next_free = uf->free_head;
+			uf->free_head = i;
+		}
+		uf->capa = capa;
+		slot = uf->free_head;
+	}
+	uf->free_head = uf->ops[slot].next_free;
+
+	return slot;
+}
+
+/* queues an operation, returns its tag */
+static VALUE uf_queue(VALUE self, struct uring_file *uf,
+			struct io_uring_sqe *sqe, unsigned char opcode,
+			VALUE io, VALUE buf, VALUE tag)
+{
+	long slot = uf_slot(uf);
+	struct uf_op *op = &uf->ops[slot];
+
+	if (NIL_P(tag))
+		tag = LONG2FIX(slot);
+	op->tag = tag;
+	op->buf = buf;
+	op->io = io;
+	op->opcode = opcode;
+	if (uf->inflight++ == 0)
+		uf_pin(self, uf);
+
+	sqe->opcode = opcode;
+	sqe->user_data = (uint64_t)slot + 1;
+	rb_sp_uring_push(&uf->ring);
+
+	return tag;
+}
+
+static uint64_t uf_offset(VALUE offset)
+{
+	return NIL_P(offset) ? (uint64_t)-1 : (uint64_t)NUM2OFFT(offset);
+}
+
+/*
+ * call-seq:
+ *	uf.read(io, length[, offset[, tag]])	-> tag
+ *
+ * Queues a read of up to +length+ bytes from +io+ at +offset+, or at
+ * the current file position if +offset+ is +nil+.  The completion
+ * yields the String read, which is empty at the end of the file.
+ *
+ * +tag+ is any object identifying the operation in completions, it
+ * defaults to an Integer unique among operations in flight.  Returns
+ * +tag+.
+ */
+static VALUE uf_read(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_file *uf = uf_get(self);
+	VALUE io, length, offset, tag, buf;
+	struct io_uring_sqe *sqe;
+	long len;
+	int fd;
+
+	rb_scan_args(argc, argv, "22", &io, &length, &offset, &tag);
+	fd = rb_sp_fileno(io);
+	len = NUM2LONG(length);
+	if (len < 0 || (unsigned long)len > UINT32_MAX)
+		rb_raise(rb_eArgError, "invalid length: %ld", len);
+	buf = rb_str_buf_new(len);
+
+	sqe = rb_sp_uring_sqe(&uf->ring);
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)RSTRING_PTR(buf);
+	sqe->len = (uint32_t)len;
+	sqe->off = uf_offset(offset);
+
+	return uf_queue(self, uf, sqe, IORING_OP_READ, io, buf, tag);
+}
+
+/*
+ * call-seq:
+ *	uf.write(io, string[, offset[, tag]])	-> tag
+ *
+ * Queues a write of +string+ to +io+ at +offset+, or at the current
+ * file position if +offset+ is +nil+.  The completion yields the
+ * Integer number of bytes written.  +string+ may be modified once this
+ * returns.  See Uring::File#read for +tag+.
+ */
+static VALUE uf_write(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_file *uf = uf_get(self);
+	VALUE io, str, offset, tag;
+	struct io_uring_sqe *sqe;
+	int fd;
+
+	rb_scan_args(argc, argv, "22", &io, &str, &offset, &tag);
+	fd = rb_sp_fileno(io);
+	str = rb_str_new_frozen(StringValue(str));
+	if ((unsigned long)RSTRING_LEN(str) > UINT32_MAX)
+		rb_raise(rb_eArgError, "string too long");
+
+	sqe = rb_sp_uring_sqe(&uf->ring);
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)RSTRING_PTR(str);
+	sqe->len = (uint32_t)RSTRING_LEN(str);
+	sqe->off = uf_offset(offset);
+
+	return uf_queue(self, uf, sqe, IORING_OP_WRITE, io, str, tag);
+}
+
+/*
+ * call-seq:
+ *	uf.fsync(io[, datasync[, tag]])	-> tag
+ *
+ * Queues an fsync(2) of +io+, or fdatasync(2) if +datasync+ is true.
+ * The completion yields zero.  Operations are not ordered, so only
+ * queue this after writes it must cover have completed.  See
+ * Uring::File#read for +tag+.
+ */
+static VALUE uf_fsync(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_file *uf = uf_get(self);
+	VALUE io, datasync, tag;
+	struct io_uring_sqe *sqe;
+	int fd;
+
+	rb_scan_args(argc, argv, "12", &io, &datasync, &tag);
+	fd = rb_sp_fileno(io);
+
+	sqe = rb_sp_uring_sqe(&uf->ring);
+	sqe->fd = fd;
+	if (RTEST(datasync))
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+
+	return uf_queue(self, uf, sqe, IORING_OP_FSYNC, io, Qnil, tag);
+}
+
+/*
+ * call-seq:
+ *	uf.submit	-> Integer
+ *
+ * Submits all queued operations to the kernel with a single
+ * io_uring_enter(2) call and returns how many were submitted.  The
+ * IO objects of submitted operations may be closed.
+ */
+static VALUE uf_submit(VALUE self)
+{
+	struct uring_file *uf = uf_get(self);
+	unsigned n;
+
+	rb_sp_uring_push(&uf->ring);
+	n = rb_sp_uring_pending(&uf->ring);
+	rb_sp_uring_submit(&uf->ring);
+
+	return UINT2NUM(n - rb_sp_uring_pending(&uf->ring));
+}
+
+/* resets the EventFD counter so level-triggered watchers stop waking up */
+static void uf_drain_eventfd(struct uring_file *uf)
+{
+	uint64_t val;
+
+	if (read(rb_sp_fileno(uf->efd), &val, sizeof(val)) < 0 &&
+	    errno != EAGAIN && errno != EINTR)
+		rb_sys_fail("read(eventfd)");
+}
+
+static VALUE uf_result(struct uf_op *op, int res)
+{
+	if (res < 0)
+		return rb_sp_syserr_new(-res, "io_uring");
+
+	switch (op->opcode) {
+	case IORING_OP_READ:
+		rb_str_set_len(op->buf, res);
+		return op->buf;
+	default:
+		return INT2NUM(res);
+	}
+}
+
+/*
+ * yields completions one at a time (unless +discard+), so an exception
+ * or break in the block leaves the remaining ones for the next call
+ */
+static long uf_reap(VALUE self, struct uring_file *uf, int discard)
+{
+	struct io_uring_cqe cqe;
+	long n = 0;
+
+	uf_drain_eventfd(uf);
+	while (rb_sp_uring_reap(&uf->ring, &cqe, 1)) {
+		long slot = (long)cqe.user_data - 1;
+		struct uf_op *op;
+		VALUE tag, res;
+
+		if (slot < 0 || slot >= uf->capa)
+			continue;
+		op = &uf->ops[slot];
+		if (op->opcode == IORING_OP_NOP)
+			continue;
+		tag = op->tag;
+		res = discard ? Qnil : uf_result(op, cqe.res);
+
+		/* free the slot before the block may queue more */
+		op->opcode = IORING_OP_NOP;
+		op->tag = op->buf = op->io = Qnil;
+		op->next_free = uf->free_head;
+		uf->free_head = slot;
+		if (--uf->inflight == 0)
+			uf_pin(self, uf);
+		n++;
+
+		if (!discard)
+			rb_yield_values(2, tag, res);
+	}
+
+	return n;
+}
+
+/*
+ * call-seq:
+ *	uf.reap { |tag, result| ... }	-> Integer
+ *
+ * Yields the +tag+ and +result+ of every completed operation without
+ * blocking and returns the number of completions.  +result+ is the
+ * String read, the Integer number of bytes written, zero for fsync, or
+ * a SystemCallError (e.g. Errno::EBADF) if the operation failed.
+ *
+ * This also resets the counter of Uring::File#eventfd, call it whenever
+ * the EventFD is readable.
+ */
+static VALUE uf_reap_m(VALUE self)
+{
+	rb_need_block();
+
+	return LONG2NUM(uf_reap(self, uf_get(self), 0));
+}
+
+struct uf_wait {
+	struct rb_sp_uring *ring;
+	unsigned to_submit;
+	struct __kernel_timespec *tsp;
+	struct __kernel_timespec ts;
+};
+
+static VALUE nogvl_enter(void *ptr)
+{
+	struct uf_wait *w = ptr;
+
+	return (VALUE)(long)rb_sp_uring_enter(w->ring, w->to_submit, 1,
+					      w->tsp);
+}
+
+/*
+ * call-seq:
+ *	uf.wait([timeout]) { |tag, result| ... }	-> Integer
+ *
+ * Submits queued operations, waits up to +timeout+ milliseconds (or
+ * indefinitely if +nil+) for at least one of them to complete, and
+ * yields completions like Uring::File#reap.  Returns zero immediately
+ * if nothing is in flight.
+ */
+static VALUE uf_wait(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_file *uf = uf_get(self);
+	VALUE timeout;
+	struct uf_wait w;
+	long rc;
+
+	rb_need_block();
+	rb_scan_args(argc, argv, "01", &timeout);
+	if (!uf->inflight)
+		return INT2FIX(0);
+
+	w.ring = &uf->ring;
+	w.tsp = NULL;
+	if (!NIL_P(timeout)) {
+		double ms = NUM2DBL(timeout);
+
+		if (ms >= 0) {
+			uint64_t ns = (uint64_t)(ms * 1000000.0);
+
+			w.ts.tv_sec = ns / 1000000000ULL;
+			w.ts.tv_nsec = ns % 1000000000ULL;
+			w.tsp = &w.ts;
+		}
+	}
+	rb_sp_uring_push(&uf->ring);
+	if (rb_sp_uring_ready(&uf->ring)) {
+		rb_sp_uring_submit(&uf->ring);
+	} else {
+		w.to_submit = rb_sp_uring_pending(&uf->ring);
+		rc = (long)rb_sp_fd_region(nogvl_enter, &w, uf->ring.fd);
+		uf->ring.fd = rb_sp_fileno(uf->io); /* raise if closed */
+		if (rc < 0 && errno != ETIME && errno != EINTR &&
+		    errno != EBUSY && errno != EAGAIN)
+			rb_sys_fail("io_uring_enter");
+	}
+
+	return LONG2NUM(uf_reap(self, uf, 0));
+}
+
+/*
+ * call-seq:
+ *	uf.eventfd	-> SleepyPenguin::EventFD
+ *
+ * Returns the non-blocking EventFD which becomes readable when
+ * operations complete.  Watch it with Epoll (or anything else) and
+ * call Uring::File#reap when it is readable.
+ */
+static VALUE uf_eventfd(VALUE self)
+{
+	return uf_get(self)->efd;
+}
+
+/*
+ * call-seq:
+ *	uf.inflight	-> Integer
+ *
+ * Returns the number of operations queued or submitted whose
+ * completions were not yielded, yet.
+ */
+static VALUE uf_inflight(VALUE self)
+{
+	return LONG2NUM(uf_get(self)->inflight);
+}
+
+/*
+ * the kernel may still write into read buffers after the ring is gone
+ * (io-wq workers), so wait until it reports every operation done
+ */
+static void uf_cancel_all(VALUE self, struct uring_file *uf)
+{
+	struct io_uring_sqe *sqe;
+	struct uf_wait w;
+	long i, rc;
+
+	for (i = 0; i < uf->capa; i++) {
+		if (uf->ops[i].opcode == IORING_OP_NOP)
+			continue;
+		sqe = rb_sp_uring_sqe(&uf->ring);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uint64_t)i + 1;
+		sqe->user_data = 0; /* ignored by uf_reap */
+		rb_sp_uring_push(&uf->ring);
+	}
+	w.ring = &uf->ring;
+	w.tsp = NULL;
+	while (uf->inflight) {
+		w.to_submit = rb_sp_uring_pending(&uf->ring);
+		rc = (long)rb_sp_fd_region(nogvl_enter, &w, uf->ring.fd);
+		if (rc < 0 && errno != EINTR && errno != EBUSY &&
+		    errno != EAGAIN)
+			rb_sys_fail("io_uring_enter");
+		uf_reap(self, uf, 1);
+	}
+}
+
+/*
+ * call-seq:
+ *	uf.close	-> nil
+ *
+ * Closes the ring and the EventFD.  Operations in flight are canceled,
+ * and close waits until the kernel is done with the ones which could
+ * not be.  Their results are discarded.
+ */
+static VALUE uf_close(VALUE self)
+{
+	struct uring_file *uf = uf_get(self);
+
+	uf_cancel_all(self, uf);
+	rb_funcall(uf->io, id_close, 0);
+	rb_sp_uring_unmap(&uf->ring);
+	if (!rb_sp_io_closed(uf->efd))
+		rb_funcall(uf->efd, id_close, 0);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	uf.closed?	-> true or false
+ */
+static VALUE uf_closed_p(VALUE self)
+{
+	struct uring_file *uf;
+
+	TypedData_Get_Struct(self, struct uring_file, &uf_type, uf);
+
+	return NIL_P(uf->io) || rb_sp_io_closed(uf->io) ? Qtrue : Qfalse;
+}
+
+void rb_sp_uring_file_init(VALUE cUring)
+{
+	VALUE mSleepyPenguin = rb_define_module("SleepyPenguin");
+	VALUE cFile;
+
+	/*
+	 * Document-class: SleepyPenguin::Uring::File
+	 *
+	 * Batched, asynchronous read, write and fsync operations on
+	 * regular files (or anything else) using io_uring(7).  Completions
+	 * are signalled through an EventFD, so disk I/O can be driven by
+	 * the same Epoll loop as sockets without a thread per request:
+	 *
+	 *	uf = SleepyPenguin::Uring::File.new
+	 *	ep.add(uf.eventfd, SleepyPenguin::Epoll::IN)
+	 *	uf.read(file, 16384, 0)
+	 *	uf.submit
+	 *	...
+	 *	# once ep.wait yields uf.eventfd:
+	 *	uf.reap { |tag, result| ... }
+	 *
+	 * Like Epoll, a child process starts with no operations in flight
+	 * after fork, but keeps the same EventFD.
+	 *
+	 * Objects are not garbage collected while they have operations in
+	 * flight, reap every completion or call Uring::File#close when done.
+	 */
+	cFile = rb_define_class_under(cUring, "File", rb_cObject);
+	rb_define_alloc_func(cFile, uf_alloc);
+	rb_undef_method(cFile, "initialize_copy");
+	rb_define_method(cFile, "initialize", uf_init, -1);
+	rb_define_method(cFile, "read", uf_read, -1);
+	rb_define_method(cFile, "write", uf_write, -1);
+	rb_define_method(cFile, "fsync", uf_fsync, -1);
+	rb_define_method(cFile, "submit", uf_submit, 0);
+	rb_define_method(cFile, "reap", uf_reap_m, 0);
+	rb_define_method(cFile, "wait", uf_wait, -1);
+	rb_define_method(cFile, "eventfd", uf_eventfd, 0);
+	rb_define_method(cFile, "inflight", uf_inflight, 0);
+	rb_define_method(cFile, "close", uf_close, 0);
+	rb_define_method(cFile, "closed?", uf_closed_p, 0);
+
+	cEventFD = rb_const_get(mSleepyPenguin, rb_intern("EventFD"));
+	id_new = rb_intern("new");
+	id_close = rb_intern("close");
+	sym_CLOEXEC = ID2SYM(rb_intern("CLOEXEC"));
+	sym_NONBLOCK = ID2SYM(rb_intern("NONBLOCK"));
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+	busy_key = rb_ractor_local_storage_value_newkey();
+#else
+	busy = rb_hash_new();
+	rb_global_variable(&busy);
+#endif
+}
+#endif /* HAVE_LINUX_IO_URING_H && HAVE_SYS_EVENTFD_H */
@@ -0,0 +1,690 @@
+#include "sleepy_penguin.h"
+#ifdef HAVE_LINUX_IO_URING_H
+#include "uring.h"
+#ifdef IORING_RECV_MULTISHOT
+#include "fdtab.h"
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <string.h>
+
+/*
+ * Accepts connections with a multishot accept request and reads them
+ * with multishot recv requests picking buffers from a provided buffer
+ * ring.  Once armed, neither needs another syscall from us: the kernel
+ * keeps posting completions while we keep handing buffers back by
+ * bumping the buffer ring tail in shared memory.
+ *
+ * Connections live in an fdtab indexed by descriptor, with the sequence
+ * number of their recv request stored as the events.  Like the poller
+ * in uring.c, completions carry (seq << 32 | fd) in their user_data so
+ * completions of canceled requests are recognized and dropped, but their
+ * buffers are always recycled.
+ */
+#define US_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | \
+		     IORING_FEAT_CQE_SKIP)
+#define US_ACCEPT ((uint64_t)-1) /* user_data of the accept request */
+#define US_CANCEL ((uint64_t)-2) /* cancels the accept request */
+#define US_BGID 0
+
+static ID id_for_fd, id_close;
+static VALUE sym_entries, sym_buffers, sym_buffer_size, sym_class;
+
+struct uring_server {
+	struct rb_sp_uring ring;
+	unsigned entries;
+	int accepting; /* multishot accept armed */
+	int ring_ref; /* keeps the ring alive until buffers are unregistered */
+	VALUE io; /* owns ring.fd */
+	VALUE listener;
+	VALUE klass;
+	struct rb_sp_fdtab *conns;
+	uint32_t seq;
+
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	char *bufs;
+	size_t bufs_size;
+	unsigned nbufs; /* power-of-two */
+	unsigned buf_size;
+	uint16_t br_tail;
+};
+
+static void us_mark(void *ptr)
+{
+	struct uring_server *us = ptr;
+
+	rb_gc_mark(us->io);
+	rb_gc_mark(us->listener);
+	rb_gc_mark(us->klass);
+	rb_sp_fdtab_mark(us->conns);
+}
+
+/*
+ * the kernel may still write into the buffers of a live ring, so
+ * unregister them before they're unmapped
+ */
+static void us_release(struct uring_server *us)
+{
+	if (us->ring_ref >= 0) {
+		struct io_uring_buf_reg reg;
+
+		memset(&reg, 0, sizeof(reg));
+		reg.bgid = US_BGID;
+		if (us->ring.forks == rb_sp_uring_forks)
+			syscall(__NR_io_uring_register, us->ring_ref,
+				IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		close(us->ring_ref);
+		us->ring_ref = -1;
+	}
+	rb_sp_uring_unmap(&us->ring);
+}
+
+static void us_free(void *ptr)
+{
+	struct uring_server *us = ptr;
+
+	us_release(us);
+	if (us->br)
+		munmap(us->br, us->br_size);
+	if (us->bufs)
+		munmap(us->bufs, us->bufs_size);
+	rb_sp_fdtab_unref(us->conns);
+	xfree(us);
+}
+
+static size_t us_memsize(const void *ptr)
+{
+	const struct uring_server *us = ptr;
+
+	return sizeof(*us) + rb_sp_fdtab_memsize(us->conns) +
+	       us->br_size + us->bufs_size + us->ring.sq_ring_size +
+	       us->ring.cq_ring_size + us->ring.sqes_size;
+}
+
+static const rb_data_type_t us_type = {
+	"SleepyPenguin::Uring::Server",
+	{ us_mark, us_free, us_memsize, },
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE us_alloc(VALUE klass)
+{
+	struct uring_server *us;
+	VALUE self = TypedData_Make_Struct(klass, struct uring_server,
+					   &us_type, us);
+
+	us->io = us->listener = us->klass = Qnil;
+	us->ring_ref = -1;
+	us->conns = rb_sp_fdtab_new();
+
+	return self;
+}
+
+static void *anon_mmap(size_t size)
+{
+	void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if (ptr == MAP_FAILED) {
+		rb_gc();
+		ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			rb_sys_fail("mmap");
+	}
+	return ptr;
+}
+
+/* hands buffer +bid+ back to the kernel */
+static void br_recycle(struct uring_server *us, uint16_t bid)
+{
+	struct io_uring_buf *buf = &us->br->bufs[us->br_tail & (us->nbufs - 1)];
+	char *ptr = us->bufs + (size_t)bid * us->buf_size;
+
+	buf->addr = (uint64_t)(uintptr_t)ptr;
+	buf->len = us->buf_size;
+	buf->bid = bid;
+	us->br_tail++;
+	RB_SP_URING_STORE_REL(&us->br->tail, us->br_tail);
+}
+
+static void us_arm_accept(struct uring_server *us)
+{
+	struct io_uring_sqe *sqe = rb_sp_uring_sqe(&us->ring);
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = rb_sp_fileno(us->listener);
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+	sqe->user_data = US_ACCEPT;
+	rb_sp_uring_push(&us->ring);
+	us->accepting = 1;
+}
+
+static void us_arm_recv(struct uring_server *us, int fd, uint32_t seq)
+{
+	struct io_uring_sqe *sqe = rb_sp_uring_sqe(&us->ring);
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = US_BGID;
+	sqe->user_data = ((uint64_t)seq << 32) | (uint32_t)fd;
+	rb_sp_uring_push(&us->ring);
+}
+
+static void us_setup(struct uring_server *us)
+{
+	struct io_uring_buf_reg reg;
+	unsigned i;
+	int fd;
+
+	us->io = rb_sp_uring_io_new(&us->ring, us->entries, US_FEATURES);
+	fd = fcntl(us->ring.fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		rb_sys_fail("fcntl(F_DUPFD_CLOEXEC)");
+	us->ring_ref = fd;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)us->br;
+	reg.ring_entries = us->nbufs;
+	reg.bgid = US_BGID;
+	if (syscall(__NR_io_uring_register, us->ring.fd,
+		    IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		if (errno == EINVAL)
+			errno = ENOSYS; /* Linux < 5.19 */
+		rb_sys_fail("io_uring_register(IORING_REGISTER_PBUF_RING)");
+	}
+	us->br_tail = 0;
+	for (i = 0; i < us->nbufs; i++)
+		br_recycle(us, (uint16_t)i);
+
+	us_arm_accept(us);
+	rb_sp_uring_submit(&us->ring);
+}
+
+static unsigned opt_uint(VALUE opts, VALUE key, unsigned dflt)
+{
+	VALUE val = NIL_P(opts) ? Qnil : rb_hash_aref(opts, key);
+
+	return NIL_P(val) ? dflt : NUM2UINT(val);
+}
+
+/*
+ * call-seq:
+ *	SleepyPenguin::Uring::Server.new(listener[, opts])	-> Server object
+ *
+ * Starts accepting connections on the listening socket +listener+ and
+ * reading from them.  +opts+ may contain:
+ *
+ * - :buffers - number of receive buffers shared by all connections,
+ *   a power of two up to 32768 (default: 256)
+ * - :buffer_size - size of each receive buffer (default: 16384)
+ * - :entries - submission queue size (default: 256)
+ * - :class - class whose +for_fd+ method wraps accepted descriptors
+ *   (default: BasicSocket if the socket library is loaded, IO otherwise)
+ *
+ * Requires Linux 6.0 or later, raises Errno::ENOSYS on older kernels.
+ */
+static VALUE us_init(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_server *us = DATA_PTR(self);
+	VALUE listener, opts;
+
+	rb_scan_args(argc, argv, "11", &listener, &opts);
+	if (!NIL_P(opts))
+		Check_Type(opts, T_HASH);
+	rb_sp_fileno(listener);
+	us->listener = listener;
+	us->entries = opt_uint(opts, sym_entries, 256);
+	us->nbufs = opt_uint(opts, sym_buffers, 256);
+	us->buf_size = opt_uint(opts, sym_buffer_size, 16384);
+	if (!us->nbufs || us->nbufs > 32768 || (us->nbufs & (us->nbufs - 1)))
+		rb_raise(rb_eArgError,
+			 "buffers must be a power of two <= 32768");
+	if (!us->buf_size)
+		rb_raise(rb_eArgError, "buffer_size must be positive");
+
+	us->klass = NIL_P(opts) ? Qnil : rb_hash_aref(opts, sym_class);
+	if (NIL_P(us->klass)) {
+		ID id = rb_intern("BasicSocket");
+
+		us->klass = rb_const_defined(rb_cObject, id) ?
+			    rb_const_get(rb_cObject, id) : rb_cIO;
+	}
+
+	us->br_size = us->nbufs * sizeof(struct io_uring_buf);
+	us->br = anon_mmap(us->br_size);
+	us->bufs_size = (size_t)us->nbufs * us->buf_size;
+	us->bufs = anon_mmap(us->bufs_size);
+	us_setup(us);
+
+	return self;
+}
+
+/*
+ * the parent still owns the inherited ring and its requests, so start
+ * over with a new ring accepting on the same listener and leave
+ * connections accepted by the parent alone
+ */
+static void us_fork_reinit(struct uring_server *us)
+{
+	if (us->ring_ref >= 0) {
+		close(us->ring_ref);
+		us->ring_ref = -1;
+	}
+	rb_sp_uring_unmap(&us->ring);
+	us->ring.forks = rb_sp_uring_forks;
+	if (!rb_sp_io_closed(us->io)) {
+		rb_funcall(us->io, id_close, 0);
+		rb_sp_fdtab_reset(us->conns);
+		us->accepting = 0;
+		us_setup(us);
+	}
+}
+
+/* raises IOError if closed */
+static struct uring_server *us_get(VALUE self)
+{
+	struct uring_server *us;
+
+	TypedData_Get_Struct(self, struct uring_server, &us_type, us);
+	if (NIL_P(us->io))
+		rb_raise(rb_eIOError, "uninitialized Uring::Server");
+	if (us->ring.forks != rb_sp_uring_forks)
+		us_fork_reinit(us);
+	us->ring.fd = rb_sp_fileno(us->io);
+
+	return us;
+}
+
+struct us_for_fd_args {
+	VALUE klass;
+	int fd;
+};
+
+static VALUE us_for_fd(VALUE ptr)
+{
+	struct us_for_fd_args *a = (struct us_for_fd_args *)ptr;
+
+	return rb_funcall(a->klass, id_for_fd, 1, INT2NUM(a->fd));
+}
+
+static VALUE us_accepted(struct uring_server *us, int fd)
+{
+	struct us_for_fd_args a;
+	VALUE conn;
+	int state;
+
+	/* nothing owns +fd+ until for_fd returns, it may raise (ENOMEM) */
+	a.klass = us->klass;
+	a.fd = fd;
+	conn = rb_protect(us_for_fd, (VALUE)&a, &state);
+	if (state) {
+		close(fd);
+		rb_jump_tag(state);
+	}
+
+	if (++us->seq == 0) /* zero means unregistered */
+		++us->seq;
+	rb_sp_fdtab_set(us->conns, fd, conn, us->seq);
+	us_arm_recv(us, fd, us->seq);
+
+	return conn;
+}
+
+/*
+ * Turns one completion into a connection and its result, returns Qundef
+ * if there is nothing to yield.  Buffers are copied into Strings and
+ * recycled right away.
+ */
+static VALUE
+us_complete(struct uring_server *us, const struct io_uring_cqe *cqe,
+	    VALUE *res)
+{
+	int fd = (int)(uint32_t)cqe->user_data;
+	uint32_t seq = (uint32_t)(cqe->user_data >> 32);
+	uint32_t cur;
+	VALUE conn;
+
+	if (cqe->user_data == US_ACCEPT) {
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			us->accepting = 0; /* rearmed by the next reap */
+		if (cqe->res < 0) {
+			*res = rb_sp_syserr_new(-cqe->res, "accept");
+			return us->listener;
+		}
+		*res = rb_str_new(NULL, 0);
+		return us_accepted(us, cqe->res);
+	}
+
+	*res = Qnil;
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+		if (seq && cqe->res > 0)
+			*res = rb_str_new(us->bufs + (size_t)bid * us->buf_size,
+					  cqe->res);
+		br_recycle(us, bid);
+	}
+	if (!seq)
+		return Qundef; /* failed cancel */
+	conn = rb_sp_fdtab_get(us->conns, fd, &cur);
+	if (NIL_P(conn) || cur != seq)
+		return Qundef; /* canceled by Server#del */
+	if (cqe->res > 0) {
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			us_arm_recv(us, fd, seq);
+		return conn;
+	}
+	if (cqe->res == -ENOBUFS) { /* we fell behind, buffers are back */
+		us_arm_recv(us, fd, seq);
+		return Qundef;
+	}
+	if (cqe->flags & IORING_CQE_F_MORE)
+		return Qundef;
+
+	/* EOF or error, the recv request is gone */
+	rb_sp_fdtab_clear(us->conns, fd);
+	if (cqe->res < 0)
+		*res = rb_sp_syserr_new(-cqe->res, "recv");
+
+	return conn;
+}
+
+/*
+ * yields completions one at a time, so an exception or break in the
+ * block leaves the remaining ones for the next call
+ */
+static long us_reap(struct uring_server *us)
+{
+	struct io_uring_cqe cqe;
+	long n = 0;
+
+	if (!us->accepting && !rb_sp_io_closed(us->listener))
+		us_arm_accept(us);
+	while (rb_sp_uring_reap(&us->ring, &cqe, 1)) {
+		VALUE res, conn = us_complete(us, &cqe, &res);
+
+		if (conn == Qundef)
+			continue;
+		n++;
+		/* recvs rearmed above must not wait for the block */
+		rb_sp_uring_submit(&us->ring);
+		rb_yield_values(2, conn, res);
+	}
+	rb_sp_uring_submit(&us->ring);
+
+	return n;
+}
+
+/*
+ * call-seq:
+ *	srv.reap { |conn, data| ... }	-> Integer
+ *
+ * Yields completed accepts and reads without blocking and returns how
+ * many were yielded:
+ *
+ * - newly accepted connections are yielded with an empty String
+ * - data read is yielded as a binary String
+ * - +data+ is +nil+ once +conn+ reached EOF
+ * - +data+ is a SystemCallError if reading failed
+ * - if accepting fails, +conn+ is the listener and +data+ the
+ *   SystemCallError, accepting is retried by the next call
+ *
+ * Nothing more is read from +conn+ after EOF or an error, it may be
+ * closed right away.  Call Server#del before closing a connection
+ * otherwise.
+ */
+static VALUE us_reap_m(VALUE self)
+{
+	rb_need_block();
+
+	return LONG2NUM(us_reap(us_get(self)));
+}
+
+struct us_wait {
+	struct rb_sp_uring *ring;
+	struct __kernel_timespec *tsp;
+	struct __kernel_timespec ts;
+};
+
+static VALUE nogvl_enter(void *ptr)
+{
+	struct us_wait *w = ptr;
+
+	return (VALUE)(long)rb_sp_uring_enter(w->ring, 0, 1, w->tsp);
+}
+
+/*
+ * call-seq:
+ *	srv.wait([timeout]) { |conn, data| ... }	-> Integer
+ *
+ * Waits up to +timeout+ milliseconds (or indefinitely if +nil+) for
+ * connections or data and yields them like Server#reap.  Use this if
+ * the Server object is not watched by another event loop via
+ * Server#to_io.
+ */
+static VALUE us_wait(int argc, VALUE *argv, VALUE self)
+{
+	struct uring_server *us = us_get(self);
+	VALUE timeout;
+	struct us_wait w;
+	long rc;
+
+	rb_need_block();
+	rb_scan_args(argc, argv, "01", &timeout);
+
+	w.ring = &us->ring;
+	w.tsp = NULL;
+	if (!NIL_P(timeout)) {
+		double ms = NUM2DBL(timeout);
+
+		if (ms >= 0) {
+			uint64_t ns = (uint64_t)(ms * 1000000.0);
+
+			w.ts.tv_sec = ns / 1000000000ULL;
+			w.ts.tv_nsec = ns % 1000000000ULL;
+			w.tsp = &w.ts;
+		}
+	}
+	rb_sp_uring_submit(&us->ring);
+	if (!rb_sp_uring_ready(&us->ring)) {
+		rc = (long)rb_sp_fd_region(nogvl_enter, &w, us->ring.fd);
+		us->ring.fd = rb_sp_fileno(us->io); /* raise if closed */
+		if (rc < 0 && errno != ETIME && errno != EINTR &&
+		    errno != EBUSY && errno != EAGAIN)
+			rb_sys_fail("io_uring_enter");
+	}
+
+	return LONG2NUM(us_reap(us));
+}
+
+/*
+ * call-seq:
+ *	srv.del(conn)	-> conn or nil
+ *
+ * Stops reading from +conn+ and returns it, or +nil+ if +conn+ is not
+ * being read from.  io_uring keeps sockets open while requests on them
+ * are in flight, so this must be called before closing +conn+ unless
+ * Server#reap yielded its EOF or error.
+ */
+static VALUE us_del(VALUE self, VALUE conn)
+{
+	struct uring_server *us = us_get(self);
+	int fd = rb_sp_fileno(conn);
+	struct io_uring_sqe *sqe;
+	uint32_t seq = 0;
+	VALUE cur = rb_sp_fdtab_get(us->conns, fd, &seq);
+
+	if (cur != conn)
+		return Qnil;
+	sqe = rb_sp_uring_sqe(&us->ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = ((uint64_t)seq << 32) | (uint32_t)fd;
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = 0;
+	rb_sp_uring_push(&us->ring);
+	rb_sp_fdtab_clear(us->conns, fd);
+	rb_sp_uring_submit(&us->ring); /* the caller is likely to close */
+
+	return conn;
+}
+
+/*
+ * call-seq:
+ *	srv.include?(conn)	-> true or false
+ *
+ * Returns whether +conn+ is being read from.
+ */
+static VALUE us_include_p(VALUE self, VALUE conn)
+{
+	struct uring_server *us = us_get(self);
+	VALUE cur = rb_sp_fdtab_get(us->conns, rb_sp_fileno(conn), NULL);
+
+	return cur == conn ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *	srv.listener	-> IO
+ */
+static VALUE us_listener(VALUE self)
+{
+	return us_get(self)->listener;
+}
+
+/*
+ * call-seq:
+ *	srv.to_io	-> IO
+ *
+ * Returns the IO object for the underlying io_uring descriptor, which
+ * is readable while completions are ready.  It may be watched by Epoll
+ * along with other descriptors, call Server#reap once it is readable.
+ */
+static VALUE us_to_io(VALUE self)
+{
+	return us_get(self)->io;
+}
+
+/*
+ * Rings are torn down asynchronously after close(2), and an accept
+ * request may keep accepting until then, so cancel it and wait.  Clients
+ * accepted but not yielded, yet, are disconnected rather than lost.
+ */
+static void us_stop_accept(struct uring_server *us)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe cqe;
+
+	if (!us->accepting)
+		return;
+	sqe = rb_sp_uring_sqe(&us->ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = US_ACCEPT;
+	sqe->user_data = US_CANCEL;
+	rb_sp_uring_push(&us->ring);
+	rb_sp_uring_submit(&us->ring);
+
+	while (us->accepting) {
+		if (!rb_sp_uring_reap(&us->ring, &cqe, 1)) {
+			if (rb_sp_uring_enter(&us->ring, 0, 1, NULL) < 0 &&
+			    errno != EINTR && errno != EAGAIN)
+				rb_sys_fail("io_uring_enter");
+			continue;
+		}
+		if (cqe.user_data != US_ACCEPT)
+			continue;
+		if (cqe.res >= 0)
+			close(cqe.res);
+		if (!(cqe.flags & IORING_CQE_F_MORE))
+			us->accepting = 0;
+	}
+}
+
+/*
+ * call-seq:
+ *	srv.close	-> nil
+ *
+ * Stops accepting and reading and releases the buffers.  Neither the
+ * listener nor any connection is closed.
+ */
+static VALUE us_close(VALUE self)
+{
+	struct uring_server *us = us_get(self);
+
+	us_stop_accept(us);
+	us_release(us);
+	rb_funcall(us->io, id_close, 0);
+	rb_sp_fdtab_reset(us->conns);
+
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *	srv.closed?	-> true or false
+ */
+static VALUE us_closed_p(VALUE self)
+{
+	struct uring_server *us;
+
+	TypedData_Get_Struct(self, struct uring_server, &us_type, us);
+
+	return NIL_P(us->io) || rb_sp_io_closed(us->io) ? Qtrue : Qfalse;
+}
+
+void rb_sp_uring_server_init(VALUE cUring)
+{
+	VALUE cServer;
+
+	/*
+	 * Document-class: SleepyPenguin::Uring::Server
+	 *
+	 * Accepts and reads from TCP (or UNIX) connections with multishot
+	 * io_uring(7) requests.  Requests stay armed across completions,
+	 * and received data lands in a ring of kernel-selected buffers
+	 * which are recycled without syscalls, so a busy server hardly
+	 * makes any syscalls besides writing responses:
+	 *
+	 *	srv = SleepyPenguin::Uring::Server.new(TCPServer.new(8080))
+	 *	ep.add(srv, SleepyPenguin::Epoll::IN)
+	 *	...
+	 *	# once ep.wait yields srv:
+	 *	srv.reap do |conn, data|
+	 *	  case data
+	 *	  when String then ... # new connection or data
+	 *	  else conn.close # EOF or error
+	 *	  end
+	 *	end
+	 *
+	 * Like Epoll, a child process starts with no connections after
+	 * fork, but keeps accepting on the same listener.
+	 */
+	cServer = rb_define_class_under(cUring, "Server", rb_cObject);
+	rb_define_alloc_func(cServer, us_alloc);
+	rb_undef_method(cServer, "initialize_copy");
+	rb_define_method(cServer, "initialize", us_init, -1);
+	rb_define_method(cServer, "reap", us_reap_m, 0);
+	rb_define_method(cServer, "wait", us_wait, -1);
+	rb_define_method(cServer, "del", us_del, 1);
+	rb_define_method(cServer, "include?", us_include_p, 1);
+	rb_define_method(cServer, "listener", us_listener, 0);
+	rb_define_method(cServer, "to_io", us_to_io, 0);
+	rb_define_method(cServer, "close", us_close, 0);
+	rb_define_method(cServer, "closed?", us_closed_p, 0);
+
+	id_for_fd = rb_intern("for_fd");
+	id_close = rb_intern("close");
+	sym_entries = ID2SYM(rb_intern("entries"));
+	sym_buffers = ID2SYM(rb_intern("buffers"));
+	sym_buffer_size = ID2SYM(rb_intern("buffer_size"));
+	sym_class = ID2SYM(rb_intern("class"));
+}
+#endif /* IORING_RECV_MULTISHOT */
+#endif /* HAVE_LINUX_IO_URING_H */
@@ -1,4 +1,25 @@
 #include "sleepy_penguin.h"
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#  include <ruby/fiber/scheduler.h>
+#endif
+#ifdef HAVE_RUBY_VERSION_H
+#  include <ruby/version.h>
+#endif
+#if defined(RUBY_API_VERSION_CODE) && RUBY_API_VERSION_CODE >= 30300
+#  include <ruby/ractor.h>
+#  define RB_SP_MN 1 /* Ruby 3.3+ */
+#else
+#  define RB_SP_MN 0
+#endif
+#include <stdlib.h>
+
+/* RUBY_MN_THREADS=1 puts threads of the main Ractor on M:N threads */
+static int mn_main;
+
+#if RB_SP_MN
+/* only set in the main Ractor, other Ractors always use M:N threads */
+static rb_ractor_local_key_t main_key;
+#endif
 
 static VALUE klass_for(VALUE klass)
 {
@@ -106,6 +127,20 @@ int rb_sp_io_closed(VALUE io)
 	return my_rb_io_closed(io);
 }
 
+/* returns a SystemCallError (e.g. Errno::ENOENT) without raising it */
+VALUE rb_sp_syserr_new(int err, const char *msg)
+{
+#ifdef HAVE_RB_SYSERR_NEW
+	return rb_syserr_new(err, msg);
+#else
+	VALUE args[2];
+
+	args[0] = rb_str_new2(msg);
+	args[1] = INT2NUM(err);
+	return rb_class_new_instance(2, args, rb_eSystemCallError);
+#endif
+}
+
 int rb_sp_fileno(VALUE io)
 {
 	rb_io_t *fptr;
@@ -135,13 +170,157 @@ void rb_sp_set_nonblock(int fd)
 		rb_sys_fail("fcntl(F_SETFL)");
 }
 
+/*
+ * returns non-zero if the current fiber is non-blocking and its thread
+ * has a Fiber::Scheduler, a blocking syscall would stall every other
+ * fiber in the thread
+ */
+int rb_sp_fiber_scheduler_p(void)
+{
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+	return !NIL_P(rb_fiber_scheduler_current());
+#else
+	return 0;
+#endif
+}
+
+/*
+ * returns non-zero if the current Ruby thread may be multiplexed with
+ * others over fewer native threads (Ruby 3.3+), each blocking region
+ * would then pin a native thread for as long as it sleeps
+ */
+int rb_sp_mn_p(void)
+{
+#if RB_SP_MN
+	VALUE main_p;
+
+	if (mn_main)
+		return 1;
+	return !rb_ractor_local_storage_value_lookup(main_key, &main_p);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * returns non-zero if waiting should park the Ruby thread (or fiber)
+ * in Ruby's own event hub (or the fiber scheduler) rather than sleep
+ * in a syscall without the GVL
+ */
+int rb_sp_park_p(void)
+{
+	return rb_sp_mn_p() || rb_sp_fiber_scheduler_p();
+}
+
+/*
+ * prepares +fd+ for a read or write and returns non-zero if the syscall
+ * must not sleep: either the caller asked for +nonblock+, or the thread
+ * should be parked by rb_sp_wait on EAGAIN instead (see rb_sp_park_p)
+ */
+int rb_sp_io_prepare(VALUE nonblock, int fd)
+{
+	if (RTEST(nonblock) || rb_sp_park_p()) {
+		rb_sp_set_nonblock(fd);
+		return 1;
+	}
+	blocking_io_prepare(fd);
+	return 0;
+}
+
 int rb_sp_wait(rb_sp_waitfn waiter, VALUE obj, int *fd)
 {
+	int rc;
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+	VALUE scheduler;
+
+	/*
+	 * rb_io_wait_readable would wrap the descriptor in a new IO object
+	 * for the scheduler on every call, give it the one we have
+	 */
+	if (errno == EAGAIN &&
+	    !NIL_P(scheduler = rb_fiber_scheduler_current())) {
+		int events = waiter == rb_io_wait_writable ?
+			     RUBY_IO_WRITABLE : RUBY_IO_READABLE;
+		VALUE io = rb_convert_type(obj, T_FILE, "IO", "to_io");
+
+		rb_fiber_scheduler_io_wait(scheduler, io, INT2FIX(events),
+					   Qnil);
+		*fd = rb_sp_fileno(obj); /* other fibers may have closed it */
+		return 1;
+	}
+#endif
 	/*
 	 * we need to check the fileno before and after waiting, a close()
 	 * could've happened at any time (especially when outside of GVL).
 	 */
-	int rc = waiter(rb_sp_fileno(obj));
+	rc = waiter(rb_sp_fileno(obj));
 	*fd = rb_sp_fileno(obj);
 	return rc;
 }
+
+/* frozen copy of Signal.list, shared by all Ractors */
+static VALUE signal_list;
+
+/* converts a Symbol, String, or Fixnum to an integer signal */
+static int sig2int(VALUE sig)
+{
+	const char *ptr;
+	long len;
+
+	if (TYPE(sig) == T_FIXNUM)
+		return FIX2INT(sig);
+
+	sig = rb_obj_as_string(sig);
+	len = RSTRING_LEN(sig);
+	ptr = RSTRING_PTR(sig);
+
+	if (len > 3 && !memcmp("SIG", ptr, 3))
+		sig = rb_str_new(ptr + 3, len - 3);
+
+	sig = rb_hash_aref(signal_list, sig);
+	if (NIL_P(sig))
+		rb_raise(rb_eArgError, "invalid signal: %s", ptr);
+
+	return NUM2INT(sig);
+}
+
+/* fills sigset_t with an Array of signals */
+void rb_sp_value2sigset(sigset_t *mask, VALUE set)
+{
+	sigemptyset(mask);
+
+	switch (TYPE(set)) {
+	case T_NIL: return;
+	case T_ARRAY: {
+		VALUE *ptr = RARRAY_PTR(set);
+		long len = RARRAY_LEN(set);
+
+		while (--len >= 0)
+			sigaddset(mask, sig2int(*ptr++));
+		}
+		break;
+	default:
+		sigaddset(mask, sig2int(set));
+	}
+}
+
+void sleepy_penguin_init_util(void)
+{
+	VALUE tmp = rb_const_get(rb_cObject, rb_intern("Signal"));
+
+	/* loaded eagerly, lazy initialization would race between Ractors */
+	signal_list = rb_obj_freeze(rb_funcall(tmp, rb_intern("list"), 0, 0));
+	rb_global_variable(&signal_list);
+
+#if RB_SP_MN
+	{
+		/* Ruby itself only reads this at startup, too */
+		const char *mn = getenv("RUBY_MN_THREADS");
+
+		mn_main = mn && atoi(mn) != 0;
+		main_key = rb_ractor_local_storage_value_newkey();
+		rb_ractor_local_storage_value_set(main_key, Qtrue);
+	}
+#endif
+}
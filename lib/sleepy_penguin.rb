@@ -1,8 +1,8 @@
 # -*- encoding: binary -*-
 require 'sleepy_penguin_ext'
 
-# We need to serialize Inotify#take for Rubinius since that has no GVL
-# to protect the internal array
+# We need to serialize Inotify#take and Inotify#take_all for Rubinius since
+# that has no GVL to protect the internal array
 if defined?(SleepyPenguin::Inotify) &&
    defined?(Rubinius) && Rubinius.respond_to?(:synchronize)
   class SleepyPenguin::Inotify
@@ -12,6 +12,12 @@ if defined?(SleepyPenguin::Inotify) &&
     def take(*args)
       Rubinius.synchronize(@inotify_tmp) { __take(*args) }
     end
+
+    alias __take_all take_all
+    undef_method :take_all
+    def take_all(*args)
+      Rubinius.synchronize(@inotify_tmp) { __take_all(*args) }
+    end
     # :startdoc
   end
 end
@@ -1,6 +1,5 @@
 require 'thread'
 class SleepyPenguin::Epoll
-
   # call-seq:
   #     SleepyPenguin::Epoll.new([flags]) -> Epoll object
   #
@@ -8,22 +7,29 @@ class SleepyPenguin::Epoll
   # +flags+ may currently be +:CLOEXEC+ or +0+ (or +nil+).
   def initialize(create_flags = nil)
     @io = SleepyPenguin::Epoll::IO.new(create_flags)
+
+    # registrations live in a C table which is updated without releasing
+    # the GVL, @mtx only guards the rare fork/close/dup paths
     @mtx = Mutex.new
-    @events = []
-    @marks = []
     @pid = $$
     @create_flags = create_flags
+    @busy_poll = nil
     @copies = { @io => self }
   end
 
   def __ep_reinit # :nodoc:
-    @events.clear
-    @marks.clear
     @io = SleepyPenguin::Epoll::IO.new(@create_flags)
+    @io.busy_poll = @busy_poll
+    __ep_reset(@io) # keeps EXCLUSIVE registrations
   end
 
   # auto-reinitialize the Epoll object after forking
   def __ep_check # :nodoc:
+    return if @pid == $$
+    @mtx.synchronize { __ep_fork_reinit }
+  end
+
+  def __ep_fork_reinit # :nodoc:
     return if @pid == $$
     return if @io.closed?
     objects = @copies.values
@@ -39,10 +45,8 @@ class SleepyPenguin::Epoll
 
   # Epoll objects may be watched by IO.select and similar methods
   def to_io
-    @mtx.synchronize do
-      __ep_check
-      @io
-    end
+    __ep_check
+    @io
   end
 
   # Calls epoll_wait(2) and yields Integer +events+ and IO objects watched
@@ -52,36 +56,78 @@ class SleepyPenguin::Epoll
   # single-threaded applications. +maxevents+ defaults to 64 events.
   # +timeout+ is specified in milliseconds, +nil+
   # (the default) meaning it will block and wait indefinitely.
+  # Float and Rational +timeout+ values may specify fractions of a
+  # millisecond.
   def wait(maxevents = 64, timeout = nil)
-    # snapshot the marks so we do can sit this thread on epoll_wait while other
-    # threads may call epoll_ctl.  People say RCU is a poor man's GC, but our
-    # (ab)use of GC here is inspired by RCU...
-    snapshot = @mtx.synchronize do
-      __ep_check
-      @marks.dup
-    end
-
-    # we keep a snapshot of @marks around in case another thread closes
-    # the IO while it is being transferred to userspace.  We release mtx
-    # so another thread may add events to us while we're sleeping.
+    # pin the current generation of registrations so objects removed by
+    # other threads while we sleep in epoll_wait stay alive until we're
+    # done with them.  This costs the same regardless of how many
+    # objects are registered, unlike copying them all.
+    __ep_check
+    __rearm_flush(@io)
+    gen = __pin
     @io.epoll_wait(maxevents, timeout) { |events, io| yield(events, io) }
   ensure
-    # hopefully Ruby does not optimize this array away...
-    snapshot.clear
+    __unpin(gen) if gen
+  end
+
+  # call-seq:
+  #     ep.wait_into(ary[, maxevents[, timeout]]) -> Integer
+  #
+  # Like Epoll#wait, but replaces the contents of +ary+ with flat
+  # pairs of Integer +events+ and IO objects instead of yielding:
+  #
+  #   [ events, io, events, io, ... ]
+  #
+  # Returns the number of pairs stored in +ary+.  Reuse +ary+ across
+  # calls to avoid allocating Ruby objects for every event.
+  def wait_into(ary, maxevents = 64, timeout = nil)
+    __ep_check
+    __rearm_flush(@io)
+    gen = __pin
+    @io.epoll_wait_into(ary, maxevents, timeout)
+  ensure
+    __unpin(gen) if gen
+  end
+
+  # call-seq:
+  #     ep.wait_until(maxevents, deadline) { |events, io| ... }
+  #
+  # Like Epoll#wait, but waits until an absolute +deadline+ on the
+  # monotonic clock.  See Epoll::IO#epoll_wait_until for the accepted
+  # +deadline+ values.
+  def wait_until(maxevents, deadline)
+    __ep_check
+    __rearm_flush(@io)
+    gen = __pin
+    @io.epoll_wait_until(maxevents, deadline) { |ev, io| yield(ev, io) }
+  ensure
+    __unpin(gen) if gen
+  end
+
+  # call-seq:
+  #     ep.busy_poll = usecs
+  #
+  # Spins for up to +usecs+ microseconds before sleeping in waits.
+  # See Epoll::IO#busy_poll= for details.  Unlike the kernel parameters
+  # set by Epoll::IO#busy_poll_params=, this survives fork.
+  def busy_poll=(usecs)
+    __ep_check
+    @io.busy_poll = usecs
+    @busy_poll = usecs
+  end
+
+  # Returns the busy polling budget in microseconds, or +nil+
+  def busy_poll
+    __ep_check
+    @io.busy_poll
   end
 
   # Starts watching a given +io+ object with +events+ which may be an Integer
   # bitmask or Array representing arrays to watch for.
   def add(io, events)
-    fd = io.to_io.fileno
-    events = __event_flags(events)
-    @mtx.synchronize do
-      __ep_check
-      @io.epoll_ctl(CTL_ADD, io, events)
-      @events[fd] = events
-      @marks[fd] = io
-    end
-    0
+    __ep_check
+    __add(@io, io, events)
   end
 
   # call-seq:
@@ -89,13 +135,8 @@ class SleepyPenguin::Epoll
   #
   # Disables an IO object from being watched.
   def del(io)
-    fd = io.to_io.fileno
-    @mtx.synchronize do
-      __ep_check
-      @io.epoll_ctl(CTL_DEL, io, 0)
-      @events[fd] = @marks[fd] = nil
-    end
-    0
+    __ep_check
+    __del(@io, io)
   end
 
   # call-seq:
@@ -110,16 +151,8 @@ class SleepyPenguin::Epoll
   #
   # This method is deprecated and will be removed in sleepy_penguin 4.x
   def delete(io)
-    fd = io.to_io.fileno
-    @mtx.synchronize do
-      __ep_check
-      cur_io = @marks[fd]
-      return if nil == cur_io || cur_io.to_io.closed?
-      @io.epoll_ctl(CTL_DEL, io, 0)
-      @events[fd] = @marks[fd] = nil
-    end
-    io
-  rescue Errno::ENOENT, Errno::EBADF
+    __ep_check
+    __delete(@io, io)
   end
 
   # call-seq:
@@ -128,14 +161,25 @@ class SleepyPenguin::Epoll
   # Changes the watch for an existing IO object based on +events+.
   # Returns zero on success, will raise SystemError on failure.
   def mod(io, events)
-    events = __event_flags(events)
-    fd = io.to_io.fileno
-    @mtx.synchronize do
-      __ep_check
-      @io.epoll_ctl(CTL_MOD, io, events)
-      @marks[fd] = io # may be a different object with same fd/file
-      @events[fd] = events
-    end
+    __ep_check
+    __mod(@io, io, events)
+  end
+
+  # call-seq:
+  #     epoll.rearm(io, events) -> 0
+  #
+  # Like Epoll#mod, but defers the epoll_ctl(2) call until the next
+  # Epoll#wait or Epoll#wait_into in any thread.  All deferred changes
+  # are then applied in one pass right before sleeping.  This is
+  # intended for rearming many +ONESHOT+ registrations in one
+  # iteration of an event loop.
+  #
+  # Errors are only detected when changes are applied.  Changes for
+  # descriptors which were closed or deleted in the meantime are
+  # dropped, and other errors are raised by Epoll#wait.
+  def rearm(io, events)
+    __ep_check
+    __rearm(io, events)
   end
 
   # call-seq:
@@ -156,32 +200,8 @@ class SleepyPenguin::Epoll
   #
   # This method is deprecated and will be removed in sleepy_penguin 4.x
   def set(io, events)
-    fd = io.to_io.fileno
-    @mtx.synchronize do
-      __ep_check
-      cur_io = @marks[fd]
-      if cur_io == io
-        cur_events = @events[fd]
-        return 0 if (cur_events & ONESHOT) == 0 && cur_events == events
-        begin
-          @io.epoll_ctl(CTL_MOD, io, events)
-        rescue Errno::ENOENT
-          warn "epoll event cache failed (mod -> add)"
-          @io.epoll_ctl(CTL_ADD, io, events)
-          @marks[fd] = io
-        end
-      else
-        begin
-          @io.epoll_ctl(CTL_ADD, io, events)
-        rescue Errno::EEXIST
-          warn "epoll event cache failed (add -> mod)"
-          @io.epoll_ctl(CTL_MOD, io, events)
-        end
-        @marks[fd] = io
-      end
-      @events[fd] = events
-    end
-    0
+    __ep_check
+    __set(@io, io, events)
   end
 
   # call-seq:
@@ -206,11 +226,6 @@ class SleepyPenguin::Epoll
     end
   end
 
-  # we still support integer FDs for some debug functions
-  def __fileno(io) # :nodoc:
-    Integer === io ? io : io.to_io.fileno
-  end
-
   # call-seq:
   #     ep.io_for(io) -> object
   #
@@ -218,11 +233,8 @@ class SleepyPenguin::Epoll
   # IO objects may internally refer to the same process file descriptor.
   # Mostly used for debugging.
   def io_for(io)
-    fd = __fileno(io)
-    @mtx.synchronize do
-      __ep_check
-      @marks[fd]
-    end
+    __ep_check
+    __io_for(io)
   end
 
   # call-seq:
@@ -231,11 +243,8 @@ class SleepyPenguin::Epoll
   # Returns the events currently watched for in current Epoll object.
   # Mostly used for debugging.
   def events_for(io)
-    fd = __fileno(io)
-    @mtx.synchronize do
-      __ep_check
-      @events[fd]
-    end
+    __ep_check
+    __events_for(io)
   end
 
   # backwards compatibility, to be removed in 4.x
@@ -248,16 +257,14 @@ class SleepyPenguin::Epoll
   # garbage-collected by the current Epoll object.  This may include
   # closed IO objects.
   def include?(io)
-    fd = __fileno(io)
-    @mtx.synchronize do
-      __ep_check
-      @marks[fd] ? true : false
-    end
+    __ep_check
+    __io_for(io) ? true : false
   end
 
   def initialize_copy(src) # :nodoc:
+    src.__ep_check
+    __ep_share(src)
     @mtx.synchronize do
-      __ep_check
       rv = super
       unless @io.closed?
         @io = @io.dup
@@ -267,3 +274,6 @@ class SleepyPenguin::Epoll
     end
   end
 end
+
+# not autoloaded, non-main Ractors can't autoload
+require 'sleepy_penguin/epoll/dispatcher'
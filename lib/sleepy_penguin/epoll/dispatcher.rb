@@ -0,0 +1,171 @@
+require 'thread'
+
+# A pool of threads sharing one Epoll object.  Every descriptor is
+# watched with Epoll::ONESHOT so exactly one thread handles a given
+# descriptor at any time, and is rearmed right after its handler returns
+# so idle threads may pick it up while the rest of a batch is handled.
+#
+#   dispatcher = SleepyPenguin::Epoll::Dispatcher.new(4) do |events, io|
+#     buf = io.read_nonblock(16384)
+#     ...
+#   end
+#   dispatcher.add(sock, SleepyPenguin::Epoll::IN)
+#   dispatcher.start
+#
+# Each thread grabs up to +:maxevents+ events at once.  If handling
+# them takes longer than +:handoff+ seconds, the events it has not
+# started on yet are handed off to idle threads instead of waiting
+# behind a slow handler.
+class SleepyPenguin::Epoll::Dispatcher
+
+  # the underlying Epoll object
+  attr_reader :epoll
+
+  # call-seq:
+  #     SleepyPenguin::Epoll::Dispatcher.new(nthreads = 4[, opts]) { |events, io| ... }
+  #
+  # Creates a dispatcher with +nthreads+ threads calling the given block
+  # with the Integer +events+ and IO object for every event.  Threads are
+  # not started until Dispatcher#start is called.
+  #
+  # +opts+ may contain:
+  #
+  # - :maxevents - events grabbed at once by each thread (default: 8)
+  # - :handoff - seconds after which pending events are handed off to
+  #   other threads (default: 0.01)
+  # - :epoll - an existing Epoll object to use (default: Epoll.new)
+  #
+  # An exception raised by the block stops the thread which called it,
+  # without rearming the descriptor, and is raised again by
+  # Dispatcher#join.
+  def initialize(nthreads = 4, opts = {}, &handler)
+    handler or raise ArgumentError, "block not given"
+    nthreads > 0 or raise ArgumentError, "nthreads must be positive"
+    @nthreads = nthreads
+    @handler = handler
+    @maxevents = opts[:maxevents] || 8
+    @handoff = opts[:handoff] || 0.01
+    @epoll = opts[:epoll] || SleepyPenguin::Epoll.new
+    @threads = []
+    @stopping = false
+
+    # events handed off by busy threads, the wake pipe is level-triggered
+    # so every idle thread sees it until it is drained
+    @stolen = Queue.new
+    @wake_rd, @wake_wr = IO.pipe
+    @epoll.add(@wake_rd, SleepyPenguin::Epoll::IN)
+  end
+
+  # call-seq:
+  #     dispatcher.add(io, events) -> 0
+  #
+  # Starts watching +io+ for +events+, Epoll::ONESHOT is always added.
+  def add(io, events)
+    events = @epoll.__event_flags(events) | SleepyPenguin::Epoll::ONESHOT
+    @epoll.add(io, events)
+  end
+
+  # call-seq:
+  #     dispatcher.del(io) -> 0
+  #
+  # Stops watching +io+.  This may be called from the handler.
+  def del(io)
+    @epoll.del(io)
+  end
+
+  # call-seq:
+  #     dispatcher.start -> dispatcher
+  #
+  # Starts the threads.
+  def start
+    @threads.empty? or raise ArgumentError, "already started"
+    @nthreads.times { @threads << Thread.new { worker_loop } }
+    self
+  end
+
+  # call-seq:
+  #     dispatcher.stop -> dispatcher
+  #
+  # Tells all threads to stop once they are done with the events they
+  # are currently handling.  Events not handled yet are dropped without
+  # rearming.  Use Dispatcher#join to wait for the threads.
+  def stop
+    @stopping = true
+    @wake_wr.close unless @wake_wr.closed? # EOF wakes everybody up
+    self
+  end
+
+  # call-seq:
+  #     dispatcher.join -> dispatcher
+  #
+  # Waits for all threads to exit after Dispatcher#stop.
+  def join
+    @threads.each { |thr| thr.join }
+    self
+  ensure
+    @wake_rd.close unless @wake_rd.closed?
+  end
+
+  def dispatch(events, io) # :nodoc:
+    @handler.call(events, io)
+    return if io.closed?
+
+    # the handler may have deleted or modified io
+    ev = @epoll.events_for(io) or return
+    @epoll.rearm(io, ev)
+
+    # idle threads are asleep in epoll_wait and won't apply it for us
+    @epoll.__rearm_flush(@epoll.to_io)
+  end
+
+  def handoff(ary, i, n) # :nodoc:
+    while i < n
+      io = ary[i + 1]
+      @stolen << [ ary[i], io ] unless io == @wake_rd
+      i += 2
+    end
+    @wake_wr.syswrite('.')
+  rescue IOError, Errno::EPIPE # stopping
+  end
+
+  # returns false once we're stopping
+  def drain_wake # :nodoc:
+    @wake_rd.read_nonblock(16384)
+    true
+  rescue Errno::EAGAIN, Errno::EINTR
+    true
+  rescue EOFError, IOError
+    false
+  end
+
+  def worker_loop # :nodoc:
+    ary = []
+    until @stopping
+      begin
+        while (ev = @stolen.pop(true))
+          dispatch(*ev)
+          return if @stopping
+        end
+      rescue ThreadError # empty
+      end
+
+      n = @epoll.wait_into(ary, @maxevents) * 2
+      t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      i = 0
+      while i < n && !@stopping
+        events, io = ary[i], ary[i + 1]
+        if io == @wake_rd
+          drain_wake or return
+        elsif i > 0 &&
+              Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0 > @handoff
+          handoff(ary, i, n)
+          break
+        else
+          dispatch(events, io)
+        end
+        i += 2
+      end
+      ary.clear
+    end
+  end
+end
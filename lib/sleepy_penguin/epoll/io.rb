@@ -24,5 +24,30 @@ class SleepyPenguin::Epoll::IO
       retry
     end
   end
+
+  alias __epoll_wait_into epoll_wait_into
+  undef_method :epoll_wait_into
+  def epoll_wait_into(ary, maxevents = 64, timeout = nil)
+    begin
+      if timeout == nil || timeout < 0 # wait forever
+        begin
+          IO.select([self])
+          n = __epoll_wait_into(ary, maxevents, 0)
+        end while n == 0
+      elsif timeout == 0
+        return __epoll_wait_into(ary, maxevents, 0)
+      else
+        done = Time.now + (timeout / 1000.0)
+        begin
+          tout = done - Time.now
+          IO.select([self], nil, nil, tout) if tout > 0
+          n = __epoll_wait_into(ary, maxevents, 0)
+        end while n == 0 && tout > 0
+      end
+      n
+    rescue Errno::EINTR
+      retry
+    end
+  end
   # :startdoc:
 end
@@ -0,0 +1,258 @@
+# -*- encoding: binary -*-
+require 'thread'
+class SleepyPenguin::FiberScheduler
+  # :stopdoc:
+  # one suspension of +fiber+, stale events for it are ignored once +done+
+  Wait = Struct.new(:fiber, :done)
+
+  # one pending timeout, +wait+ is cleared once fired or cancelled
+  Timer = Struct.new(:at, :wait, :error)
+
+  # rebuild the timer heap when this many cancelled timers pile up
+  TIMER_GC = 64
+  # :startdoc:
+
+  # call-seq:
+  #     SleepyPenguin::FiberScheduler.new -> FiberScheduler object
+  #
+  # Creates a new scheduler for the current thread, it must be installed
+  # with Fiber.set_scheduler before Fiber.schedule may be used.
+  def initialize
+    @io = SleepyPenguin::Epoll::IO.new(nil)
+    @timer = SleepyPenguin::TimerFD.new(:MONOTONIC, [ :CLOEXEC, :NONBLOCK ])
+    @wakeup = SleepyPenguin::EventFD.new(0, [ :CLOEXEC, :NONBLOCK ])
+    @thread = Thread.current
+    @lock = Mutex.new
+    @unblocked = [] # Waits unblocked by other threads, guarded by @lock
+    @ready = [] # Waits unblocked by this thread
+    @blocking = {} # fiber => Wait, for fibers which may be unblocked
+    @waiting = 0 # suspended fibers, the loop runs until none are left
+    @events = [] # flat [ Wait, events, ... ] pairs from __select
+    @timers = [] # binary heap ordered by Timer#at
+    @cancelled = 0 # cancelled Timers still in @timers
+    @armed_at = nil # the deadline @timer is armed for
+    @closed = false
+    __wait_io(@io, @timer, IO::READABLE, :timer)
+    __wait_io(@io, @wakeup, IO::READABLE, :wakeup)
+  end
+
+  # Fiber::Scheduler hook for IO#wait, IO#wait_readable and friends.
+  # Returns the ready +events+, or +false+ if +timeout+ seconds elapsed.
+  def io_wait(io, events, timeout = nil)
+    wait = Wait.new(Fiber.current, false)
+    ready = nil
+    fd = __wait_io(@io, io, events, wait) or return events
+    ready = __suspend(wait, timeout, false)
+  ensure
+    __cancel_io(@io, fd, wait) if fd && !ready
+  end
+
+  # Fiber::Scheduler hook for Kernel#sleep, sleeps forever (or until
+  # unblocked) without a +duration+.
+  def kernel_sleep(duration = nil)
+    __suspend(Wait.new(Fiber.current, false), duration, true)
+    true
+  end
+
+  # Fiber::Scheduler hook for Mutex, Queue, Thread#join and friends.
+  # Returns +true+ if unblocked, and +false+ if +timeout+ seconds elapsed.
+  def block(blocker, timeout = nil)
+    __suspend(Wait.new(Fiber.current, false), timeout, true)
+  end
+
+  # Fiber::Scheduler hook to wake up a fiber suspended by #block,
+  # this may be called by any thread.
+  def unblock(blocker, fiber)
+    if Thread.current == @thread
+      wait = @blocking[fiber] and @ready << wait
+    else
+      wait = @blocking[fiber] || fiber # resolved in __wakeup if not blocked
+      @lock.synchronize { @unblocked << wait }
+      @wakeup.incr(1, true)
+    end
+  end
+
+  # Fiber::Scheduler hook for Timeout.timeout, raises +klass+ with
+  # +message+ in the current fiber if the block runs for longer than
+  # +duration+ seconds.
+  def timeout_after(duration, klass, message)
+    timer = __timer_add(duration, Wait.new(Fiber.current, false),
+                        [ klass, message ])
+    yield duration
+  ensure
+    __timer_cancel(timer) if timer
+  end
+
+  # Fiber::Scheduler hook for Process.wait and friends, waitpid(2) runs
+  # in a separate thread which unblocks us when done.
+  def process_wait(pid, flags)
+    Thread.new { Process::Status.wait(pid, flags) }.value
+  end
+
+  # Fiber::Scheduler hook for Fiber.schedule, starts running the block
+  # in a new non-blocking fiber right away.
+  def fiber(&block)
+    fiber = Fiber.new(blocking: false, &block)
+    fiber.resume
+    fiber
+  end
+
+  # Runs until no fibers are left waiting.
+  def run
+    __run_once while @waiting > 0 || !@ready.empty?
+  end
+
+  # Fiber::Scheduler hook called when the thread exits or the scheduler
+  # is replaced, finishes all fibers before releasing descriptors.
+  def close
+    return if @closed
+    run
+  ensure
+    unless @closed
+      @closed = true
+      [ @io, @timer, @wakeup ].each { |io| io.close unless io.closed? }
+    end
+  end
+
+  def closed?
+    @closed
+  end
+
+  # :stopdoc:
+  def __suspend(wait, timeout, blocker)
+    fiber = wait.fiber
+    timer = timeout ? __timer_add(timeout, wait, nil) : nil
+    @blocking[fiber] = wait if blocker
+    @waiting += 1
+    Fiber.yield
+  ensure
+    wait.done = true
+    @waiting -= 1
+    @blocking.delete(fiber) if blocker
+    __timer_cancel(timer) if timer
+  end
+
+  # resumes the fiber behind +wait+ unless something else already did,
+  # one batch of events may hold both its timeout and its readiness
+  def __resume(wait, value)
+    return if wait.done
+    wait.done = true
+    wait.fiber.resume(value) if wait.fiber.alive?
+  end
+
+  def __run_once
+    n = __select(@io, @events, @ready.empty? ? nil : 0)
+    i = 0
+    while n > 0
+      wait = @events[i]
+      case wait
+      when :timer then __timer_fire
+      when :wakeup then __wakeup
+      else
+        __resume(wait, @events[i + 1])
+      end
+      i += 2
+      n -= 1
+    end
+    __resume_ready
+  end
+
+  def __resume_ready
+    return if @ready.empty?
+    ready = @ready
+    @ready = []
+    ready.each { |wait| __resume(wait, true) }
+  end
+
+  def __wakeup
+    @wakeup.value(true)
+    __wait_io(@io, @wakeup, IO::READABLE, :wakeup)
+    @lock.synchronize do
+      @unblocked.each do |wait|
+        wait = @blocking[wait] if Fiber === wait
+        @ready << wait if wait
+      end
+      @unblocked.clear
+    end
+  end
+
+  def __now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  def __timer_add(duration, wait, error)
+    timer = Timer.new(__now + duration, wait, error)
+    __heap_push(timer)
+    if @armed_at.nil? || timer.at < @armed_at
+      @timer.settime(:ABSTIME, 0, timer.at)
+      @armed_at = timer.at
+    end
+    timer
+  end
+
+  def __timer_cancel(timer)
+    return unless timer.wait
+    timer.wait = nil
+    @cancelled += 1
+    return if @cancelled < TIMER_GC || @cancelled * 2 < @timers.size
+    @timers.keep_if(&:wait)
+    @timers.sort_by!(&:at) # a sorted Array is a valid heap
+    @cancelled = 0
+  end
+
+  def __timer_fire
+    @timer.expirations(true)
+    @armed_at = nil
+    __wait_io(@io, @timer, IO::READABLE, :timer)
+    now = __now
+    while (timer = @timers[0]) && timer.at <= now
+      __heap_pop
+      wait = timer.wait
+      if wait.nil?
+        @cancelled -= 1
+        next
+      end
+      timer.wait = nil
+      next unless wait.fiber.alive?
+      begin
+        timer.error ? wait.fiber.raise(*timer.error) : __resume(wait, false)
+      rescue FiberError # it is running another fiber, too late
+      end
+    end
+    if timer = @timers[0]
+      @timer.settime(:ABSTIME, 0, timer.at)
+      @armed_at = timer.at
+    end
+  end
+
+  def __heap_push(timer)
+    heap = @timers
+    i = heap.size
+    heap << timer
+    while i > 0
+      parent = (i - 1) / 2
+      break if heap[parent].at <= timer.at
+      heap[i] = heap[parent]
+      i = parent
+    end
+    heap[i] = timer
+  end
+
+  def __heap_pop
+    heap = @timers
+    top = heap[0]
+    last = heap.pop
+    n = heap.size
+    return top if n == 0
+    i = 0
+    while (child = i * 2 + 1) < n
+      child += 1 if child + 1 < n && heap[child + 1].at < heap[child].at
+      break if last.at <= heap[child].at
+      heap[i] = heap[child]
+      i = child
+    end
+    heap[i] = last
+    top
+  end
+  # :startdoc:
+end
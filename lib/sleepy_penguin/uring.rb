@@ -0,0 +1,15 @@
+class SleepyPenguin::Uring
+
+  # call-seq:
+  #     SleepyPenguin::Uring.poller([entries]) -> Uring or Epoll object
+  #
+  # Returns a new Uring object, or a new Epoll object if io_uring is
+  # unavailable because the kernel is too old or io_uring is disabled
+  # (e.g. via the kernel.io_uring_disabled sysctl or a seccomp filter).
+  # Both objects support the add, mod, del, wait, close and to_io methods.
+  def self.poller(entries = nil)
+    new(entries)
+  rescue Errno::ENOSYS, Errno::EPERM, Errno::EACCES, Errno::EINVAL
+    SleepyPenguin::Epoll.new
+  end
+end
@@ -0,0 +1,98 @@
+require 'test/unit'
+$-w = true
+require 'sleepy_penguin'
+
+class TestArena < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @rd, @wr = IO.pipe
+    @wr.write('.')
+    @ep = Epoll.new
+    @ep.add(@rd, Epoll::IN)
+  end
+
+  def teardown
+    [ @ep, @rd, @wr ].each { |io| io.close unless io.closed? }
+  end
+
+  def test_stats
+    @ep.wait(1, 0) { }
+    st = SleepyPenguin.arena_stats
+    [ :threads, :bytes, :peak_bytes, :grows, :trims ].each do |k|
+      assert_kind_of Integer, st[k], k.inspect
+    end
+    assert_operator st[:threads], :>=, 1
+    assert_operator st[:bytes], :>, 0
+    assert_operator st[:peak_bytes], :>=, st[:bytes]
+  end
+
+  def test_burst_trimmed
+    @ep.wait(8, 0) { }
+    small = SleepyPenguin.arena_stats[:bytes]
+    @ep.wait(65536, 0) { }
+    st = SleepyPenguin.arena_stats
+    assert_operator st[:bytes], :>=, 65536 * 12 # sizeof(epoll_event)
+    # one full decay period with the burst, and one without it
+    2048.times { @ep.wait(8, 0) { } }
+    after = SleepyPenguin.arena_stats
+    assert_operator after[:trims], :>, st[:trims]
+    assert_equal small, after[:bytes]
+  end
+
+  def test_thread_exit
+    before = SleepyPenguin.arena_stats
+    thr = Array.new(4) { Thread.new { @ep.wait(4096, 0) { } } }
+    thr.each(&:join)
+    after = SleepyPenguin.arena_stats
+    assert_operator after[:grows], :>=, before[:grows] + 4
+
+    # M:N threads leave their scratch memory to GC, whenever that runs
+    omit_if(ENV['RUBY_MN_THREADS'].to_i != 0, 'M:N threads')
+
+    # native threads may be reused or exit a bit after Thread#join
+    50.times do
+      break if after[:bytes] <= before[:bytes]
+      sleep 0.1
+      after = SleepyPenguin.arena_stats
+    end
+    assert_operator after[:bytes], :<=, before[:bytes]
+  end
+
+  def test_nested_wait
+    rd2, wr2 = IO.pipe
+    rd3, wr3 = IO.pipe
+    rd4, wr4 = IO.pipe
+    [ wr2, wr3, wr4 ].each { |w| w.write('.') }
+    @ep.add(rd2, Epoll::IN)
+    ep3 = Epoll.new
+    ep3.add(rd3, Epoll::IN)
+    ep3.add(rd4, Epoll::IN)
+    seen = []
+    @ep.wait(2, 0) do |_, io|
+      seen << io
+      next if seen.size > 1
+      assert_equal 2, ep3.wait(2, 0) { |_, nested| refute_same io, nested }
+      ep3.wait(65536, 0) { } # grows
+      2048.times { ep3.wait(8, 0) { } } # trims
+    end
+    assert_equal [ @rd, rd2 ].sort_by(&:fileno), seen.sort_by(&:fileno)
+    @ep.wait(1, 0) { } # reclaims memory the outer wait held
+  ensure
+    [ rd2, wr2, rd3, wr3, rd4, wr4, ep3 ].each { |io| io.close if io && !io.closed? }
+  end
+
+  def test_inotify_shared
+    require 'tempfile'
+    ino = Inotify.new
+    tmp = Tempfile.new('arena')
+    ino.add_watch(tmp.path, :OPEN)
+    before = SleepyPenguin.arena_stats[:grows]
+    File.open(tmp.path).close
+    assert_kind_of Inotify::Event, ino.take
+    assert_operator SleepyPenguin.arena_stats[:grows], :>, before
+  ensure
+    ino.close if ino
+    tmp.close! if tmp
+  end if defined?(SleepyPenguin::Inotify)
+end if defined?(SleepyPenguin::Epoll)
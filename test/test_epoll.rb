@@ -2,6 +2,10 @@ require 'test/unit'
 require 'fcntl'
 require 'socket'
 require 'thread'
+begin
+  require 'objspace'
+rescue LoadError
+end
 $-w = true
 Thread.abort_on_exception = true
 
@@ -17,7 +21,7 @@ class TestEpoll < Test::Unit::TestCase
 
   def test_constants
     Epoll.constants.each do |const|
-      next if const.to_sym == :IO
+      next if const.to_sym == :IO || const.to_sym == :Dispatcher
       nr = Epoll.const_get(const)
       assert nr <= 0xffffffff, "#{const}=#{nr}"
     end
@@ -514,6 +518,176 @@ class TestEpoll < Test::Unit::TestCase
     end
   end
 
+  def test_concurrent_add_del
+    pipes = (1..64).map { IO.pipe }
+    thr = pipes.each_slice(8).map do |slice|
+      Thread.new do
+        20.times do
+          slice.each { |r, _| @ep.add(r, Epoll::IN) }
+          slice.each { |r, _| assert_equal r, @ep.io_for(r) }
+          slice.each { |r, _| @ep.del(r) }
+        end
+        slice.each { |r, _| @ep.add(r, Epoll::IN) }
+      end
+    end
+    thr.each(&:join)
+    pipes.each do |r, w|
+      assert_equal r, @ep.io_for(r)
+      assert_equal Epoll::IN, @ep.events_for(r)
+    end
+  ensure
+    pipes.each { |pair| pair.each(&:close) }
+  end
+
+  def test_memsize_follows_live_fds
+    empty = ObjectSpace.memsize_of(@ep)
+    @ep.add(@rd, Epoll::IN)
+    full = ObjectSpace.memsize_of(@ep)
+    assert_operator full, :>, empty
+    @ep.del(@rd)
+    assert_operator ObjectSpace.memsize_of(@ep), :<, full
+  end if defined?(ObjectSpace.memsize_of)
+
+  def test_del_while_pinned
+    wmap = ObjectSpace::WeakMap.new
+    gen = nil
+    r = w = nil
+    Thread.new do
+      r, w = IO.pipe
+      wmap[r] = true
+      @ep.add(r, Epoll::IN)
+      gen = @ep.__pin
+      @ep.del(r)
+      r = nil
+    end.join
+    GC.start
+    assert_equal 1, wmap.keys.size, "retired IO survives while pinned"
+    @ep.__unpin(gen)
+  ensure
+    w.close if w
+  end if defined?(ObjectSpace::WeakMap)
+
+  def test_rearm
+    @ep.add(@wr, Epoll::OUT | Epoll::ONESHOT)
+    assert_equal 1, @ep.wait(1, 0) { |flags, obj| assert_equal @wr, obj }
+    assert_equal 0, @ep.wait(1, 0) { |flags, obj| flunk "not rearmed" }
+
+    assert_equal 0, @ep.rearm(@wr, Epoll::OUT | Epoll::ONESHOT)
+    assert_equal Epoll::OUT | Epoll::ONESHOT, @ep.events_for(@wr)
+    ary = []
+    assert_equal 1, @ep.wait_into(ary, 1, 0)
+    assert_equal [ Epoll::OUT, @wr ], ary
+
+    # rearm superseded by del before the flush
+    @ep.rearm(@wr, [ :OUT, :ONESHOT ])
+    @ep.del(@wr)
+    assert_equal 0, @ep.wait(1, 0) { |flags, obj| flunk "deleted" }
+
+    # rearm for an unregistered IO is dropped
+    @ep.rearm(@rd, Epoll::IN)
+    assert_equal 0, @ep.wait(1, 0) { |flags, obj| flunk "unregistered" }
+    assert ! @ep.include?(@rd)
+  end
+
+  def test_busy_poll_fork
+    assert_nil @ep.busy_poll
+    @ep.busy_poll = 100
+    assert_equal 100, @ep.busy_poll
+    rd, wr = IO.pipe
+    pid = fork do
+      rd.close
+      wr.syswrite(@ep.busy_poll.inspect)
+      exit!(0)
+    end
+    wr.close
+    assert_equal "100", rd.read
+    _, status = Process.waitpid2(pid)
+    assert status.success?
+    rd.close
+  end
+
+  def test_wait_until
+    @ep.add(@wr, Epoll::OUT)
+    tmp = []
+    deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + 1
+    @ep.wait_until(1, deadline) { |flags, obj| tmp << [ flags, obj ] }
+    assert_equal [[Epoll::OUT, @wr]], tmp
+  end
+
+  def test_exclusive
+    assert_raises(ArgumentError) do
+      @ep.add(@rd, Epoll::IN | Epoll::EXCLUSIVE | Epoll::ONESHOT)
+    end
+    assert ! @ep.include?(@rd)
+    assert_equal 0, @ep.add(@rd, [ :IN, :ET, :EXCLUSIVE ])
+    assert_equal Epoll::IN | Epoll::ET | Epoll::EXCLUSIVE, @ep.events_for(@rd)
+    assert_raises(ArgumentError) { @ep.mod(@rd, Epoll::IN) }
+    assert_raises(ArgumentError) { @ep.rearm(@rd, Epoll::IN) }
+    @ep.add(@wr, Epoll::OUT)
+    assert_raises(ArgumentError) { @ep.mod(@wr, [ :OUT, :EXCLUSIVE ]) }
+    @ep.del(@rd)
+    assert_equal 0, @ep.add(@rd, Epoll::IN)
+  end if defined?(SleepyPenguin::Epoll::EXCLUSIVE)
+
+  def test_exclusive_fork
+    @ep.add(@rd, Epoll::IN | Epoll::EXCLUSIVE)
+    @ep.add(@wr, Epoll::OUT)
+    @wr.syswrite '.' # children see it when re-adding @rd
+    res = (1..2).map do
+      rd, wr = IO.pipe
+      pid = fork do
+        rd.close
+        ok = @ep.include?(@rd) && ! @ep.include?(@wr)
+        ready = nil
+        @ep.wait(1, 1000) { |_, io| ready = io } if ok
+        wr.syswrite(ready == @rd ? "ok" : "fail")
+        exit!(0)
+      end
+      wr.close
+      [ pid, rd ]
+    end
+    res.each do |pid, rd|
+      assert_equal "ok", rd.read
+      _, status = Process.waitpid2(pid)
+      assert status.success?
+      rd.close
+    end
+  end if defined?(SleepyPenguin::Epoll::EXCLUSIVE)
+
+  def test_exclusive_fork_fd_reused
+    @ep.add(@rd, Epoll::IN | Epoll::EXCLUSIVE)
+    rd, wr = IO.pipe
+    pid = fork do
+      rd.close
+      fd = @rd.fileno
+      @rd.close
+      a, b = IO.pipe
+      a.fileno == fd or b.fileno == fd or exit!(2) # fd not reused, skip
+      b.syswrite('.')
+      ok = !@ep.include?(a) && !@ep.include?(b) &&
+           @ep.io_for(a).nil? &&
+           @ep.wait(1, 0) { |_, io| }.zero?
+      wr.syswrite(ok ? "ok" : "fail")
+      exit!(0)
+    end
+    wr.close
+    _, status = Process.waitpid2(pid)
+    status.exitstatus == 2 and omit 'descriptor was not reused'
+    assert_equal "ok", rd.read
+    assert status.success?
+  ensure
+    rd.close if rd
+  end if defined?(SleepyPenguin::Epoll::EXCLUSIVE)
+
+  def test_wait_into
+    ary = [ :garbage ]
+    assert_equal 0, @ep.wait_into(ary, 1, 0)
+    assert_equal [], ary
+    @ep.add(@wr, Epoll::OUT)
+    assert_equal 1, @ep.wait_into(ary)
+    assert_equal [Epoll::OUT, @wr], ary
+  end
+
   def test_epoll_as_queue
     fl = Epoll::OUT | Epoll::ET
     first = nil
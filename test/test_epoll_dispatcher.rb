@@ -0,0 +1,117 @@
+require 'test/unit'
+require 'thread'
+$-w = true
+Thread.abort_on_exception = true
+require 'sleepy_penguin'
+
+class TestEpollDispatcher < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @pipes = []
+    @dispatcher = nil
+  end
+
+  def teardown
+    if @dispatcher
+      @dispatcher.stop
+      @dispatcher.join
+    end
+    @pipes.flatten.each { |io| io.close unless io.closed? }
+  end
+
+  def pipe
+    @pipes << IO.pipe
+    @pipes[-1]
+  end
+
+  def test_rearm
+    q = Queue.new
+    @dispatcher = Epoll::Dispatcher.new(2) do |events, io|
+      q << [ events, io.read_nonblock(16) ]
+    end
+    rd, wr = pipe
+    @dispatcher.add(rd, :IN)
+    assert_equal Epoll::IN | Epoll::ONESHOT, @dispatcher.epoll.events_for(rd)
+    @dispatcher.start
+    3.times do |i|
+      wr.syswrite(i.to_s)
+      assert_equal [ Epoll::IN, i.to_s ], q.pop
+    end
+  end
+
+  def test_del_in_handler
+    q = Queue.new
+    @dispatcher = Epoll::Dispatcher.new(1) do |events, io|
+      @dispatcher.del(io)
+      q << io.read_nonblock(16)
+    end
+    rd, wr = pipe
+    @dispatcher.add(rd, Epoll::IN)
+    @dispatcher.start
+    wr.syswrite('a')
+    assert_equal 'a', q.pop
+    wr.syswrite('b')
+    sleep 0.05
+    assert q.empty?
+    assert ! @dispatcher.epoll.include?(rd)
+  end
+
+  def test_handoff
+    q = Queue.new
+    slow = nil
+    @dispatcher = Epoll::Dispatcher.new(2, :maxevents => 64,
+                                           :handoff => 0.01) do |events, io|
+      io.read_nonblock(16)
+      slow ||= io
+      sleep 0.1 if slow == io
+      q << [ io, Thread.current ]
+    end
+    pipes = (1..4).map { pipe }
+    pipes.each { |rd, _| @dispatcher.add(rd, Epoll::IN) }
+    pipes.each { |_, wr| wr.syswrite('.') }
+    @dispatcher.start
+    res = (1..4).map { q.pop }
+    assert_equal pipes.map { |rd, _| rd }.sort_by(&:fileno),
+                 res.map { |io, _| io }.sort_by(&:fileno)
+    assert_equal 2, res.map { |_, thr| thr }.uniq.size
+  end
+
+  def test_rearm_before_batch_ends
+    q = Queue.new
+    again = Queue.new
+    first = nil
+    pipes = (1..2).map { pipe }
+    @dispatcher = Epoll::Dispatcher.new(2, :maxevents => 64,
+                                           :handoff => 10) do |events, io|
+      io.read_nonblock(16)
+      if first.nil?
+        first = io
+      elsif io == first
+        again << io
+      else
+        # another thread must get first while this one is busy
+        pipes.assoc(first)[1].syswrite('.')
+        q << again.pop(timeout: 5)
+      end
+    end
+    pipes.each { |rd, _| @dispatcher.add(rd, Epoll::IN) }
+    pipes.each { |_, wr| wr.syswrite('.') }
+    @dispatcher.start
+    got = q.pop
+    assert_same first, got
+  end
+
+  def test_stop
+    @dispatcher = Epoll::Dispatcher.new(3) { |events, io| }
+    @dispatcher.start
+    assert_raises(ArgumentError) { @dispatcher.start }
+    assert_equal @dispatcher, @dispatcher.stop
+    assert_equal @dispatcher, @dispatcher.join
+    @dispatcher = nil
+  end
+
+  def test_no_block
+    assert_raises(ArgumentError) { Epoll::Dispatcher.new(1) }
+  end
+end if defined?(SleepyPenguin::Epoll)
@@ -21,6 +21,177 @@ class TestEpollIO < Test::Unit::TestCase
     assert_equal([[Epoll::OUT, @wr]], ev)
   end
 
+  def test_add_wait_into
+    ary = []
+    assert_equal 0, @epio.epoll_wait_into(ary, 64, 0)
+    assert_equal [], ary
+    @epio.epoll_ctl(Epoll::CTL_ADD, @wr, Epoll::OUT)
+    @epio.epoll_ctl(Epoll::CTL_ADD, @rd, Epoll::IN)
+    assert_equal 1, @epio.epoll_wait_into(ary)
+    assert_equal([Epoll::OUT, @wr], ary)
+    @wr.syswrite('.')
+    assert_equal 2, @epio.epoll_wait_into(ary, 64, 0)
+    assert_equal 4, ary.size
+    assert_equal [@rd, @wr], [ary[1], ary[3]].sort_by(&:fileno)
+    @rd.sysread(1)
+    assert_equal 1, @epio.epoll_wait_into(ary, 64, 0)
+    assert_equal([Epoll::OUT, @wr], ary)
+    assert_raises(TypeError) { @epio.epoll_wait_into(nil, 1, 0) }
+    frozen_error = defined?(FrozenError) ? FrozenError : RuntimeError
+    assert_raises(frozen_error) { @epio.epoll_wait_into([].freeze, 1, 0) }
+  end
+
+  def test_token
+    token = 0x3fffffff_ffffffff
+    @epio.epoll_ctl(Epoll::CTL_ADD, @wr, Epoll::OUT, token)
+    @epio.epoll_ctl(Epoll::CTL_ADD, @rd.fileno, Epoll::IN)
+    ev = []
+    @epio.epoll_wait { |events, obj| ev << [ events, obj ] }
+    assert_equal([[Epoll::OUT, token]], ev)
+
+    @wr.syswrite('.')
+    ary = []
+    assert_equal 2, @epio.epoll_wait_into(ary, 2, 0)
+    assert_equal [@rd.fileno, token], [ary[1], ary[3]].sort
+
+    @epio.epoll_ctl(Epoll::CTL_MOD, @wr, Epoll::OUT, -1)
+    ev.clear
+    @epio.epoll_wait(1) { |events, obj| ev << obj }
+    assert_kind_of Integer, ev[0]
+    @epio.epoll_ctl(Epoll::CTL_DEL, @rd, 0)
+    @epio.epoll_wait(1, 0) { |_, obj| assert_equal(-1, obj) }
+
+    assert_raises(RangeError) do
+      @epio.epoll_ctl(Epoll::CTL_MOD, @wr, Epoll::OUT, 2 ** 64)
+    end
+    assert_raises(TypeError) do
+      @epio.epoll_ctl(Epoll::CTL_MOD, @wr, Epoll::OUT, "1")
+    end
+  end
+
+  def test_token_compact
+    @epio.epoll_ctl(Epoll::CTL_ADD, @wr, Epoll::OUT, 42)
+    GC.compact
+    ev = []
+    @epio.epoll_wait { |events, obj| ev << [ events, obj ] }
+    assert_equal([[Epoll::OUT, 42]], ev)
+  end if GC.respond_to?(:compact)
+
+  def test_epoll_ctl_batch
+    ops = [
+      [ Epoll::CTL_ADD, @rd, Epoll::IN ],
+      [ Epoll::CTL_ADD, @wr, Epoll::OUT, 7 ],
+    ]
+    assert_nil @epio.epoll_ctl_batch(ops)
+    ev = []
+    @epio.epoll_wait { |events, obj| ev << [ events, obj ] }
+    assert_equal([[Epoll::OUT, 7]], ev)
+
+    ops = [
+      [ Epoll::CTL_ADD, @rd, Epoll::IN ],
+      [ Epoll::CTL_DEL, @wr, 0 ],
+      [ Epoll::CTL_MOD, @wr, Epoll::OUT ],
+    ]
+    res = @epio.epoll_ctl_batch(ops)
+    assert_equal 3, res.size
+    assert_kind_of Errno::EEXIST, res[0]
+    assert_nil res[1]
+    assert_kind_of Errno::ENOENT, res[2]
+    assert_equal 0, @epio.epoll_wait(64, 0) { |*_| flunk "no events" }
+
+    assert_raises(ArgumentError) { @epio.epoll_ctl_batch([[Epoll::CTL_ADD]]) }
+    assert_raises(TypeError) { @epio.epoll_ctl_batch([nil]) }
+    assert_nil @epio.epoll_ctl_batch([])
+  end
+
+  def clock_ns
+    Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+  end
+
+  def test_fractional_timeout
+    [ 0.25, Rational(1, 4) ].each do |timeout|
+      t0 = clock_ns
+      assert_equal 0, @epio.epoll_wait(1, timeout) { flunk "no events" }
+      assert_operator clock_ns - t0, :>=, 250_000
+    end
+    assert_equal 0, @epio.epoll_wait(1, 0.0) { flunk "no events" }
+    assert_raises(TypeError) { @epio.epoll_wait(1, "1") { } }
+  end
+
+  def test_wait_until
+    deadline = clock_ns + 5_000_000
+    assert_equal 0, @epio.epoll_wait_until(1, deadline) { flunk "no events" }
+    assert_operator clock_ns, :>=, deadline
+
+    deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + 0.005
+    assert_equal 0, @epio.epoll_wait_until(1, deadline) { flunk "no events" }
+    assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC), :>=,
+                    deadline
+
+    @epio.epoll_ctl(Epoll::CTL_ADD, @wr, Epoll::OUT)
+    ev = []
+    @epio.epoll_wait_until(1, 0) { |events, obj| ev << [ events, obj ] }
+    assert_equal([[Epoll::OUT, @wr]], ev)
+  end
+
+  def test_epoll_pwait
+    @epio.epoll_ctl(Epoll::CTL_ADD, @wr, Epoll::OUT)
+    ev = []
+    @epio.epoll_pwait(1, 0, [ :USR1, "USR2" ]) do |events, obj|
+      ev << [ events, obj ]
+    end
+    assert_equal([[Epoll::OUT, @wr]], ev)
+    assert_raises(ArgumentError) { @epio.epoll_pwait(1, 0, :BOGUS) { } }
+  end
+
+  def test_busy_poll
+    assert_nil @epio.busy_poll
+    @epio.busy_poll = 200
+    assert_equal 200, @epio.busy_poll
+    assert_equal [], @epio.instance_variables
+    assert_raises(ArgumentError) { @epio.busy_poll = -1 }
+
+    @epio.epoll_ctl(Epoll::CTL_ADD, @rd, Epoll::IN)
+    thr = Thread.new do
+      5.times { sleep 0.0001; @wr.syswrite('.') }
+    end
+    5.times do
+      assert_equal 1, @epio.epoll_wait(1, 1000) { |_, io| io.read_nonblock(9) }
+    end
+    thr.join
+
+    # spinning must not delay timeouts
+    t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    assert_equal 0, @epio.epoll_wait(1, 10) { }
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+    assert_operator elapsed, :>=, 0.01
+    assert_operator elapsed, :<, 1
+
+    @epio.busy_poll = nil
+    assert_nil @epio.busy_poll
+  end
+
+  def test_busy_poll_params
+    begin
+      params = @epio.busy_poll_params
+    rescue Errno::ENOTTY
+      return
+    end
+    assert_equal({ :busy_poll_usecs => 0, :busy_poll_budget => 0,
+                   :prefer_busy_poll => false }, params)
+    @epio.busy_poll_params = { :busy_poll_usecs => 20,
+                               :prefer_busy_poll => true }
+    params = @epio.busy_poll_params
+    assert_equal 20, params[:busy_poll_usecs]
+    assert_equal true, params[:prefer_busy_poll]
+    @epio.busy_poll_params = { :busy_poll_budget => 8 }
+    assert_equal({ :busy_poll_usecs => 20, :busy_poll_budget => 8,
+                   :prefer_busy_poll => true }, @epio.busy_poll_params)
+    assert_raises(RangeError) do
+      @epio.busy_poll_params = { :busy_poll_budget => 0x10000 }
+    end
+  end
+
   class EpSub < Epoll::IO
     def self.new
       super(SleepyPenguin::Epoll::CLOEXEC)
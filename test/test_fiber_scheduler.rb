@@ -0,0 +1,302 @@
+require 'test/unit'
+$-w = true
+require 'sleepy_penguin'
+require 'timeout'
+
+class TestFiberScheduler < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    Fiber.respond_to?(:set_scheduler) or
+      omit 'Fiber::Scheduler needs Ruby 3.0+'
+  end
+
+  def now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  # the scheduler runs all fibers to completion when the thread exits
+  def scheduled
+    sched = nil
+    Thread.new do
+      sched = FiberScheduler.new
+      Fiber.set_scheduler(sched)
+      yield sched
+    end.join
+    sched
+  end
+
+  def test_io_wait
+    got = nil
+    rd, wr = IO.pipe
+    scheduled do
+      Fiber.schedule { got = rd.read(5) }
+      Fiber.schedule { sleep 0.01; wr.write('hello') }
+    end
+    assert_equal 'hello', got
+  ensure
+    [ rd, wr ].each(&:close)
+  end
+
+  def test_io_wait_timeout
+    got = :unset
+    rd, wr = IO.pipe
+    t0 = now
+    scheduled do
+      Fiber.schedule { got = rd.wait_readable(0.05) }
+    end
+    assert_nil got
+    assert_operator now - t0, :>=, 0.05
+
+    # the cancelled registration must not confuse the next waiter
+    scheduled do
+      Fiber.schedule { got = rd.read(1) }
+      Fiber.schedule { wr.write('.') }
+    end
+    assert_equal '.', got
+  ensure
+    [ rd, wr ].each(&:close)
+  end
+
+  def test_reader_and_writer_on_one_socket
+    require 'socket'
+    a, b = UNIXSocket.pair
+    got = []
+    big = 'x' * 1024 * 1024
+    scheduled do
+      Fiber.schedule { a.write(big); got << :written }
+      Fiber.schedule { got << a.read(3) }
+      Fiber.schedule { got << b.read(big.size).size; b.write('bye') }
+    end
+    assert_equal [ 'bye', :written, big.size ].sort_by(&:to_s),
+                 got.sort_by(&:to_s)
+  ensure
+    [ a, b ].each(&:close)
+  end
+
+  # busy-waits without letting other fibers run
+  def hog(seconds)
+    t0 = now
+    nil while now - t0 < seconds
+  end
+
+  def test_io_wait_timeout_and_ready_at_once
+    rd, wr = IO.pipe
+    slept = nil
+    scheduled do
+      Fiber.schedule do
+        rd.wait_readable(0.01)
+        t0 = now
+        sleep 0.2
+        slept = now - t0
+      end
+      Fiber.schedule { hog(0.05); wr.write('.') }
+    end
+    assert_operator slept, :>=, 0.2
+  ensure
+    [ rd, wr ].each(&:close)
+  end
+
+  def test_unblock_and_timeout_at_once
+    q = Queue.new
+    slept = nil
+    scheduled do
+      Fiber.schedule do
+        q.pop(timeout: 0.01)
+        t0 = now
+        sleep 0.2
+        slept = now - t0
+      end
+      Fiber.schedule { hog(0.05); q << 1 }
+    end
+    assert_operator slept, :>=, 0.2
+  end
+
+  def test_sleep_concurrently
+    t0 = now
+    scheduled do
+      50.times { Fiber.schedule { sleep 0.1 } }
+    end
+    elapsed = now - t0
+    assert_operator elapsed, :>=, 0.1
+    assert_operator elapsed, :<, 1.0
+  end
+
+  def test_timers_in_order
+    woke = []
+    scheduled do
+      [ 0.05, 0.01, 0.03, 0.02, 0.04 ].each do |t|
+        Fiber.schedule { sleep t; woke << t }
+      end
+    end
+    assert_equal [ 0.01, 0.02, 0.03, 0.04, 0.05 ], woke
+  end
+
+  def test_block_unblock_same_thread
+    q = Queue.new
+    got = nil
+    scheduled do
+      Fiber.schedule { got = q.pop }
+      Fiber.schedule { q << :x }
+    end
+    assert_equal :x, got
+  end
+
+  def test_unblock_from_other_thread
+    q = Queue.new
+    got = nil
+    scheduled do
+      Fiber.schedule { got = q.pop }
+      Thread.new { sleep 0.01; q << :y }
+    end
+    assert_equal :y, got
+  end
+
+  def test_block_timeout
+    q = Queue.new
+    got = :unset
+    scheduled do
+      Fiber.schedule { got = q.pop(timeout: 0.02) }
+    end
+    assert_nil got
+  end
+
+  def test_mutex
+    m = Mutex.new
+    order = []
+    scheduled do
+      3.times do |i|
+        Fiber.schedule { m.synchronize { order << i; sleep 0.01 } }
+      end
+    end
+    assert_equal [ 0, 1, 2 ], order
+  end
+
+  def test_timeout_after
+    err = nil
+    scheduled do
+      Fiber.schedule do
+        begin
+          Timeout.timeout(0.02) { sleep 10 }
+        rescue Timeout::Error => e
+          err = e
+        end
+      end
+    end
+    assert_kind_of Timeout::Error, err
+  end
+
+  def test_timeout_not_reached
+    got = nil
+    scheduled do
+      Fiber.schedule { got = Timeout.timeout(10) { sleep 0.01; :ok } }
+    end
+    assert_equal :ok, got
+  end
+
+  def test_process_wait
+    status = nil
+    scheduled do
+      Fiber.schedule do
+        pid = spawn('exit 3')
+        status = Process.wait2(pid)[1]
+      end
+    end
+    assert_equal 3, status.exitstatus
+  end
+
+  def test_epoll_wait
+    rd, wr = IO.pipe
+    ep = Epoll.new
+    ep.add(rd, Epoll::IN)
+    got = []
+    scheduled do
+      Fiber.schedule do
+        ep.wait(1) { |_, io| got << io }
+        got << Thread.current.keys # scratch memory is hidden
+      end
+      Fiber.schedule { got << :write; wr.write('.') }
+    end
+    assert_equal [ :write, rd, [] ], got
+  ensure
+    [ ep, rd, wr ].each { |io| io.close if io }
+  end
+
+  def test_epoll_wait_timeout
+    ep = Epoll.new
+    n = nil
+    ticks = 0
+    scheduled do
+      Fiber.schedule { n = ep.wait(1, 50) { } }
+      Fiber.schedule { 3.times { sleep 0.01; ticks += 1 } }
+    end
+    assert_equal 0, n
+    assert_equal 3, ticks
+  ensure
+    ep.close if ep
+  end
+
+  def test_eventfd_value
+    efd = EventFD.new(0)
+    got = []
+    scheduled do
+      Fiber.schedule { got << efd.value }
+      Fiber.schedule { got << :incr; efd.incr(5) }
+    end
+    assert_equal [ :incr, 5 ], got
+  ensure
+    efd.close if efd
+  end
+
+  def test_timerfd_expirations
+    tfds = Array.new(20) { TimerFD.new }
+    got = []
+    ticks = 0
+    t0 = now
+    scheduled do
+      tfds.each do |tfd|
+        Fiber.schedule do
+          tfd.settime(nil, 0, 0.05)
+          got << tfd.expirations
+        end
+      end
+      Fiber.schedule { 3.times { sleep 0.01; ticks += 1 } }
+    end
+    assert_equal [ 1 ] * tfds.size, got
+    assert_equal 3, ticks
+    assert_operator now - t0, :<, 1.0
+  ensure
+    tfds.each(&:close) if tfds
+  end
+
+  def test_inotify_take
+    require 'tmpdir'
+    Dir.mktmpdir do |dir|
+      ino = Inotify.new
+      ino.add_watch(dir, :CREATE)
+      got = []
+      scheduled do
+        Fiber.schedule { got << ino.take.name }
+        Fiber.schedule { got << :touch; File.open("#{dir}/a", 'w').close }
+      end
+      assert_equal [ :touch, 'a' ], got
+      ino.close
+    end
+  end
+
+  def test_close
+    sched = scheduled { }
+    assert_predicate sched, :closed?
+    sched.close # idempotent
+  end
+
+  def test_one_timerfd
+    sched = scheduled do |s|
+      100.times { |i| Fiber.schedule { sleep(0.001 * (i % 10)) } }
+    end
+    fds = sched.instance_variables.map do |ivar|
+      sched.instance_variable_get(ivar)
+    end.grep(TimerFD)
+    assert_equal 1, fds.size
+  end
+end
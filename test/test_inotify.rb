@@ -2,6 +2,7 @@ require 'test/unit'
 require 'fcntl'
 require 'tempfile'
 require 'set'
+require 'tmpdir'
 $-w = true
 require 'sleepy_penguin'
 
@@ -27,7 +28,7 @@ class TestInotify < Test::Unit::TestCase
   def test_constants
     (Inotify.constants - IO.constants).each do |const|
       case const.to_sym
-      when :Event, :Enumerator
+      when :Event, :Enumerator, :Tree
       else
         nr = Inotify.const_get(const)
         assert nr <= 0xffffffff, "#{const}=#{nr}"
@@ -70,6 +71,123 @@ class TestInotify < Test::Unit::TestCase
     assert_nil ino.take(true)
   end
 
+  def test_take_all
+    ino = Inotify.new :CLOEXEC
+    Dir.mktmpdir do |dir|
+      wd = ino.add_watch(dir, :CREATE)
+      names = (0...1000).map { |i| "#{i}" * 20 }
+      names.each { |name| File.open("#{dir}/#{name}", 'w').close }
+      got = []
+      while got.size < names.size
+        events = ino.take_all
+        assert_kind_of Array, events
+        got.concat(events)
+      end
+      assert_equal names, got.map(&:name)
+      assert_equal [ wd ], got.map(&:wd).uniq
+      assert_nil ino.take_all(nil, true)
+    end
+  end
+
+  def test_take_all_max_bytes
+    ino = Inotify.new :CLOEXEC
+    Dir.mktmpdir do |dir|
+      ino.add_watch(dir, :CREATE)
+      10.times { |i| File.open("#{dir}/#{i}", 'w').close }
+      first = ino.take_all(1)
+      assert_operator first.size, :>=, 1
+      assert_operator first.size, :<, 10
+      rest = ino.take_all(nil, true)
+      assert_equal (0...10).map(&:to_s), (first + rest).map(&:name)
+    end
+  end
+
+  def test_take_all_after_take
+    ino = Inotify.new :CLOEXEC
+    Dir.mktmpdir do |dir|
+      ino.add_watch(dir, :CREATE)
+      3.times { |i| File.open("#{dir}/#{i}", 'w').close }
+      assert_equal '0', ino.take.name
+      assert_equal %w(1 2), ino.take_all.map(&:name)
+      assert_nil ino.take(true)
+    end
+  end
+
+  def test_each_batch
+    ino = Inotify.new :CLOEXEC
+    Dir.mktmpdir do |dir|
+      ino.add_watch(dir, :CREATE)
+      File.open("#{dir}/a", 'w').close
+      ino.each_batch do |events|
+        assert_equal %w(a), events.map(&:name)
+        break
+      end
+    end
+  end
+
+  def test_each_raw
+    ino = Inotify.new :CLOEXEC
+    Dir.mktmpdir do |dir|
+      wd = ino.add_watch(dir, [ :CREATE, :DELETE ])
+      path = "#{dir}/index.lock"
+      100.times { File.open(path, 'w').close; File.unlink(path) }
+      got = Array.new(200)
+      i = 0
+      before = GC.stat(:total_allocated_objects)
+      ino.each_raw(nil, true) do |wd_, mask, cookie, name|
+        got[i] = [ wd_, mask, cookie, name ]
+        i += 1
+      end
+      allocated = GC.stat(:total_allocated_objects) - before
+      assert_equal 200, i
+      assert_operator allocated, :<, 200 + 20 # only our own Arrays
+      got.each_slice(2) do |(c, d)|
+        assert_equal [ wd, Inotify::CREATE, 0, 'index.lock' ], c
+        assert_equal [ wd, Inotify::DELETE, 0, 'index.lock' ], d
+      end
+      names = got.map(&:last)
+      assert names.all?(&:frozen?)
+      assert_same ino, ino.each_raw(nil, true) { flunk 'no more events' }
+      if RUBY_VERSION.to_f >= 3.0
+        assert_equal 1, names.map(&:object_id).uniq.size
+      end
+
+      path = "#{dir}/f"
+      File.open(path, 'w').close
+      wd = ino.add_watch(path, :ATTRIB)
+      File.chmod(0600, path)
+      raw = []
+      ino.each_raw(nil, true) { |*args| raw << args }
+      assert_equal [ wd, Inotify::ATTRIB, 0, nil ], raw[-1]
+    end
+  end
+
+  def test_each_raw_break
+    ino = Inotify.new :CLOEXEC
+    Dir.mktmpdir do |dir|
+      ino.add_watch(dir, :CREATE)
+      File.open("#{dir}/a", 'w').close
+      File.open("#{dir}/b", 'w').close
+      got = ino.each_raw { |_, _, _, name| break name }
+      assert_equal 'a', got
+    end
+  end
+
+  def test_each_raw_after_take
+    ino = Inotify.new :CLOEXEC
+    Dir.mktmpdir do |dir|
+      wd = ino.add_watch(dir, :CREATE)
+      %w(a b c).each { |f| File.open("#{dir}/#{f}", 'w').close }
+      assert_equal 'a', ino.take.name
+      got = []
+      ino.each_raw(nil, true) { |*ev| got << ev }
+      assert_equal [ [ wd, Inotify::CREATE, 0, 'b' ],
+                     [ wd, Inotify::CREATE, 0, 'c' ] ], got
+      assert got.all? { |ev| ev[3].frozen? }
+      assert_nil ino.take(true)
+    end
+  end
+
   def test_add_take_symbols
     ino = Inotify.new :CLOEXEC
     tmp1 = Tempfile.new 'take'
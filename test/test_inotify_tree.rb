@@ -0,0 +1,164 @@
+require 'test/unit'
+require 'tmpdir'
+require 'fileutils'
+$-w = true
+require 'sleepy_penguin'
+
+class TestInotifyTree < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @dir = Dir.mktmpdir
+    @tree = Inotify::Tree.new
+    %w(a/b/c d).each { |sub| FileUtils.mkdir_p("#@dir/#{sub}") }
+  end
+
+  def teardown
+    @tree.close unless @tree.closed?
+    FileUtils.rm_rf(@dir)
+  end
+
+  def take
+    @tree.take_all(nil, true) || []
+  end
+
+  def test_add
+    assert_equal 5, @tree.add(@dir, [ :CREATE, :DELETE ])
+    assert_equal 5, @tree.size
+    assert_equal 0, @tree.add(@dir, :CREATE), 'already watched'
+    assert_equal 5, @tree.size
+    assert_nil @tree.take_all(nil, true)
+  end
+
+  def test_add_missing
+    assert_raise(Errno::ENOENT) { @tree.add("#@dir/missing", :CREATE) }
+    File.open(file = "#@dir/file", 'w').close
+    assert_raise(Errno::ENOTDIR) { @tree.add(file, :CREATE) }
+    assert_equal 0, @tree.size
+  end
+
+  def test_full_paths
+    @tree.add("#@dir/", [ :CREATE, :DELETE ])
+    File.open("#@dir/a/b/c/f", 'w').close
+    File.unlink("#@dir/a/b/c/f")
+    got = take
+    assert_equal [ "#@dir/a/b/c/f" ] * 2, got.map(&:path)
+    assert_equal [ [ :CREATE ], [ :DELETE ] ], got.map(&:events)
+    assert_kind_of Inotify::Tree::Event, got[0]
+    assert_nil got[0].from
+  end
+
+  def test_new_directories
+    @tree.add(@dir, :CREATE)
+    FileUtils.mkdir_p("#@dir/d/e/f")
+    got = take
+    assert_equal "#@dir/d/e", got[0].path
+    assert_equal [ :CREATE, :ISDIR ], got[0].events
+    assert_equal 7, @tree.size
+
+    File.open("#@dir/d/e/f/g", 'w').close
+    assert_equal [ "#@dir/d/e/f/g" ], take.map(&:path)
+  end
+
+  def test_new_directory_unwatchable
+    deep = "#@dir/d"
+    deep << "/#{'x' * 200}" while deep.size < 3900
+    FileUtils.mkdir_p(deep)
+    @tree.add(@dir, :CREATE)
+    long = 'y' * (4100 - deep.size)
+    Dir.chdir(deep) { Dir.mkdir(long) } # too long for inotify_add_watch
+    File.open("#@dir/after", 'w').close
+    got = take
+    assert_equal [ [ :CREATE, :ISDIR ], [ :Q_OVERFLOW, :ISDIR ],
+                   [ :CREATE ] ], got.map(&:events)
+    assert_equal [ "#{deep}/#{long}" ] * 2 + [ "#@dir/after" ],
+                 got.map(&:path)
+  end
+
+  def test_rename_file
+    @tree.add(@dir, :MOVE)
+    File.open("#@dir/a/x", 'w').close
+    File.rename("#@dir/a/x", "#@dir/d/y")
+    got = take
+    assert_equal 1, got.size
+    assert_equal [ :MOVED_FROM, :MOVED_TO ], got[0].events
+    assert_equal "#@dir/d/y", got[0].path
+    assert_equal "#@dir/a/x", got[0].from
+  end
+
+  def test_rename_directory
+    @tree.add(@dir, [ :CREATE, :MOVE ])
+    File.rename("#@dir/a", "#@dir/d/z")
+    got = take
+    assert_equal 1, got.size
+    assert_equal [ :MOVED_FROM, :MOVED_TO, :ISDIR ], got[0].events
+    assert_equal [ "#@dir/d/z", "#@dir/a" ], [ got[0].path, got[0].from ]
+    assert_equal 5, @tree.size
+
+    File.open("#@dir/d/z/b/c/f", 'w').close
+    assert_equal [ "#@dir/d/z/b/c/f" ], take.map(&:path)
+  end
+
+  def test_move_out
+    out = Dir.mktmpdir
+    @tree.add(@dir, [ :CREATE, :MOVE ])
+    File.rename("#@dir/a", "#{out}/a")
+    got = take
+    assert_equal 1, got.size
+    assert_equal [ :MOVED_FROM, :ISDIR ], got[0].events
+    assert_equal [ "#@dir/a", nil ], [ got[0].path, got[0].from ]
+
+    File.open("#{out}/a/b/f", 'w').close
+    assert_equal [], take
+    assert_equal 2, @tree.size
+  ensure
+    FileUtils.rm_rf(out)
+  end
+
+  def test_move_in
+    out = Dir.mktmpdir
+    FileUtils.mkdir_p("#{out}/m/n")
+    @tree.add(@dir, [ :CREATE, :MOVE ])
+    File.rename("#{out}/m", "#@dir/m")
+    got = take
+    assert_equal [ [ :MOVED_TO, :ISDIR ] ], got.map(&:events)
+    assert_equal 7, @tree.size
+    File.open("#@dir/m/n/f", 'w').close
+    assert_equal [ "#@dir/m/n/f" ], take.map(&:path)
+  ensure
+    FileUtils.rm_rf(out)
+  end
+
+  def test_delete_directory
+    @tree.add(@dir, :DELETE)
+    FileUtils.rm_rf("#@dir/a")
+    got = take
+    assert_equal "#@dir/a", got[-1].path
+    assert_equal [ :DELETE, :ISDIR ], got[-1].events
+    assert_equal 2, @tree.size
+  end
+
+  def test_blocking
+    @tree.add(@dir, :CREATE)
+    thr = Thread.new { @tree.take_all }
+    sleep 0.05
+    assert thr.alive?
+    File.open("#@dir/d/f", 'w').close
+    assert_equal [ "#@dir/d/f" ], thr.value.map(&:path)
+  end
+
+  def test_to_io
+    @tree.add(@dir, :CREATE)
+    assert_kind_of Inotify, @tree.to_io
+    assert_nil IO.select([ @tree ], nil, nil, 0)
+    File.open("#@dir/f", 'w').close
+    assert_equal [ [ @tree ], [], [] ], IO.select([ @tree ], nil, nil, 1)
+  end
+
+  def test_close
+    @tree.add(@dir, :CREATE)
+    @tree.close
+    assert_predicate @tree, :closed?
+    assert_equal 0, @tree.size
+  end
+end if defined?(SleepyPenguin::Inotify::Tree)
@@ -0,0 +1,125 @@
+require 'test/unit'
+$-w = true
+require 'sleepy_penguin'
+require 'rbconfig'
+
+# Ruby 3.3+ multiplexes Ruby threads over fewer native threads with
+# RUBY_MN_THREADS=1, waiting must not pin one native thread per waiter
+class TestMNThreads < Test::Unit::TestCase
+  NR = 64
+
+  def setup
+    RUBY_VERSION.to_f >= 3.3 or omit 'M:N threads need Ruby 3.3+'
+    File.directory?('/proc/self/task') or omit '/proc/self/task missing'
+  end
+
+  # runs +code+ with RUBY_MN_THREADS=1 and returns the native thread count
+  # it prints while NR threads are waiting
+  def native_threads(code)
+    script = <<-EOS
+      require 'sleepy_penguin'
+      include SleepyPenguin
+      n = #{NR}
+      #{code}
+      sleep 0.5
+      $stdout.puts(Dir['/proc/self/task/*'].size)
+      $stdout.flush
+      wake.call
+      thr.each(&:join)
+    EOS
+    rd, wr = IO.pipe
+    pid = spawn({ 'RUBY_MN_THREADS' => '1' }, RbConfig.ruby,
+                *$LOAD_PATH.map { |dir| "-I#{dir}" }, '-e', script,
+                out: wr)
+    wr.close
+    tasks = rd.read.to_i
+    _, status = Process.waitpid2(pid)
+    assert_predicate status, :success?
+    tasks
+  ensure
+    rd.close if rd
+  end
+
+  def test_epoll_wait
+    tasks = native_threads(<<-EOS)
+      pipes = Array.new(n) { IO.pipe }
+      thr = pipes.map do |rd, _|
+        ep = Epoll.new
+        ep.add(rd, Epoll::IN)
+        Thread.new { ep.wait(1, 10_000) { } }
+      end
+      wake = lambda { pipes.each { |_, wr| wr.write('.') } }
+    EOS
+    assert_operator tasks, :<, NR / 2
+  end
+
+  def test_epoll_io_wait_timeout
+    t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    tasks = native_threads(<<-EOS)
+      thr = Array.new(n) do
+        Thread.new do
+          epio = Epoll::IO.new(nil)
+          epio.epoll_wait(1, 700) { }
+          epio.close
+        end
+      end
+      wake = lambda {}
+    EOS
+    assert_operator tasks, :<, NR / 2
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+    assert_operator elapsed, :>=, 0.7
+  end
+
+  def test_eventfd_value
+    tasks = native_threads(<<-EOS)
+      efds = Array.new(n) { EventFD.new(0) }
+      thr = efds.map { |efd| Thread.new { efd.value } }
+      wake = lambda { efds.each { |efd| efd.incr(1) } }
+    EOS
+    assert_operator tasks, :<, NR / 2
+  end
+
+  def test_timerfd_expirations
+    tasks = native_threads(<<-EOS)
+      tfds = Array.new(n) { TimerFD.new }
+      thr = tfds.map do |tfd|
+        tfd.settime(nil, 0, 0.6)
+        Thread.new { tfd.expirations }
+      end
+      wake = lambda {}
+    EOS
+    assert_operator tasks, :<, NR / 2
+  end
+
+  def test_inotify_take
+    require 'tmpdir'
+    Dir.mktmpdir do |dir|
+      tasks = native_threads(<<-EOS)
+        inos = Array.new(n) do
+          ino = Inotify.new
+          ino.add_watch(#{dir.dump}, :CREATE)
+          ino
+        end
+        thr = inos.map { |ino| Thread.new { ino.take } }
+        wake = lambda { File.open(#{dir.dump} + '/x', 'w').close }
+      EOS
+      assert_operator tasks, :<, NR / 2
+    end
+  end if defined?(SleepyPenguin::Inotify)
+
+  # scratch memory must not be reachable (or inspectable) from Ruby
+  def test_arena_hidden
+    script = <<-EOS
+      require 'sleepy_penguin'
+      Thread.new do
+        SleepyPenguin::Epoll.new.wait(1, 0) { }
+        Thread.current.keys.empty? or abort Thread.current.keys.inspect
+        Fiber.current.instance_variables.empty? or abort 'ivars'
+      end.join
+    EOS
+    pid = spawn({ 'RUBY_MN_THREADS' => '1' }, RbConfig.ruby,
+                *$LOAD_PATH.map { |dir| "-I#{dir}" }, '-e', script)
+    _, status = Process.waitpid2(pid)
+    assert_predicate status, :success?
+  end
+end
@@ -0,0 +1,78 @@
+require 'test/unit'
+$-w = true
+require 'sleepy_penguin'
+
+class TestRactor < Test::Unit::TestCase
+  def setup
+    @experimental = Warning[:experimental]
+    Warning[:experimental] = false
+  end
+
+  def teardown
+    Warning[:experimental] = @experimental
+  end
+
+  def test_constants
+    r = Ractor.new do
+      [ SleepyPenguin::SLEEPY_PENGUIN_VERSION, SleepyPenguin::Epoll::IN,
+        SleepyPenguin::Epoll::Dispatcher.name ]
+    end
+    version, events, name = r.take
+    assert_equal SleepyPenguin::SLEEPY_PENGUIN_VERSION, version
+    assert_equal SleepyPenguin::Epoll::IN, events
+    assert_equal 'SleepyPenguin::Epoll::Dispatcher', name
+  end
+
+  def test_event_loops
+    rs = Array.new(4) do |i|
+      Ractor.new(i) do |i|
+        sp = SleepyPenguin
+        ep = sp::Epoll.new
+        efd = sp::EventFD.new(0, :NONBLOCK)
+        tfd = sp::TimerFD.new(:MONOTONIC)
+        ep.add(efd, sp::Epoll::IN)
+        ep.add(tfd, sp::Epoll::IN)
+        tfd.settime(nil, 0.001, 0.001)
+        efd.incr(i + 1)
+        got = { efd: 0, tfd: 0 }
+        until got[:efd] > 0 && got[:tfd] >= 3
+          ep.wait(8, 1000) do |_, io|
+            if io == efd
+              got[:efd] += efd.value(true).to_i
+            else
+              got[:tfd] += tfd.expirations(true).to_i
+            end
+          end
+        end
+        [ ep, efd, tfd ].each(&:close)
+        [ i, got[:efd] ]
+      end
+    end
+    assert_equal [ [0, 1], [1, 2], [2, 3], [3, 4] ], rs.map(&:take).sort
+  end
+
+  def test_sigmask
+    r = Ractor.new do
+      epio = SleepyPenguin::Epoll::IO.new(nil)
+      rv = epio.epoll_pwait(1, 0, [ :USR1, 'SIGUSR2', 'HUP' ]) { }
+      epio.close
+      rv
+    end
+    assert_equal 0, r.take
+  end if SleepyPenguin::Epoll::IO.method_defined?(:epoll_pwait)
+
+  def test_inotify
+    require 'tmpdir'
+    Dir.mktmpdir do |dir|
+      r = Ractor.new(dir) do |dir|
+        ino = SleepyPenguin::Inotify.new
+        ino.add_watch(dir, :CREATE)
+        File.open("#{dir}/x", 'w').close
+        events = ino.take.events
+        ino.close
+        events
+      end
+      assert_equal [ :CREATE ], r.take
+    end
+  end if defined?(SleepyPenguin::Inotify)
+end if defined?(Ractor) && defined?(SleepyPenguin::Epoll)
@@ -0,0 +1,156 @@
+require 'test/unit'
+$-w = true
+require 'sleepy_penguin'
+
+class TestStats < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @rd, @wr = IO.pipe
+  end
+
+  def teardown
+    [ @rd, @wr ].each { |io| io.close unless io.closed? }
+  end
+
+  def delta(kind)
+    before = SleepyPenguin.stats[kind]
+    yield
+    after = SleepyPenguin.stats[kind]
+    rv = {}
+    before.each do |k, v|
+      rv[k] = k == :histogram ? after[k].zip(v).map { |a, b| a - b } :
+              after[k] - v
+    end
+    rv
+  end
+
+  def test_snapshot
+    stats = SleepyPenguin.stats
+    assert_kind_of Hash, stats
+    [ :epoll, :inotify, :eventfd, :timerfd, :signalfd ].each do |kind|
+      s = stats[kind]
+      assert_kind_of Hash, s, kind.inspect
+      [ :syscalls, :eintr, :eagain, :nogvl_ns, :batches, :events ].each do |k|
+        assert_kind_of Integer, s[k], "#{kind} #{k}"
+      end
+      assert_equal 17, s[:histogram].size
+    end
+  end
+
+  def test_epoll_object
+    ep = Epoll.new
+    assert_equal 0, SleepyPenguin.stats(ep)[:syscalls]
+    ep.set(@wr, Epoll::OUT)
+    ep.set(@wr, Epoll::OUT)
+    assert_equal 1, SleepyPenguin.stats(ep)[:syscalls]
+    ep.set(@wr, Epoll::OUT | Epoll::ONESHOT)
+    assert_equal 2, SleepyPenguin.stats(ep)[:syscalls]
+
+    ep.add(@rd, Epoll::IN)
+    @wr.write('.')
+    ep.wait(8, 0) { }
+    s = SleepyPenguin.stats(ep)
+    assert_equal 4, s[:syscalls]
+    assert_equal 1, s[:batches]
+    assert_equal 2, s[:events]
+    assert_equal 1, s[:histogram][2]
+    assert_equal 0, s[:nogvl_ns], 'zero timeout keeps the GVL'
+
+    ep.wait(8, 0) { } # only @rd is left, ONESHOT @wr fired
+    s = SleepyPenguin.stats(ep)
+    assert_equal 1, s[:histogram][1]
+    assert_equal 3, s[:events]
+  ensure
+    ep.close if ep
+  end
+
+  def test_epoll_process
+    ep = Epoll.new
+    d = delta(:epoll) do
+      ep.add(@rd, Epoll::IN)
+      assert_equal 0, ep.wait(8, 0) { }
+    end
+    assert_operator d[:syscalls], :>=, 2
+    assert_operator d[:batches], :>=, 1
+    assert_operator d[:histogram][0], :>=, 1
+  ensure
+    ep.close if ep
+  end
+
+  def test_threads
+    efd = EventFD.new(0)
+    SleepyPenguin.stats(efd)
+    d = delta(:eventfd) do
+      4.times.map { Thread.new { 10.times { efd.incr(1) } } }.each(&:join)
+    end
+    assert_operator d[:syscalls], :>=, 40
+    assert_equal 40, SleepyPenguin.stats(efd)[:syscalls]
+    assert_equal 40, efd.value
+  ensure
+    efd.close if efd
+  end
+
+  def test_eagain
+    efd = EventFD.new(0)
+    SleepyPenguin.stats(efd)
+    assert_nil efd.value(true)
+    s = SleepyPenguin.stats(efd)
+    assert_equal 1, s[:eagain]
+    assert_equal 0, s[:nogvl_ns], 'nonblocking calls keep the GVL'
+  ensure
+    efd.close if efd
+  end if defined?(SleepyPenguin::EventFD)
+
+  def test_timerfd
+    tfd = TimerFD.new
+    SleepyPenguin.stats(tfd)
+    tfd.settime(nil, 0, 0.001)
+    assert_equal 1, tfd.expirations
+    s = SleepyPenguin.stats(tfd)
+    assert_equal 2, s[:syscalls]
+    assert_operator s[:nogvl_ns], :>, 0
+
+    # blocking calls on O_NONBLOCK descriptors only release the GVL to wait
+    assert_nil tfd.expirations(true)
+    tfd.settime(nil, 0, 0.001)
+    assert_equal 1, tfd.expirations
+    s = SleepyPenguin.stats(tfd)
+    assert_equal 6, s[:syscalls]
+    assert_equal 2, s[:eagain]
+  ensure
+    tfd.close if tfd
+  end if defined?(SleepyPenguin::TimerFD)
+
+  def test_inotify
+    require 'tempfile'
+    ino = Inotify.new
+    SleepyPenguin.stats(ino)
+    tmp = Tempfile.new('stats')
+    ino.add_watch(tmp.path, :OPEN)
+    File.open(tmp.path).close
+    File.open(tmp.path).close
+    sleep 0.01
+    ino.take
+    s = SleepyPenguin.stats(ino)
+    assert_operator s[:syscalls], :>=, 2
+    assert_operator s[:events], :>=, 1
+    assert_equal s[:batches], s[:histogram].inject(:+)
+  ensure
+    ino.close if ino
+    tmp.close! if tmp
+  end if defined?(SleepyPenguin::Inotify)
+
+  def test_fork
+    ep = Epoll.new
+    ep.add(@rd, Epoll::IN)
+    before = SleepyPenguin.stats[:epoll][:syscalls]
+    pid = fork do
+      exit!(SleepyPenguin.stats[:epoll][:syscalls] >= before)
+    end
+    _, status = Process.waitpid2(pid)
+    assert status.success?
+  ensure
+    ep.close if ep
+  end
+end if defined?(SleepyPenguin::Epoll)
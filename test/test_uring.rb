@@ -0,0 +1,197 @@
+require 'test/unit'
+require 'socket'
+require 'thread'
+$-w = true
+Thread.abort_on_exception = true
+require 'sleepy_penguin'
+
+class TestUring < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @uring = Uring.new
+    @rd, @wr = IO.pipe
+  rescue Errno::ENOSYS, Errno::EPERM
+    omit "io_uring unavailable: #$!"
+  end
+
+  def teardown
+    [ @uring, @rd, @wr ].each { |io| io.close if io && !io.closed? }
+  end
+
+  def events(timeout = 0, maxevents = 64)
+    ev = []
+    n = @uring.wait(maxevents, timeout) { |events, io| ev << [ events, io ] }
+    assert_equal n, ev.size
+    ev
+  end
+
+  def test_level_triggered
+    assert_equal 0, @uring.add(@rd, Uring::IN)
+    assert_equal [], events
+    @wr.syswrite '.'
+    assert_equal [[ Uring::IN, @rd ]], events(1000)
+    assert_equal [[ Uring::IN, @rd ]], events(1000)
+    @rd.sysread(1)
+    assert_equal [], events
+  end
+
+  def test_symbols
+    @uring.add(@wr, [ :OUT ])
+    assert_equal Uring::OUT, @uring.events_for(@wr)
+    assert_equal [[ Uring::OUT, @wr ]], events
+  end
+
+  def test_edge_triggered
+    @uring.add(@rd, Uring::IN | Uring::ET)
+    @wr.syswrite '.'
+    assert_equal [[ Uring::IN, @rd ]], events(1000)
+    assert_equal [], events
+    @wr.syswrite '.'
+    assert_equal [[ Uring::IN, @rd ]], events(1000)
+  end
+
+  def test_oneshot_mod
+    @uring.add(@wr, Uring::OUT | Uring::ONESHOT)
+    assert_equal [[ Uring::OUT, @wr ]], events(1000)
+    assert_equal [], events
+    assert_equal 0, @uring.mod(@wr, Uring::OUT | Uring::ONESHOT)
+    assert_equal [[ Uring::OUT, @wr ]], events(1000)
+    assert_equal [], events
+  end
+
+  def test_mod_changes_events
+    @uring.add(@wr, Uring::OUT)
+    @uring.mod(@wr, Uring::IN)
+    assert_equal [], events(10)
+    assert_equal Uring::IN, @uring.events_for(@wr)
+  end
+
+  def test_del
+    assert_raises(Errno::ENOENT) { @uring.del(@wr) }
+    assert_raises(Errno::ENOENT) { @uring.mod(@wr, Uring::OUT) }
+    @uring.add(@wr, Uring::OUT)
+    assert_raises(Errno::EEXIST) { @uring.add(@wr, Uring::OUT) }
+    assert @uring.include?(@wr)
+    assert_equal @wr, @uring.io_for(@wr)
+    assert_equal 0, @uring.del(@wr)
+    assert ! @uring.include?(@wr)
+    assert_nil @uring.io_for(@wr)
+    assert_nil @uring.events_for(@wr)
+    assert_equal [], events(10)
+  end
+
+  def test_add_closed_leftover
+    rd, wr = IO.pipe
+    @uring.add(wr, Uring::OUT)
+    fd = wr.fileno
+    wr.close # without del
+    io = @wr.dup
+    if io.fileno == fd
+      assert_equal 0, @uring.add(io, Uring::OUT)
+      assert_equal [[ Uring::OUT, io ]], events(1000)
+    end
+  ensure
+    rd.close if rd
+    io.close if io
+  end
+
+  def test_timeout
+    @uring.add(@rd, Uring::IN)
+    t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    assert_equal [], events(20)
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+    assert_operator elapsed, :>=, 0.02
+    assert_operator elapsed, :<, 1
+  end
+
+  def test_maxevents
+    pipes = (1..4).map { IO.pipe }
+    pipes.each { |_, wr| @uring.add(wr, Uring::OUT) }
+    assert_equal 2, events(1000, 2).size
+    assert_raises(Errno::EINVAL) { @uring.wait(0, 0) { } }
+  ensure
+    pipes.flatten.each(&:close) if pipes
+  end
+
+  def test_many_changes
+    uring = Uring.new(4)
+    pipes = (1..64).map { IO.pipe }
+    pipes.each { |_, wr| uring.add(wr, Uring::OUT | Uring::ONESHOT) }
+    seen = {}
+    while seen.size < pipes.size
+      uring.wait(64, 1000) { |_, io| seen[io] = true }
+    end
+    assert_equal pipes.map { |_, wr| wr }.sort_by(&:fileno),
+                 seen.keys.sort_by(&:fileno)
+  ensure
+    uring.close if uring
+    pipes.flatten.each(&:close) if pipes
+  end
+
+  def test_add_while_waiting
+    thr = Thread.new { events(nil) }
+    Thread.pass until thr.stop?
+    sleep 0.05
+    @uring.add(@wr, Uring::OUT)
+    assert_equal [[ Uring::OUT, @wr ]], thr.value
+  end
+
+  def test_close_while_waiting
+    thr = Thread.new do
+      begin
+        events(nil)
+      rescue IOError => e
+        e
+      end
+    end
+    Thread.pass until thr.stop?
+    sleep 0.05
+    @uring.close
+    assert_kind_of IOError, thr.value
+    assert @uring.closed?
+    assert_raises(IOError) { @uring.close }
+    assert_raises(IOError) { @uring.add(@rd, Uring::IN) }
+  end
+
+  def test_to_io
+    @uring.add(@wr, Uring::OUT)
+    assert_nil @uring.submit
+    r = IO.select([ @uring ], nil, nil, 1)
+    assert_equal [ @uring ], r[0]
+    assert_equal [[ Uring::OUT, @wr ]], events
+
+    # zero timeouts submit the requeued poll, too
+    r = IO.select([ @uring ], nil, nil, 1)
+    assert_equal [ @uring ], r[0]
+  end
+
+  def test_fork
+    @uring.add(@wr, Uring::OUT)
+    rd, wr = IO.pipe
+    pid = fork do
+      rd.close
+      ok = ! @uring.include?(@wr) && events(10) == []
+      @uring.add(@wr, Uring::OUT)
+      ok &&= events(1000) == [[ Uring::OUT, @wr ]]
+      wr.syswrite(ok ? "ok" : "fail")
+      exit!(0)
+    end
+    wr.close
+    assert_equal "ok", rd.read
+    _, status = Process.waitpid2(pid)
+    assert status.success?
+    rd.close
+    assert_equal [[ Uring::OUT, @wr ]], events(1000)
+  end
+
+  def test_poller
+    poller = Uring.poller
+    assert_kind_of Uring, poller
+    poller.close
+  end
+
+  def test_dup
+    assert_raises(NoMethodError) { @uring.dup }
+  end
+end if defined?(SleepyPenguin::Uring)
@@ -0,0 +1,201 @@
+require 'test/unit'
+require 'tempfile'
+$-w = true
+require 'sleepy_penguin'
+
+class TestUringFile < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @uf = Uring::File.new
+    @tmp = Tempfile.new('uring_file')
+    @tmp.sync = true
+  rescue Errno::ENOSYS, Errno::EPERM
+    omit "io_uring unavailable: #$!"
+  end
+
+  def teardown
+    @uf.close if @uf && !@uf.closed?
+    @tmp.close! if @tmp
+  end
+
+  def completions(uf = @uf)
+    res = {}
+    uf.wait(1000) { |tag, result| res[tag] = result } while uf.inflight > 0
+    res
+  end
+
+  def test_write_read
+    assert_equal :w, @uf.write(@tmp, "hello world", 0, :w)
+    assert_equal 1, @uf.inflight
+    assert_equal 1, @uf.submit
+    assert_equal({ :w => 11 }, completions)
+    assert_equal "hello world", File.read(@tmp.path)
+
+    @uf.read(@tmp, 5, 6, :a)
+    @uf.read(@tmp, 5, 0, :b)
+    @uf.read(@tmp, 5, 1000, :c)
+    res = completions
+    assert_equal({ :a => "world", :b => "hello", :c => "" }, res)
+    assert_equal Encoding::BINARY, res[:a].encoding
+    assert_equal 0, @uf.inflight
+  end
+
+  def test_default_tags
+    a = @uf.write(@tmp, "a", 0)
+    b = @uf.fsync(@tmp)
+    assert_kind_of Integer, a
+    assert_kind_of Integer, b
+    assert_not_equal a, b
+    assert_equal({ a => 1, b => 0 }, completions)
+  end
+
+  def test_fsync
+    @uf.write(@tmp, "x", nil, :w)
+    assert_equal({ :w => 1 }, completions)
+    @uf.fsync(@tmp, true, :fdatasync)
+    @uf.fsync(@tmp, false, :fsync)
+    assert_equal({ :fdatasync => 0, :fsync => 0 }, completions)
+  end
+
+  def test_current_position
+    @uf.write(@tmp, "abc", nil, 1)
+    completions
+    @uf.write(@tmp, "def", nil, 2)
+    completions
+    assert_equal "abcdef", File.read(@tmp.path)
+  end
+
+  def test_error
+    rd, wr = IO.pipe
+    @uf.write(rd, "x", nil, :bad)
+    res = completions
+    assert_kind_of SystemCallError, res[:bad]
+  ensure
+    rd.close if rd
+    wr.close if wr
+  end
+
+  def test_modify_after_queue
+    str = "hello".dup
+    @uf.write(@tmp, str, 0, :w)
+    str.replace("HELLO")
+    assert_equal({ :w => 5 }, completions)
+    assert_equal "hello", File.read(@tmp.path)
+  end
+
+  def test_eventfd_epoll
+    ep = Epoll.new
+    ep.add(@uf.eventfd, Epoll::IN)
+    assert_kind_of EventFD, @uf.eventfd
+    @uf.write(@tmp, "x" * 4096, 0, :w)
+    assert_equal 0, ep.wait(1, 0) { }
+    @uf.submit
+    res = {}
+    while res.empty?
+      ep.wait(1, 1000) do |_, io|
+        assert_equal @uf.eventfd, io
+        @uf.reap { |tag, result| res[tag] = result }
+      end
+    end
+    assert_equal({ :w => 4096 }, res)
+
+    # reap resets the EventFD
+    assert_equal 0, ep.wait(1, 0) { }
+    assert_equal 0, @uf.reap { }
+  ensure
+    ep.close if ep
+  end
+
+  def test_many
+    uf = Uring::File.new(4)
+    100.times { |i| uf.write(@tmp, i.chr, i, i) }
+    res = completions(uf)
+    assert_equal 100, res.size
+    assert res.values.all? { |v| v == 1 }
+    assert_equal (0...100).map(&:chr).join, File.binread(@tmp.path)
+  ensure
+    uf.close if uf
+  end
+
+  def test_break_keeps_completions
+    3.times { |i| @uf.write(@tmp, "x", i, i) }
+    @uf.submit
+    sleep 0.05
+    tags = []
+    @uf.reap { |tag, _| tags << tag; break }
+    assert_equal 1, tags.size
+    @uf.reap { |tag, _| tags << tag } while @uf.inflight > 0
+    assert_equal [ 0, 1, 2 ], tags.sort
+  end
+
+  def test_gc_compact
+    @uf.read(@tmp, 4096, 0, :r)
+    @uf.write(@tmp, "y" * 4096, 8192, :w)
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    assert_equal({ :r => "", :w => 4096 }, completions)
+  rescue NotImplementedError
+  end
+
+  def test_wait_nothing_inflight
+    assert_equal 0, @uf.wait(0) { }
+    assert_equal 0, @uf.wait { }
+  end
+
+  def test_close
+    efd = @uf.eventfd
+    assert_nil @uf.close
+    assert @uf.closed?
+    assert efd.closed?
+    assert_raises(IOError) { @uf.read(@tmp, 1) }
+  end
+
+  def test_close_inflight
+    rd, wr = IO.pipe
+    @uf.read(rd, 16, nil, :pipe) # never completes on its own
+    @uf.read(@tmp, 16, 0, :file)
+    @uf.submit
+    assert_nil @uf.close
+    assert @uf.closed?
+  ensure
+    rd.close if rd
+    wr.close if wr
+  end
+
+  def inflight_ref
+    uf = Uring::File.new
+    uf.read(@tmp, 16, 0, :r)
+    uf.submit
+    WeakRef.new(uf)
+  end
+
+  def test_gc_inflight
+    require 'weakref'
+    ref = inflight_ref
+    GC.start
+    assert ref.weakref_alive?, 'kernel may still write into its buffers'
+    uf = ref.__getobj__
+    assert_equal({ :r => "" }, completions(uf))
+    uf.close
+  end
+
+  def test_fork
+    @uf.write(@tmp, "parent", 0, :parent)
+    rd, wr = IO.pipe
+    pid = fork do
+      rd.close
+      ok = @uf.inflight == 0
+      @uf.write(@tmp, "child", 100, :child)
+      ok &&= completions == { :child => 5 }
+      wr.syswrite(ok ? "ok" : "fail")
+      exit!(0)
+    end
+    wr.close
+    assert_equal "ok", rd.read
+    _, status = Process.waitpid2(pid)
+    assert status.success?
+    rd.close
+    assert_equal({ :parent => 6 }, completions)
+  end
+end if defined?(SleepyPenguin::Uring::File)
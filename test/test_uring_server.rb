@@ -0,0 +1,198 @@
+require 'test/unit'
+require 'socket'
+$-w = true
+require 'sleepy_penguin'
+
+class TestUringServer < Test::Unit::TestCase
+  include SleepyPenguin
+
+  def setup
+    @srv = nil
+    @clients = []
+    @listener = TCPServer.new('127.0.0.1', 0)
+    @port = @listener.addr[1]
+  end
+
+  def teardown
+    @srv.close if @srv && !@srv.closed?
+    @clients.each { |c| c.close unless c.closed? }
+    @listener.close
+  end
+
+  def server(opts = {})
+    @srv = Uring::Server.new(@listener, opts)
+  rescue Errno::ENOSYS, Errno::EPERM
+    omit "io_uring unavailable: #$!"
+  end
+
+  def connect
+    c = TCPSocket.new('127.0.0.1', @port)
+    @clients << c
+    c
+  end
+
+  # collects data per connection until +n+ connections hit EOF
+  def collect(n)
+    data = Hash.new { |h, k| h[k] = ''.b }
+    eof = 0
+    deadline = Time.now + 5
+    while eof < n
+      flunk 'timed out' if Time.now > deadline
+      @srv.wait(1000) do |conn, str|
+        if str
+          data[conn] << str
+        else
+          eof += 1
+          conn.close
+        end
+      end
+    end
+    data
+  end
+
+  def test_accept_and_read
+    server
+    c = connect
+    c.write('hello')
+    c.close_write
+    res = []
+    until res[-1] && res[-1][1].nil?
+      @srv.wait(1000) { |conn, str| res << [ conn, str ] }
+    end
+    conn = res[0][0]
+    assert_kind_of BasicSocket, conn
+    assert_equal [ '', 'hello', nil ], res.map { |x| x[1] }
+    assert res.all? { |x| x[0].equal?(conn) }
+    assert_equal Encoding::BINARY, res[1][1].encoding
+    assert ! @srv.include?(conn)
+
+    conn.write('bye')
+    conn.close
+    assert_equal 'bye', c.read
+  end
+
+  def test_small_buffers
+    server(:buffers => 2, :buffer_size => 7)
+    msgs = (0...8).map { |i| (i.to_s * 5000).b }
+    clients = msgs.map do |msg|
+      c = connect
+      c.write(msg)
+      c.close_write
+      c
+    end
+    data = collect(clients.size)
+    assert_equal msgs.sort, data.values.sort
+  end
+
+  def test_epoll
+    server
+    ep = Epoll.new
+    ep.add(@srv, Epoll::IN)
+    c = connect
+    c.write('a')
+    res = []
+    while res.size < 2
+      ep.wait(8, 1000) do |_, io|
+        assert_same @srv, io
+        @srv.reap { |conn, str| res << str }
+      end
+    end
+    assert_equal [ '', 'a' ], res
+    assert_equal 0, ep.wait(8, 0) { }
+  ensure
+    ep.close if ep
+  end
+
+  def test_del
+    server
+    c = connect
+    conn = nil
+    @srv.wait(1000) { |x, str| conn = x } until conn
+    assert @srv.include?(conn)
+    assert_same conn, @srv.del(conn)
+    assert_nil @srv.del(conn)
+    assert ! @srv.include?(conn)
+    conn.close
+    assert_equal '', c.read # peer sees EOF
+  end
+
+  def test_del_drops_pending
+    server
+    c = connect
+    conn = nil
+    @srv.wait(1000) { |x, str| conn = x } until conn
+    c.write('ignored')
+    sleep 0.05
+    @srv.del(conn)
+    assert_equal 0, @srv.wait(0) { flunk 'yielded after del' }
+    conn.close
+  end
+
+  def test_class
+    server(:class => IO)
+    connect
+    conn = nil
+    @srv.wait(1000) { |x, _| conn = x } until conn
+    assert_instance_of IO, conn
+    @srv.del(conn)
+    conn.close
+  end
+
+  def test_class_raises
+    fds = []
+    klass = Class.new(IO)
+    klass.define_singleton_method(:for_fd) { |fd| fds << fd; raise 'nope' }
+    server(:class => klass)
+    connect
+    assert_raises(RuntimeError) { @srv.wait(1000) { } while fds.empty? }
+    assert_raises(Errno::EBADF) { IO.for_fd(fds[0], autoclose: false) }
+  end
+
+  def test_bad_args
+    assert_raises(ArgumentError) { Uring::Server.new(@listener, :buffers => 3) }
+    assert_raises(ArgumentError) do
+      Uring::Server.new(@listener, :buffer_size => 0)
+    end
+    assert_raises(TypeError) { Uring::Server.new(@listener, 1) }
+  end
+
+  def test_close
+    server
+    @srv.close
+    assert @srv.closed?
+    assert ! @listener.closed?
+    assert_raises(IOError) { @srv.wait(0) { } }
+  end
+
+  def test_gc_compact
+    server(:buffers => 4, :buffer_size => 64)
+    c = connect
+    c.write('x' * 1000)
+    c.close_write
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    assert_equal [ 'x' * 1000 ], collect(1).values
+  rescue NotImplementedError
+  end
+
+  def test_fork
+    server
+    rd, wr = IO.pipe
+    pid = fork do
+      rd.close
+      data = collect(1)
+      wr.syswrite(data.values.join)
+      exit!(0)
+    end
+    wr.close
+    # the parent stops accepting, so the child gets the connection
+    @srv.close
+    c = connect
+    c.write('child')
+    c.close_write
+    assert_equal 'child', rd.read
+    _, status = Process.waitpid2(pid)
+    assert status.success?
+    rd.close
+  end
+end if defined?(SleepyPenguin::Uring::Server)